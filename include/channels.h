@@ -37,9 +37,160 @@
 class CoreExport Channel : public Extensible
 {
  public:
-	/** A map of Memberships on a channel keyed by User pointers
-	 */
- 	typedef std::map<User*, insp::aligned_storage<Membership> > MemberMap;
+	/** The Memberships on a channel, indexed by User pointers.
+	 * Members are stored in a contiguous array so iterating them is cheap. The Membership objects
+	 * are allocated separately, pointers to them remain valid until the member leaves.
+	 * Removing a member moves the last member into its place, which invalidates iterators. To remove
+	 * members while iterating, collect them first.
+	 * Local members are also kept in an array of their own so code sending data to the members of a
+	 * channel doesn't have to visit remote members, together with the number of local members
+	 * having each prefix mode as their highest one.
+	 */
+	class CoreExport MemberMap
+	{
+	 public:
+		typedef std::pair<User*, Membership*> value_type;
+		typedef std::vector<value_type> List;
+		typedef List::iterator iterator;
+		typedef List::const_iterator const_iterator;
+
+		typedef std::pair<LocalUser*, Membership*> local_value_type;
+		typedef std::vector<local_value_type> LocalList;
+
+	 private:
+		typedef TR1NS::unordered_map<User*, Membership*> Index;
+		typedef insp::flat_map<char, size_t> PrefixCountMap;
+
+		/** All members
+		 */
+		List members;
+
+		/** Local members
+		 */
+		LocalList localmembers;
+
+		/** Index of all members keyed by User pointers
+		 */
+		Index index;
+
+		/** Number of local members keyed by the mode char of their highest prefix mode.
+		 * Members without prefix modes are not counted.
+		 */
+		PrefixCountMap localprefixcounts;
+
+		/** Adjust the number of local members whose highest prefix mode is the given one
+		 * @param prefix Mode char of the prefix mode, or 0 for no prefix mode
+		 * @param adding True to count one more member, false to count one less
+		 */
+		void CountPrefix(char prefix, bool adding)
+		{
+			if (!prefix)
+				return;
+
+			if (adding)
+				localprefixcounts[prefix]++;
+			else if (--localprefixcounts[prefix] == 0)
+				localprefixcounts.erase(prefix);
+		}
+
+	 public:
+		iterator begin() { return members.begin(); }
+		iterator end() { return members.end(); }
+		const_iterator begin() const { return members.begin(); }
+		const_iterator end() const { return members.end(); }
+		size_t size() const { return members.size(); }
+		bool empty() const { return members.empty(); }
+
+		/** Get the local members
+		 * @return Array of the local members
+		 */
+		const LocalList& GetLocal() const { return localmembers; }
+
+		/** Count the local members having at least the given prefix rank
+		 * @param minrank Minimum rank, members with a lower rank are not counted
+		 * @return Number of local members with the given rank or higher
+		 */
+		size_t CountLocal(unsigned int minrank) const;
+
+		/** Update the prefix mode counts after the prefix modes of a member changed
+		 * @param memb Membership whose prefix modes changed
+		 * @param oldprefix Mode char of the highest prefix mode the member had before the change,
+		 * or 0 if the member had no prefix modes
+		 */
+		void UpdatePrefix(Membership* memb, char oldprefix)
+		{
+			if (!IS_LOCAL(memb->user))
+				return;
+
+			const char newprefix = (memb->modes.empty() ? 0 : memb->modes[0]);
+			if (newprefix == oldprefix)
+				return;
+
+			CountPrefix(oldprefix, false);
+			CountPrefix(newprefix, true);
+		}
+
+		/** Find the Membership of a user
+		 * @param user User to find
+		 * @return Membership of the user or NULL if the user is not a member
+		 */
+		Membership* Get(User* user) const
+		{
+			Index::const_iterator it = index.find(user);
+			return (it != index.end() ? it->second : NULL);
+		}
+
+		iterator find(User* user)
+		{
+			Membership* memb = Get(user);
+			return (memb ? members.begin() + memb->pos : members.end());
+		}
+
+		const_iterator find(User* user) const
+		{
+			Membership* memb = Get(user);
+			return (memb ? members.begin() + memb->pos : members.end());
+		}
+
+		/** Add a member, the user must not be a member already
+		 * @param memb Membership to add
+		 */
+		void insert(Membership* memb)
+		{
+			index[memb->user] = memb;
+			memb->pos = members.size();
+			members.push_back(std::make_pair(memb->user, memb));
+
+			LocalUser* const localuser = IS_LOCAL(memb->user);
+			if (localuser)
+			{
+				memb->localpos = localmembers.size();
+				localmembers.push_back(std::make_pair(localuser, memb));
+				CountPrefix((memb->modes.empty() ? 0 : memb->modes[0]), true);
+			}
+		}
+
+		/** Remove a member, the Membership object is not destroyed
+		 * @param memb Membership to remove
+		 */
+		void erase(Membership* memb)
+		{
+			index.erase(memb->user);
+
+			// Move the last member into the place of the removed one
+			members[memb->pos] = members.back();
+			members[memb->pos].second->pos = memb->pos;
+			members.pop_back();
+
+			if (IS_LOCAL(memb->user))
+			{
+				CountPrefix((memb->modes.empty() ? 0 : memb->modes[0]), false);
+				localmembers[memb->localpos] = localmembers.back();
+				localmembers[memb->localpos].second->localpos = memb->localpos;
+				localmembers.pop_back();
+			}
+		}
+	};
 
  private:
 	/** Set default modes for the channel on creation
@@ -55,11 +206,13 @@ class CoreExport Channel : public Extensible
 	/** Remove the given membership from the channel's internal map of
 	 * memberships and destroy the Membership object.
 	 * This function does not remove the channel from User::chanlist.
-	 * Since the parameter is an iterator to the target, the complexity
-	 * of this function is constant.
-	 * @param membiter The MemberMap iterator to remove, must be valid
+	 * The complexity of this function is constant.
+	 * @param memb The Membership to remove, must be a member of this channel
 	 */
-	void DelUser(const MemberMap::iterator& membiter);
+	void DelUser(Membership* memb);
+
+	/** Changed by InvalidateListCache(), see GetListModeGen() */
+	uint64_t listmodegen;
 
  public:
 	/** Creates a channel record and initialises it with default values
@@ -92,6 +245,9 @@ class CoreExport Channel : public Extensible
 	 */
 	MemberMap userlist;
 
+	// Updates the prefix mode counts of userlist
+	friend class Membership;
+
 	/** Channel topic.
 	 * If this is an empty string, no channel topic is set.
 	 */
@@ -328,6 +484,19 @@ class CoreExport Channel : public Extensible
 	 */
 	bool IsBanned(User* user);
 
+	/** Get a value which changes whenever an entry is added to or removed from the list of any
+	 * list mode on this channel. Ban check results cached by members are valid while this and
+	 * the identity generation of the user (see User::GetIdentityGen()) are unchanged.
+	 * @return The current list mode generation of the channel
+	 */
+	uint64_t GetListModeGen() const { return listmodegen; }
+
+	/** Discard the ban check results cached by the members of this channel.
+	 * Called by ListModeBase whenever a list changes, modules which keep lists
+	 * or state checked by OnCheckChannelBan or OnExtBanCheck should call it too.
+	 */
+	void InvalidateListCache();
+
 	/** Check a single ban for match
 	 */
 	bool CheckBan(User* user, const std::string& banmask);
@@ -344,7 +513,7 @@ class CoreExport Channel : public Extensible
 
 inline bool Channel::HasUser(User* user)
 {
-	return (userlist.find(user) != userlist.end());
+	return (userlist.Get(user) != NULL);
 }
 
 inline std::string Channel::GetModeParameter(ChanModeReference& mode)
@@ -33,16 +33,52 @@ class CoreExport CommandParser
  	typedef TR1NS::unordered_map<std::string, Command*, irc::insensitive, irc::StrHashComp> CommandMap;
 
  private:
+	/** Holds the name and parameters of a command while it is being processed.
+	 * The strings are reused by the next command processed at the same nesting level so
+	 * parsing a line usually does not allocate memory.
+	 */
+	struct ParseBuffer
+	{
+		std::string command;
+		std::vector<std::string> params;
+	};
+
 	/** Process a command from a user.
 	 * @param user The user to parse the command for
 	 * @param cmd The command string to process
 	 */
 	void ProcessCommand(LocalUser* user, std::string& cmd);
 
+	/** Process a command from a user after it was split into its name and parameters.
+	 * @param user The user to parse the command for
+	 * @param cmd The command string to process
+	 * @param command The name of the command, in uppercase
+	 * @param command_p The parameters of the command
+	 */
+	void ProcessCommand(LocalUser* user, std::string& cmd, std::string& command, std::vector<std::string>& command_p);
+
+	/** Rebuild the command lookup table from the command list.
+	 */
+	void RebuildTable();
+
 	/** Command list, a hash_map of command names to Command*
 	 */
 	CommandMap cmdlist;
 
+	/** Open addressing hash table of all commands used by GetHandler(), rebuilt whenever
+	 * a command is added or removed. The size is a power of two and empty slots are NULL.
+	 */
+	std::vector<Command*> cmdtable;
+
+	/** Parse buffers, one for each level of nesting of ProcessCommand(), as modules may
+	 * process a command from within another command.
+	 */
+	std::deque<ParseBuffer> parsebuffers;
+
+	/** Current nesting level of ProcessCommand()
+	 */
+	size_t parsedepth;
+
  public:
 	/** Default constructor.
 	 */
@@ -112,6 +148,15 @@ class CoreExport CommandParser
 	 */
 	static bool LoopCall(User* user, Command* handler, const std::vector<std::string>& parameters, unsigned int splithere, int extra = -1, bool usemax = true);
 
+	/** Split a line sent by a client into the command name and its parameters the same way as irc::tokenstream does.
+	 * A source prefix before the command name is skipped, the command name is not converted to uppercase.
+	 * Strings already in the parameter vector are reused to avoid allocating memory.
+	 * @param line The line to split
+	 * @param command The command name will be written here
+	 * @param params The parameters will be written here
+	 */
+	static void SplitLine(const std::string& line, std::string& command, std::vector<std::string>& params);
+
 	/** Take a raw input buffer from a recvq, and process it on behalf of a user.
 	 * @param buffer The buffer line to process
 	 * @param user The user to whom this line belongs
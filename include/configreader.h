@@ -341,6 +341,12 @@ class CoreExport ServerConfig
 	 */
 	int NetBufferSize;
 
+	/** The number of threads used to write queued data to
+	 * client sockets in parallel, 0 if writes are done by
+	 * the main thread only.
+	 */
+	unsigned int IOThreads;
+
 	/** The value to be used for listen() backlogs
 	 * as default.
 	 */
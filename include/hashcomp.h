@@ -53,6 +53,11 @@
  */
 CoreExport extern unsigned const char *national_case_insensitive_map;
 
+/** Incremented whenever the contents of national_case_insensitive_map change. Anything which
+ * has been folded with the national case map must be folded again once this changes.
+ */
+CoreExport extern unsigned long national_case_map_generation;
+
 /** A mapping of uppercase to lowercase, including scandinavian
  * 'oddities' as specified by RFC1459, e.g. { -> [, and | -> \
  */
@@ -75,6 +75,7 @@ struct fakederef
 #include "numerics.h"
 #include "numeric.h"
 #include "uid.h"
+#include "wildcard.h"
 #include "server.h"
 #include "users.h"
 #include "channels.h"
@@ -26,6 +26,7 @@
 #include "timer.h"
 
 class IOHook;
+class IOHookMiddle;
 
 /**
  * States which a socket may be in
@@ -108,9 +109,92 @@ class CoreExport StreamSocket : public EventHandler
 	class SendQueue
 	{
 	 public:
-		/** One element of the queue, a continuous buffer
+		/** One element of the queue, a continuous immutable buffer.
+		 * Copying an element does not copy the data it refers to, the same buffer
+		 * may be shared by any number of send queues (e.g. when a line is sent to
+		 * all members of a channel).
 		 */
-		typedef std::string Element;
+		class Element
+		{
+			/** Refcounted storage holding the contents of one or more elements
+			 */
+			class Buffer : public refcountbase
+			{
+			 public:
+				std::string str;
+				Buffer() { }
+				Buffer(const std::string& s) : str(s) { }
+				Buffer(const char* s, std::string::size_type len) : str(s, len) { }
+			};
+
+			/** Shared buffer, NULL if the element is empty
+			 */
+			reference<Buffer> buf;
+
+			/** Offset of the first unsent byte in the shared buffer
+			 */
+			std::string::size_type start;
+
+		 public:
+			typedef std::string::size_type size_type;
+
+			/** Create an empty element
+			 */
+			Element() : start(0) { }
+
+			/** Create an element holding a copy of the given data
+			 * @param str Data to put into the new buffer
+			 */
+			Element(const std::string& str) : buf(new Buffer(str)), start(0) { }
+
+			/** Create an element holding a copy of the given data
+			 * @param str Data to put into the new buffer
+			 * @param len Length of the data
+			 */
+			Element(const char* str, size_type len) : buf(new Buffer(str, len)), start(0) { }
+
+			/** Create an element taking over the contents of a string without copying them
+			 * @param str String whose contents are moved into the new buffer, it is left empty
+			 * @return New element
+			 */
+			static Element Take(std::string& str)
+			{
+				Element elem;
+				elem.buf = new Buffer;
+				elem.buf->str.swap(str);
+				return elem;
+			}
+
+			/** Get a pointer to the first unsent byte of the buffer
+			 * @return Pointer to the data, not null terminated
+			 */
+			const char* data() const { return (buf ? buf->str.data() + start : ""); }
+
+			/** Get the number of unsent bytes in the buffer
+			 * @return Length of the data
+			 */
+			size_type length() const { return (buf ? buf->str.length() - start : 0); }
+			size_type size() const { return length(); }
+
+			/** Check whether the element has no unsent data
+			 * @return True if the element is empty, false otherwise
+			 */
+			bool empty() const { return (length() == 0); }
+
+			/** Check whether this element refers to the same unsent data of the same shared buffer as another one
+			 * @param other Element to compare to
+			 * @return True if both elements share the buffer and have the same unsent data, false otherwise
+			 */
+			bool SameData(const Element& other) const
+			{
+				return ((static_cast<const Buffer*>(buf) == static_cast<const Buffer*>(other.buf)) && (start == other.start));
+			}
+
+			/** Mark bytes at the beginning of the element as sent. The shared buffer is not modified.
+			 * @param n Number of bytes to skip
+			 */
+			void erase_front(size_type n) { start += n; }
+		};
 
 		/** Sequence container of buffers in the queue
 		 */
@@ -168,7 +252,7 @@ class CoreExport StreamSocket : public EventHandler
 		void erase_front(Element::size_type n)
 		{
 			nbytes -= n;
-			data.front().erase(0, n);
+			data.front().erase_front(n);
 		}
 
 		/** Insert a new buffer at the beginning of the queue
@@ -205,7 +289,7 @@ class CoreExport StreamSocket : public EventHandler
 		}
 
 	 private:
-	 	/** Private send queue. Note that individual strings may be shared.
+	 	/** Private send queue. Note that individual buffers may be shared.
 		 */
 		Container data;
 
@@ -234,12 +318,6 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	void DoRead();
 
-	/** Send as much data contained in a SendQueue object as possible.
-	 * All data which successfully sent will be removed from the SendQueue.
-	 * @param sq SendQueue to flush
-	 */
-	void FlushSendQ(SendQueue& sq);
-
 	/** Read incoming data into a receive queue.
 	 * @param rq Receive queue to put incoming data into
 	 * @return < 0 on error or close, 0 if no new data is ready (but the socket is still connected), > 0 if data was read from the socket and put into the recvq
@@ -256,14 +334,76 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	int HookChainRead(IOHook* hook, std::string& rq);
 
+	/** Fill in an array of buffers with data from the beginning of a SendQueue.
+	 * @param sq SendQueue to take the data from
+	 * @param iovecs Array to fill in, must have room for at least MYIOV_MAX elements
+	 * @param total Set to the number of bytes in the buffers
+	 * @return Number of buffers filled in
+	 */
+	static int FillIOVector(const SendQueue& sq, SocketEngine::IOVector* iovecs, size_t& total);
+
+	/** Process the result of writing buffers returned by FillIOVector() to the socket.
+	 * Data which has been written is removed from the SendQueue, errors are saved.
+	 * @param sq SendQueue the buffers were taken from
+	 * @param rv Return value of the writev() call
+	 * @param total Number of bytes in the buffers
+	 * @param errnum Value of errno after the writev() call
+	 * @return FD_WANT_EDGE_WRITE if more data can be written without blocking, otherwise the event mask to wait for writability
+	 */
+	int ProcessWriteResult(SendQueue& sq, int rv, size_t total, int errnum);
+
+	/** Append the buffers an I/O thread should write for this socket to a vector.
+	 * The buffers must not be modified until FinishThreadedWrite() is called.
+	 * @param iovecs Vector to append the buffers to
+	 * @param total Set to the number of bytes in the appended buffers
+	 * @return Number of buffers appended
+	 */
+	int PrepareThreadedWrite(std::vector<SocketEngine::IOVector>& iovecs, size_t& total);
+
+	/** Process the result of a write prepared by PrepareThreadedWrite(), data that did not fit
+	 * into the write is sent from the calling thread.
+	 * @param rv Return value of the writev() call
+	 * @param total Number of bytes in the buffers that were written
+	 * @param errnum Value of errno after the writev() call
+	 */
+	void FinishThreadedWrite(int rv, size_t total, int errnum);
+
+	friend class SocketEngine;
+
  protected:
 	std::string recvq;
+
+	/** Check whether the send queue of this socket can be written by an I/O thread.
+	 * A threaded write does not call OnEventHandlerWrite(), so sockets whose write handler
+	 * has to run for a write event must override this and return false in that case.
+	 * @return True if the send queue has data and it does not have to go through an IOHook
+	 */
+	virtual bool CanWriteThreaded() const;
  public:
 	StreamSocket() : iohook(NULL) { }
+
+	/** Send as much data contained in a SendQueue object as possible.
+	 * All data which successfully sent will be removed from the SendQueue.
+	 * Called by IOHooks that let the kernel handle their framing, e.g. kernel TLS.
+	 * @param sq SendQueue to flush
+	 */
+	void FlushSendQ(SendQueue& sq);
+
 	IOHook* GetIOHook() const;
 	void AddIOHook(IOHook* hook);
 	void DelIOHook();
 
+	/** Insert a hook at the beginning of the hook chain of this socket.
+	 * The new hook sees the data before all hooks that are already on the socket.
+	 * @param hook Hook to insert
+	 */
+	void InsertIOHook(IOHookMiddle* hook);
+
+	/** Get the last hook in the hook chain of this socket, the one reading and writing the socket itself
+	 * @return Last IOHook in the chain or NULL if the socket is not hooked
+	 */
+	IOHook* GetLastHook() const;
+
 	/** Flush the send queue
 	 */
 	void DoWrite();
@@ -281,6 +421,8 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	void OnEventHandlerError(int errcode) CXX11_OVERRIDE;
 
+	StreamSocket* ToStreamSocket() CXX11_OVERRIDE { return this; }
+
 	/** Sets the error message for this socket. Once set, the socket is dead. */
 	void SetError(const std::string& err) { if (error.empty()) error = err; }
 
@@ -295,6 +437,12 @@ class CoreExport StreamSocket : public EventHandler
 	/** Send the given data out the socket, either now or when writes unblock
 	 */
 	void WriteData(const std::string& data);
+
+	/** Send the given buffer out the socket, either now or when writes unblock.
+	 * The buffer is shared, not copied.
+	 * @param data Data to send
+	 */
+	void WriteData(const SendQueue::Element& data);
 	/** Convenience function: read a line from the socket
 	 * @param line The line read
 	 * @param delim The line delimiter
@@ -387,6 +535,12 @@ class CoreExport BufferedSocket : public StreamSocket
 	virtual ~BufferedSocket();
  protected:
 	void OnEventHandlerWrite() CXX11_OVERRIDE;
+
+	/** Check whether the send queue of this socket can be written by an I/O thread.
+	 * The write event completing a connection attempt is always handled by OnEventHandlerWrite().
+	 * @return True if the socket is connected and StreamSocket::CanWriteThreaded() allows it
+	 */
+	bool CanWriteThreaded() const CXX11_OVERRIDE;
 	BufferedSocketError BeginConnect(const irc::sockets::sockaddrs& dest, const irc::sockets::sockaddrs& bind, unsigned long timeout);
 	BufferedSocketError BeginConnect(const std::string &ipaddr, int aport, unsigned long maxtime, const std::string &connectbindip);
 };
@@ -29,7 +29,8 @@ class IOHookProvider : public refcountbase, public ServiceProvider
 	enum Type
 	{
 		IOH_UNKNOWN,
-		IOH_SSL
+		IOH_SSL,
+		IOH_COMPRESS
 	};
 
 	const Type type;
@@ -31,14 +31,127 @@ class CoreExport ListModeBase : public ModeHandler
 		std::string setter;
 		std::string mask;
 		time_t time;
-		ListItem(const std::string& Mask, const std::string& Setter, time_t Time)
-			: setter(Setter), mask(Mask), time(Time) { }
+
+		/** Compiled nick!ident part of the mask if it is a nick!ident@host mask, used by MatchUser()
+		 */
+		WildcardMask nickident;
+
+		/** Compiled host part of the mask if it is a nick!ident@host mask, used by MatchUser()
+		 */
+		WildcardMask host;
+
+		ListItem(const std::string& Mask, const std::string& Setter, time_t Time);
+
+		/** Check whether a user matches the mask in the same way as Channel::CheckBan() does
+		 * when no module handles the mask. Extbans and masks without an '@' never match.
+		 * @param user The user to check
+		 * @return True if the user matches the mask
+		 */
+		bool MatchUser(User* user) const;
 	};
 
 	/** Items stored in the channel's list
 	 */
 	typedef std::vector<ListItem> ModeList;
 
+	/** The entries of a channel's list sorted so that the nick!ident@host masks which can match
+	 * a user are found without trying every entry. The index of a channel is built the first
+	 * time it is needed and thrown away whenever the list or the national case map changes.
+	 */
+	class CoreExport MatchIndex
+	{
+	 public:
+		/** A set of entries which are checked against a user together, either the whole list
+		 * or the masks of every extban of one type with the extban prefix removed.
+		 */
+		class CoreExport Group
+		{
+			typedef TR1NS::unordered_multimap<std::string, const ListItem*> HostMap;
+			typedef std::multimap<irc::sockets::cidr_mask, const ListItem*> CIDRMap;
+			typedef std::set<std::pair<unsigned char, unsigned char> > CIDRLengths;
+			typedef TR1NS::unordered_map<User*, std::pair<uint64_t, bool> > ResultCache;
+
+			/** Every entry in the group, in list order */
+			std::vector<const ListItem*> items;
+
+			/** Entries with a literal host part, keyed by the host folded through the national case map */
+			HostMap hosts;
+
+			/** Entries whose host part is a CIDR range */
+			CIDRMap cidrs;
+
+			/** Address families and prefix lengths of the entries in cidrs */
+			CIDRLengths cidrlengths;
+
+			/** Entries with a wildcard in the host part */
+			std::vector<const ListItem*> wild;
+
+			/** Results of FindMatch() for users, valid while the identity generation of the user is unchanged */
+			ResultCache cache;
+
+			/** Buffer reused by FindHost() to fold hosts without allocating */
+			std::string folded;
+
+			/** Find an entry with a literal host part which matches the user and one of its hosts.
+			 * @param user The user to check
+			 * @param host The host or IP address of the user to look up
+			 * @return True if a matching entry was found
+			 */
+			bool FindHost(User* user, const std::string& host);
+
+			/** Check whether any entry matches the user when no module handles the masks.
+			 * @param user The user to check
+			 * @param chan The channel the list belongs to, used to limit the size of the cache
+			 * @return True if an entry matches
+			 */
+			bool FindMatch(User* user, Channel* chan);
+
+		 public:
+			/** Add an entry to the group.
+			 * @param item The entry, which must outlive the group
+			 */
+			void Add(const ListItem* item);
+
+			/** Check whether any entry matches a user with the same result as calling
+			 * Channel::CheckBan() on each of them in turn.
+			 * @param user The user to check
+			 * @param chan The channel the list belongs to
+			 * @return True if an entry matches
+			 */
+			bool Matches(User* user, Channel* chan);
+		};
+
+	 private:
+		/** Masks of the extbans in the list with the extban prefix removed */
+		ModeList extbanitems;
+
+		/** Every entry in the list */
+		Group all;
+
+		/** Extbans in the list grouped by type */
+		insp::flat_map<char, Group> extbans;
+
+	 public:
+		/** Value of national_case_map_generation when the index was built, the literal hosts are folded with that map */
+		const unsigned long casemapgen;
+
+		/** Build the index of a list.
+		 * @param list The list, which must not change for as long as the index exists
+		 */
+		MatchIndex(const ModeList& list);
+
+		/** Get the group holding every entry in the list.
+		 * @return The group of all entries
+		 */
+		Group& GetAll() { return all; }
+
+		/** Get the group holding the extbans of a given type.
+		 * @param type The extban type
+		 * @return The group of extbans of the given type or NULL if there are none
+		 */
+		Group* GetExtBans(char type);
+	};
+
  private:
 	class ChanData
 	{
@@ -46,7 +159,18 @@ class CoreExport ListModeBase : public ModeHandler
 		ModeList list;
 		int maxitems;
 
-		ChanData() : maxitems(-1) { }
+		/** Index of list, NULL until it is needed, see GetMatchIndex() */
+		MatchIndex* index;
+
+		ChanData() : maxitems(-1), index(NULL) { }
+		~ChanData() { delete index; }
+
+		/** Throw away the index after list has changed */
+		void InvalidateIndex()
+		{
+			delete index;
+			index = NULL;
+		}
 	};
 
 	/** The number of items a listmode's list may contain
@@ -136,6 +260,13 @@ class CoreExport ListModeBase : public ModeHandler
 	 */
 	ModeList* GetList(Channel* channel);
 
+	/** Get the match index of the list on the given channel, building it if needed.
+	 * The index is valid until the list or the national case map is next changed.
+	 * @param channel Channel to get the index for
+	 * @return The index of the list or NULL if the channel has no list
+	 */
+	MatchIndex* GetMatchIndex(Channel* channel);
+
 	/** Display the list for this mode
 	 * See mode.h
 	 * @param user The user to send the list to
@@ -211,3 +342,18 @@ inline ListModeBase::ModeList* ListModeBase::GetList(Channel* channel)
 
 	return &cd->list;
 }
+
+inline ListModeBase::MatchIndex* ListModeBase::GetMatchIndex(Channel* channel)
+{
+	ChanData* cd = extItem.get(channel);
+	if (!cd)
+		return NULL;
+
+	// Hosts in the index are folded with the national case map, it is of no use once the map changes
+	if ((cd->index) && (cd->index->casemapgen != national_case_map_generation))
+		cd->InvalidateIndex();
+
+	if (!cd->index)
+		cd->index = new MatchIndex(cd->list);
+	return cd->index;
+}
@@ -54,6 +54,28 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 */
 	Id id;
 
+	/** Position of this Membership in the member array of the channel, maintained by
+	 * Channel::MemberMap, other components should never read or write this field.
+	 */
+	size_t pos;
+
+	/** Position of this Membership in the local member array of the channel if the user is local,
+	 * maintained by Channel::MemberMap, other components should never read or write this field.
+	 */
+	size_t localpos;
+
+	/** Results of Channel::IsBanned() (with type 0) and Channel::GetExtBanStatus() for this member
+	 * as ModResult::res values, valid while bangens matches the list mode generation of the channel and the identity
+	 * generation of the user. Maintained by the Channel, other components should never read or
+	 * write these fields.
+	 */
+	insp::flat_map<char, int> bancache;
+
+	/** The list mode generation of the channel and the identity generation of the user
+	 * the results in bancache were found with
+	 */
+	std::pair<uint64_t, uint64_t> bangens;
+
 	/** Converts a string to a Membership::Id
 	 * @param str The string to convert
 	 * @return Raw value of type Membership::Id
@@ -68,7 +90,7 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 * Call Channel::JoinUser() or ForceJoin() to make a user join a channel instead of constructing
 	 * Membership objects directly.
 	 */
-	Membership(User* u, Channel* c) : user(u), chan(c) {}
+	Membership(User* u, Channel* c) : user(u), chan(c), pos(0), localpos(0), bangens(0, 0) {}
 
 	/** Check if this member has a given prefix mode set
 	 * @param pm Prefix mode to check
@@ -111,4 +133,19 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 * this when multiple prefixes are used names lists.
 	 */
 	std::string GetAllPrefixChars() const;
+
+	/** Look up a cached ban check result, discarding all cached results if they are stale.
+	 * @param type 0 for the result of Channel::IsBanned() or an extban type for the result of
+	 * Channel::GetExtBanStatus()
+	 * @param result Set to the cached result if there is one
+	 * @return True if a cached result was found
+	 */
+	bool GetCachedBan(char type, ModResult& result);
+
+	/** Cache a ban check result, see GetCachedBan()
+	 * @param type 0 for the result of Channel::IsBanned() or an extban type for the result of
+	 * Channel::GetExtBanStatus()
+	 * @param result The result to cache
+	 */
+	void SetCachedBan(char type, ModResult result);
 };
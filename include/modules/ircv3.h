@@ -29,10 +29,19 @@ class IRCv3::WriteNeighborsWithCap : public User::ForEachNeighborHandler
 	const Cap::Capability& cap;
 	const std::string& msg;
 
+	/** The message with CR/LF appended, built when the first neighbor with the cap is found
+	 * and shared between the sendqs of all neighbors with the cap
+	 */
+	StreamSocket::SendQueue::Element line;
+
 	void Execute(LocalUser* user) CXX11_OVERRIDE
 	{
-		if (cap.get(user))
-			user->Write(msg);
+		if (!cap.get(user))
+			return;
+
+		if (line.empty())
+			line = LocalUser::PrepareLine(msg);
+		user->Write(line);
 	}
 
  public:
@@ -138,40 +138,106 @@ class SSLIOHook : public IOHook
 	 */
 	reference<ssl_cert> certificate;
 
-	/** Reduce elements in a send queue by appending later elements to the first element until there are no more
-	 * elements to append or a desired length is reached
-	 * @param sendq SendQ to work on
-	 * @param targetsize Target size of the front element
+	/** Get the data at the beginning of a send queue as a single continuous buffer without modifying the queue.
+	 * If the first element is long enough or it is the only one then its data is returned as-is, otherwise
+	 * the data of the first few elements is copied into a scratch buffer which is reused for every socket.
+	 * The elements of the queue may be shared with other send queues so they are never modified.
+	 * @param sendq SendQ to get the data of, must not be empty
+	 * @param targetsize Desired length of the returned data
+	 * @param len Set to the length of the returned data
+	 * @return Pointer to the data, valid until the next call or until the send queue changes
 	 */
-	static void FlattenSendQueue(StreamSocket::SendQueue& sendq, size_t targetsize)
+	static const char* GetSendQueueData(const StreamSocket::SendQueue& sendq, size_t targetsize, size_t& len)
 	{
-		if ((sendq.size() <= 1) || (sendq.front().length() >= targetsize))
-			return;
+		const StreamSocket::SendQueue::Element& first = sendq.front();
+		if ((sendq.size() <= 1) || (first.length() >= targetsize))
+		{
+			len = first.length();
+			return first.data();
+		}
 
 		// Avoid multiple repeated SSL encryption invocations
-		// This adds a single copy of the queue, but avoids
+		// This adds a single copy of the data, but avoids
 		// much more overhead in terms of system calls invoked
 		// by an IOHook.
-		std::string tmp;
-		tmp.reserve(std::min(targetsize, sendq.bytes())+1);
-		do
+		std::string& scratch = GetScratchBuffer();
+		scratch.clear();
+		for (StreamSocket::SendQueue::const_iterator i = sendq.begin(); ((i != sendq.end()) && (scratch.length() < targetsize)); ++i)
+			scratch.append(i->data(), std::min(i->length(), targetsize - scratch.length()));
+
+		len = scratch.length();
+		return scratch.data();
+	}
+
+	/** Replace the data returned by GetSendQueueData() with a copy of it in a single element if it came from the
+	 * scratch buffer. Called when a write blocks because SSL libraries require the retry to pass the same data.
+	 * @param sendq SendQ the data was taken from
+	 * @param data Data returned by GetSendQueueData()
+	 * @param len Length of the data
+	 */
+	static void KeepSendQueueData(StreamSocket::SendQueue& sendq, const char* data, size_t len)
+	{
+		if (data == sendq.front().data())
+			return;
+
+		ConsumeSendQueue(sendq, len);
+		sendq.push_front(StreamSocket::SendQueue::Element(data, len));
+	}
+
+	/** Remove data which has been sent from the beginning of a send queue
+	 * @param sendq SendQ to remove the data from
+	 * @param n Number of bytes to remove, may span multiple elements
+	 */
+	static void ConsumeSendQueue(StreamSocket::SendQueue& sendq, size_t n)
+	{
+		while (n > 0)
 		{
-			tmp.append(sendq.front());
+			const size_t elemlen = sendq.front().length();
+			if (n < elemlen)
+			{
+				sendq.erase_front(n);
+				return;
+			}
+
 			sendq.pop_front();
+			n -= elemlen;
 		}
-		while (!sendq.empty() && tmp.length() < targetsize);
-		sendq.push_front(tmp);
+	}
+
+ private:
+	/** Get the scratch buffer used by GetSendQueueData(). SSL sockets are only written by the main thread.
+	 * @return Scratch buffer, its allocation is kept between calls
+	 */
+	static std::string& GetScratchBuffer()
+	{
+		static std::string scratch;
+		return scratch;
 	}
 
  public:
 	static SSLIOHook* IsSSL(StreamSocket* sock)
 	{
-		IOHook* const iohook = sock->GetIOHook();
+		// Other hooks, such as link compression, may be stacked on top of the SSL hook
+		IOHook* const iohook = sock->GetLastHook();
 		if ((iohook) && ((iohook->prov->type == IOHookProvider::IOH_SSL)))
 			return static_cast<SSLIOHook*>(iohook);
 		return NULL;
 	}
 
+	/** Get the address of the remote end of a socket, used as the key of the sessions
+	 * remembered for resumption on outgoing connections
+	 * @param sock Socket to get the remote address of
+	 * @return Address and port of the peer, empty on error
+	 */
+	static std::string GetPeerAddress(StreamSocket* sock)
+	{
+		irc::sockets::sockaddrs sa;
+		socklen_t salen = sizeof(sa);
+		if (getpeername(sock->GetFd(), &sa.sa, &salen) != 0)
+			return std::string();
+		return sa.str();
+	}
+
 	SSLIOHook(IOHookProvider* hookprov)
 		: IOHook(hookprov)
 	{
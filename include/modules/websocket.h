@@ -0,0 +1,70 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#if defined __SSE2__ || defined _M_X64
+# include <emmintrin.h>
+# define INSPIRCD_WEBSOCKET_SSE2
+#endif
+
+namespace WebSocket
+{
+	/** XOR a payload with a masking key in place
+	 * @param data Payload to unmask, its first byte is masked with the first byte of the key
+	 * @param len Length of the payload
+	 * @param maskkey 4 byte masking key
+	 */
+	inline void UnmaskPayload(char* data, size_t len, const unsigned char* maskkey)
+	{
+		// The payload is processed in blocks whose size is a multiple of the key length so
+		// every block starts with the first byte of the key
+		size_t i = 0;
+#ifdef INSPIRCD_WEBSOCKET_SSE2
+		if (len >= 16)
+		{
+			int key32;
+			memcpy(&key32, maskkey, sizeof(key32));
+			const __m128i mask128 = _mm_set1_epi32(key32);
+			for (; i + 16 <= len; i += 16)
+			{
+				__m128i* const block = reinterpret_cast<__m128i*>(data + i);
+				_mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), mask128));
+			}
+		}
+#endif
+
+		if (len - i >= 8)
+		{
+			unsigned char key64[8];
+			memcpy(key64, maskkey, 4);
+			memcpy(key64 + 4, maskkey, 4);
+			uint64_t mask64;
+			memcpy(&mask64, key64, sizeof(mask64));
+			for (; i + 8 <= len; i += 8)
+			{
+				uint64_t block;
+				memcpy(&block, data + i, sizeof(block));
+				block ^= mask64;
+				memcpy(data + i, &block, sizeof(block));
+			}
+		}
+
+		for (; i < len; i++)
+			data[i] ^= maskkey[i % 4];
+	}
+}
@@ -0,0 +1,122 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "iohook.h"
+
+/** Counters of a compressed connection
+ */
+struct ZipLinkStats
+{
+	/** Number of bytes given to the compressor
+	 */
+	unsigned long long rawout;
+
+	/** Number of bytes the compressor produced
+	 */
+	unsigned long long wireout;
+
+	/** Number of compressed bytes received
+	 */
+	unsigned long long wirein;
+
+	/** Number of bytes the received data decompressed to
+	 */
+	unsigned long long rawin;
+
+	/** Microseconds spent compressing and decompressing
+	 */
+	unsigned long long usecs;
+
+	ZipLinkStats()
+		: rawout(0), wireout(0), wirein(0), rawin(0), usecs(0)
+	{
+	}
+};
+
+/** A hook compressing the data of a connection.
+ * Both directions start out uncompressed, each one is switched to compressed independently
+ * when the protocol spoken on the connection says so. The hook is always the first in the hook
+ * chain of its socket, so it compresses data before it is encrypted by an SSL hook.
+ */
+class ZipLinkIOHook : public IOHookMiddle
+{
+ protected:
+	ZipLinkStats stats;
+
+ public:
+	ZipLinkIOHook(IOHookProvider* provider)
+		: IOHookMiddle(provider)
+	{
+	}
+
+	/** Compress all data written to the socket from now on.
+	 * Data which is already waiting in the send queue of the socket is sent uncompressed.
+	 * @param sock Hooked socket
+	 * @return True if compression was started, false on error
+	 */
+	virtual bool StartCompress(StreamSocket* sock) = 0;
+
+	/** Decompress all data read from the socket from now on.
+	 * @param sock Hooked socket
+	 * @param recvq Data received after the point where the peer started compressing. It is
+	 * decompressed and replaced with the result.
+	 * @return True if decompression was started, false if the data could not be decompressed
+	 */
+	virtual bool StartDecompress(StreamSocket* sock, std::string& recvq) = 0;
+
+	/** Get the counters of the connection
+	 * @return Number of bytes compressed and decompressed, and the time it took
+	 */
+	const ZipLinkStats& GetStats() const { return stats; }
+
+	/** Get the compression hook of a socket
+	 * @param sock Socket to get the hook of
+	 * @return Compression hook of the socket or NULL if it doesn't have one
+	 */
+	static ZipLinkIOHook* Find(StreamSocket* sock)
+	{
+		IOHook* const iohook = sock->GetIOHook();
+		if ((iohook) && (iohook->prov->type == IOHookProvider::IOH_COMPRESS))
+			return static_cast<ZipLinkIOHook*>(iohook);
+		return NULL;
+	}
+};
+
+/** Provider of a compression method for links, named "ziplink/<method>"
+ */
+class ZipLinkProvider : public IOHookProvider
+{
+ public:
+	/** Name of the compression method, e.g. "zlib"
+	 */
+	const std::string method;
+
+	ZipLinkProvider(Module* mod, const std::string& methodname)
+		: IOHookProvider(mod, "ziplink/" + methodname, IOHookProvider::IOH_COMPRESS, true)
+		, method(methodname)
+	{
+	}
+
+	/** Hook a socket with a compression hook whose directions are both uncompressed.
+	 * The hook is inserted at the beginning of the hook chain of the socket.
+	 * @param sock Socket to hook
+	 * @return New hook of the socket
+	 */
+	virtual ZipLinkIOHook* Hook(StreamSocket* sock) = 0;
+};
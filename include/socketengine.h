@@ -133,6 +133,8 @@ enum EventMask
 	FD_TRIAL_NOTE_MASK = 0x5000
 };
 
+class StreamSocket;
+
 /** This class is a basic I/O handler class.
  * Any object which wishes to receive basic I/O events
  * from the socketengine must derive from this class and
@@ -202,6 +204,13 @@ class CoreExport EventHandler : public classbase
 	 */
 	virtual void OnEventHandlerError(int errornum);
 
+	/** Get the StreamSocket this handler belongs to. The socket engine uses this to
+	 * hand writes of queued data to the I/O threads, see \<performance:iothreads>.
+	 * The default implementation returns NULL.
+	 * @return This handler as a StreamSocket or NULL if it is not a StreamSocket
+	 */
+	virtual StreamSocket* ToStreamSocket() { return NULL; }
+
 	friend class SocketEngine;
 };
 
@@ -294,6 +303,11 @@ class CoreExport SocketEngine
 
 	static void DelFdRef(EventHandler* eh);
 
+	/** Dispatch trial writes of StreamSockets, using the I/O threads if there are enough of them.
+	 * @param writers File descriptors of StreamSockets which have a trial write pending
+	 */
+	static void DispatchThreadedWrites(const std::vector<int>& writers);
+
 	template <typename T>
 	static void ResizeDouble(std::vector<T>& vect)
 	{
@@ -398,6 +412,13 @@ public:
 	 */
 	static void DispatchTrialWrites();
 
+	/** Start or stop I/O threads so that the given number of them is running.
+	 * I/O threads write the send queues of StreamSockets in parallel when a lot of them
+	 * have pending trial writes, all other processing is done by the main thread.
+	 * @param count Number of I/O threads to run, 0 to stop all of them
+	 */
+	static void SetIOThreadCount(unsigned int count);
+
 	/** Returns true if the file descriptors in the given event handler are
 	 * within sensible ranges which can be handled by the socket engine.
 	 */
@@ -556,6 +577,13 @@ public:
 	 */
 	static const Statistics& GetStats() { return stats; }
 
+	/** Update the data transfer statistics with data transferred by a library doing the socket I/O itself
+	 * instead of calling Recv() and Send(), e.g. OpenSSL with kernel TLS
+	 * @param len_in Number of bytes received
+	 * @param len_out Number of bytes sent
+	 */
+	static void UpdateStats(size_t len_in, size_t len_out);
+
 	/** Should we ignore the error in errno?
 	 * Checks EAGAIN and WSAEWOULDBLOCK
 	 */
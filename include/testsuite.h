@@ -31,6 +31,11 @@ class TestSuite
 	bool DoCommaSepStreamTests();
 	bool DoSpaceSepStreamTests();
 	bool DoGenerateUIDTests();
+	bool DoCommandParserTests();
+	bool DoWebSocketUnmaskTests();
+	bool DoSocketEngineBenchmark();
+	bool DoTimerTests();
+	bool DoUserTimerBenchmark();
 };
 
 #endif
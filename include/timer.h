@@ -33,12 +33,16 @@ class Module;
  * your object (which you have to override) will be called
  * at the given time.
  */
-class CoreExport Timer
+class CoreExport Timer : public insp::intrusive_list_node<Timer>
 {
 	/** The triggering time
 	 */
 	time_t trigger;
 
+	/** The list in the timer wheel this timer is in, NULL if it is not scheduled
+	 */
+	insp::intrusive_list_tail<Timer>* slot;
+
 	/** Number of seconds between triggers
 	 */
 	unsigned int secs;
@@ -78,6 +82,14 @@ class CoreExport Timer
 	 */
 	void SetInterval(time_t interval);
 
+	/** Check whether this timer is waiting to tick
+	 * @return True if the timer was added to the TimerManager and did not tick yet
+	 */
+	bool IsScheduled() const
+	{
+		return (slot != NULL);
+	}
+
 	/** Called when the timer ticks.
 	 * You should override this method with some useful code to
 	 * handle the tick event.
@@ -109,21 +121,69 @@ class CoreExport Timer
 	{
 		repeat = false;
 	}
+
+	friend class TimerManager;
 };
 
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timing wheel. The first level has a list for
+ * each of the next 256 seconds, every further level has 64 lists each covering 64
+ * times as many seconds as a list of the previous level. When the first level wraps
+ * around the timers of the next list of the second level are redistributed to the
+ * first level, and so on. Adding and removing a timer is O(1) and ticking only
+ * visits timers which are due or are being redistributed.
  */
 class CoreExport TimerManager
 {
-	typedef std::multimap<time_t, Timer*> TimerMap;
+	typedef insp::intrusive_list_tail<Timer> TimerList;
+
+	/** Number of bits of the trigger time used to index the first level of the wheel
+	 */
+	static const unsigned int RootBits = 8;
+
+	/** Number of bits of the trigger time used to index each of the further levels of the wheel
+	 */
+	static const unsigned int LevelBits = 6;
+
+	/** Number of levels in the wheel after the first one
+	 */
+	static const unsigned int Levels = 4;
+
+	/** The first level of the wheel, indexed by the low RootBits bits of the trigger time
+	 */
+	TimerList root[1 << RootBits];
+
+	/** The further levels of the wheel
+	 */
+	TimerList levels[Levels][1 << LevelBits];
+
+	/** The earliest time which was not processed by TickTimers() yet, 0 if nothing was scheduled yet
+	 */
+	time_t current;
 
-	/** A list of all pending timers
+	/** Add a timer to the list in the wheel matching its trigger time
+	 * @param t Timer to add
 	 */
-	TimerMap Timers;
+	void Schedule(Timer* t);
+
+	/** Move all timers from a list to the lists matching their trigger time
+	 * @param list List to empty
+	 */
+	void Redistribute(TimerList& list);
+
+	/** Move all timers in the wheel to the lists matching their trigger time relative to a new time
+	 * @param newcurrent Time to continue processing the wheel at
+	 */
+	void Rebuild(time_t newcurrent);
 
  public:
+	/** Constructor
+	 */
+	TimerManager();
+
 	/** Tick all pending Timers
 	 * @param TIME the current system time
 	 */
@@ -87,10 +87,13 @@ class CoreExport UserManager : public fakederef<UserManager>
 	 */
 	unsigned int unregistered_count;
 
-	/** Perform background user events for all local users such as PING checks, registration timeouts,
+	/** Perform background user events for a local user such as PING checks, registration timeouts,
 	 * penalty management and recvq processing for users who have data in their recvq due to throttling.
+	 * This is called by the UserTimer of the user.
+	 * @param user The user to check
+	 * @return The next time the user needs to be checked, or 0 if the user was quit
 	 */
-	void DoBackgroundUserStuff();
+	time_t DoBackgroundUserStuff(LocalUser* user);
 
 	/** Returns true when all modules have done pre-registration checks on a user
 	 * @param user The user to verify
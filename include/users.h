@@ -250,6 +250,9 @@ class CoreExport User : public Extensible
 	/** The real hostname of this user. */
 	std::string realhost;
 
+	/** Changed by InvalidateCache(), see GetIdentityGen(). */
+	uint64_t identitygen;
+
 	/** The user's mode list.
 	 * Much love to the STL for giving us an easy to use bitset, saving us RAM.
 	 * if (modes[modeid]) is set, then the mode is set.
@@ -407,6 +410,14 @@ class CoreExport User : public Extensible
 	 */
 	void InvalidateCache();
 
+	/** Get a value which changes whenever the nick, ident, host, IP address, real name, account or
+	 * oper status of the user changes.
+	 * Values are never reused, not even by other users, so results cached against a user and
+	 * this value are known to be stale when it no longer matches.
+	 * @return The current identity generation of the user
+	 */
+	uint64_t GetIdentityGen() const { return identitygen; }
+
 	/** Returns whether this user is currently away or not. If true,
 	 * further information can be found in User::awaymsg and User::awaytime
 	 * @return True if the user is away, false otherwise
@@ -732,6 +743,12 @@ class CoreExport User : public Extensible
 
 class CoreExport UserIOHandler : public StreamSocket
 {
+	/** Check whether data can be added to the write buffer, quits the user if the sendq limit is exceeded
+	 * @param len Length of the data to add
+	 * @return True if the data can be added, false if it must be dropped
+	 */
+	bool CanAddWriteBuf(size_t len);
+
  public:
 	LocalUser* const user;
 	UserIOHandler(LocalUser* me) : user(me) {}
@@ -744,6 +761,32 @@ class CoreExport UserIOHandler : public StreamSocket
 	 * @param data The data to add to the write buffer
 	 */
 	void AddWriteBuf(const std::string &data);
+
+	/** Adds a shared buffer to the user's write buffer, without copying it.
+	 * The same sendq limits as for AddWriteBuf(const std::string&) apply.
+	 * @param data The buffer to add to the write buffer
+	 */
+	void AddWriteBuf(const SendQueue::Element& data);
+};
+
+/** Performs the background checks of a local user, i.e. PING checks, registration timeouts,
+ * penalty decay and processing of lines held back due to throttling. The timer is scheduled
+ * for the next time the user needs any of these, so idle users are only visited when their
+ * ping or registration deadline passes.
+ */
+class CoreExport UserTimer : public Timer
+{
+	LocalUser* const user;
+
+ public:
+	UserTimer(LocalUser* me) : Timer(0), user(me) { }
+
+	/** Make sure the timer ticks no later than the given time
+	 * @param when The latest time the timer should tick at
+	 */
+	void ScheduleBy(time_t when);
+
+	bool Tick(time_t TIME) CXX11_OVERRIDE;
 };
 
 typedef unsigned int already_sent_t;
@@ -756,6 +799,10 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 
 	UserIOHandler eh;
 
+	/** Timer doing the background checks of this user
+	 */
+	UserTimer timer;
+
 	/** Stats counter for bytes inbound
 	 */
 	unsigned int bytes_in;
@@ -853,6 +900,19 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	void Write(const std::string& text) CXX11_OVERRIDE;
 	void Write(const char*, ...) CXX11_OVERRIDE CUSTOM_PRINTF(2, 3);
 
+	/** Build a buffer containing a line to send to local users, with CR/LF appended.
+	 * The returned buffer may be passed to Write() for any number of users, it is shared
+	 * between their sendqs instead of being copied for each of them.
+	 * @param text Line to send, it is truncated if it exceeds the maximum line length
+	 * @return Buffer holding the line
+	 */
+	static StreamSocket::SendQueue::Element PrepareLine(const std::string& text);
+
+	/** Write a line built by PrepareLine() to this user.
+	 * @param line Line to send, including CR/LF
+	 */
+	void Write(const StreamSocket::SendQueue::Element& line);
+
 	/** Send a NOTICE message from the local server to the user.
 	 * The message will be sent even if the user is connected to a remote server.
 	 * @param text Text to send
@@ -0,0 +1,136 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#pragma once
+
+/** A wildcard mask which has been split up ahead of time so that it can be matched
+ * against many strings quickly. Matching gives the same result as InspIRCd::Match()
+ * with the same mask and map, but the mask is only parsed and case folded once and
+ * the literal parts of it are located with memchr() and memcmp() where the map allows
+ * instead of being compared a character at a time.
+ *
+ * A mask compiled for the national case map never keeps a pointer to it, as the map may
+ * belong to a module. The current map is used for every match and the mask is folded
+ * again after national_case_map_generation changes.
+ */
+class CoreExport WildcardMask
+{
+	/** A part of the mask between two '*' characters */
+	struct Segment
+	{
+		/** Offset of the segment within the mask */
+		std::string::size_type offset;
+
+		/** Length of the segment */
+		std::string::size_type length;
+
+		/** Offset within the segment of the first character which is not a '?', or length if there is none */
+		std::string::size_type first;
+
+		/** True if the segment contains a '?' */
+		bool wild;
+
+		/** True if the segment has no '?' and every character in it is only matched by itself under the map */
+		bool exact;
+
+		/** The characters which can match the first character which is not a '?' */
+		unsigned char needles[2];
+
+		/** The number of entries in needles, or 0 if more than two characters can match */
+		unsigned int needlecount;
+
+		Segment(std::string::size_type Offset, std::string::size_type Length)
+			: offset(Offset), length(Length), first(Length), wild(false), exact(true), needlecount(0)
+		{
+		}
+	};
+
+	/** The mask as it was given */
+	std::string mask;
+
+	/** The mask with every character which is not a wildcard folded through the case map */
+	mutable std::string folded;
+
+	/** The parts of the mask between '*' characters. If the mask contains a '*' the
+	 * first and last segments are the (possibly empty) head and tail of the mask.
+	 */
+	mutable std::vector<Segment> segments;
+
+	/** The case map used to fold the mask and the strings matched against it, NULL for the national case map */
+	unsigned const char* fixedmap;
+
+	/** Value of national_case_map_generation when the mask was folded */
+	mutable unsigned long casemapgen;
+
+	/** True if the mask contains a '*' */
+	mutable bool star;
+
+	/** The shortest string which can match the mask */
+	mutable std::string::size_type minlength;
+
+	/** Get the case map the mask is matched with
+	 * @return The map given to the constructor or the current national case map
+	 */
+	unsigned const char* GetMap() const;
+
+	/** Split up and fold the mask with the current case map */
+	void Compile() const;
+
+	/** Check whether a segment matches a string at a given position.
+	 * @param seg The segment to check
+	 * @param str The string, at least seg.length characters long from str
+	 * @return True if the segment matches
+	 */
+	bool MatchSegment(const Segment& seg, const unsigned char* str) const;
+
+	/** Find the leftmost position within a string where a segment matches.
+	 * @param seg The segment to find
+	 * @param str The start of the range to search
+	 * @param end The end of the range to search
+	 * @return The start of the match or NULL if there is none
+	 */
+	const unsigned char* FindSegment(const Segment& seg, const unsigned char* str, const unsigned char* end) const;
+
+ public:
+	/** Create a mask which only matches the empty string.
+	 */
+	WildcardMask();
+
+	/** Compile a mask.
+	 * @param Mask The wildcard mask, as it would be passed to InspIRCd::Match()
+	 * @param Map The case map to use, or NULL to use the national case insensitive map
+	 */
+	WildcardMask(const std::string& Mask, unsigned const char* Map = NULL);
+
+	/** Match a string against the mask.
+	 * @param str The string to match
+	 * @return True if the string matches the mask
+	 */
+	bool Match(const std::string& str) const;
+
+	/** Match a string against the mask.
+	 * @param str The null terminated string to match
+	 * @return True if the string matches the mask
+	 */
+	bool Match(const char* str) const;
+
+	/** Get the mask which was compiled.
+	 * @return The mask, as it was given to the constructor
+	 */
+	const std::string& GetMask() const { return mask; }
+};
@@ -85,6 +85,16 @@ class CoreExport XLine : public classbase
 	 */
 	virtual bool Matches(const std::string &str) = 0;
 
+	/** Get the masks which Matches(User*) checks users against. Lines which match an ident
+	 * mask against the ident of a user and a host mask against the real host and the IP
+	 * address of a user using InspIRCd::MatchCIDR() can return their masks here, so the
+	 * XLineManager can index them and only check them against users they might match.
+	 * @param ident Set to the ident mask, or left empty if the line doesn't match idents
+	 * @param host Set to the host mask
+	 * @return True if the masks were set, false if the line has to be checked against every user
+	 */
+	virtual bool GetMatchMasks(std::string& ident, std::string& host) { return false; }
+
 	/** Apply a line against a user. The mechanics of what occurs when
 	 * the line is applied are specific to the derived class.
 	 * @param u The user to apply against
@@ -159,6 +169,7 @@ class CoreExport KLine : public XLine
 	 */
 	KLine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
 		: XLine(s_time, d, src, re, "K"), identmask(ident), hostmask(host)
+		, identmatch(ident, ascii_case_insensitive_map), hostmatch(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
@@ -174,6 +185,8 @@ class CoreExport KLine : public XLine
 
 	virtual bool Matches(const std::string &str);
 
+	virtual bool GetMatchMasks(std::string& ident, std::string& host);
+
 	virtual void Apply(User* u);
 
 	virtual const std::string& Displayable();
@@ -188,6 +201,13 @@ class CoreExport KLine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** Compiled form of identmask
+	 */
+	WildcardMask identmatch;
+	/** Compiled form of hostmask
+	 */
+	WildcardMask hostmatch;
 };
 
 /** GLine class
@@ -205,6 +225,7 @@ class CoreExport GLine : public XLine
 	 */
 	GLine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
 		: XLine(s_time, d, src, re, "G"), identmask(ident), hostmask(host)
+		, identmatch(ident, ascii_case_insensitive_map), hostmatch(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
@@ -220,6 +241,8 @@ class CoreExport GLine : public XLine
 
 	virtual bool Matches(const std::string &str);
 
+	virtual bool GetMatchMasks(std::string& ident, std::string& host);
+
 	virtual void Apply(User* u);
 
 	virtual const std::string& Displayable();
@@ -232,6 +255,13 @@ class CoreExport GLine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** Compiled form of identmask
+	 */
+	WildcardMask identmatch;
+	/** Compiled form of hostmask
+	 */
+	WildcardMask hostmatch;
 };
 
 /** ELine class
@@ -249,6 +279,7 @@ class CoreExport ELine : public XLine
 	 */
 	ELine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
 		: XLine(s_time, d, src, re, "E"), identmask(ident), hostmask(host)
+		, identmatch(ident, ascii_case_insensitive_map), hostmatch(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
@@ -262,6 +293,8 @@ class CoreExport ELine : public XLine
 
 	virtual bool Matches(const std::string &str);
 
+	virtual bool GetMatchMasks(std::string& ident, std::string& host);
+
 	virtual void Unset();
 
 	virtual void OnAdd();
@@ -276,6 +309,13 @@ class CoreExport ELine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** Compiled form of identmask
+	 */
+	WildcardMask identmatch;
+	/** Compiled form of hostmask
+	 */
+	WildcardMask hostmatch;
 };
 
 /** ZLine class
@@ -291,7 +331,7 @@ class CoreExport ZLine : public XLine
 	 * @param ip IP to match
 	 */
 	ZLine(time_t s_time, long d, std::string src, std::string re, std::string ip)
-		: XLine(s_time, d, src, re, "Z"), ipaddr(ip)
+		: XLine(s_time, d, src, re, "Z"), ipaddr(ip), ipmatch(ip)
 	{
 	}
 
@@ -305,6 +345,8 @@ class CoreExport ZLine : public XLine
 
 	virtual bool Matches(const std::string &str);
 
+	virtual bool GetMatchMasks(std::string& ident, std::string& host);
+
 	virtual void Apply(User* u);
 
 	virtual const std::string& Displayable();
@@ -312,6 +354,10 @@ class CoreExport ZLine : public XLine
 	/** IP mask (no ident part)
 	 */
 	std::string ipaddr;
+
+	/** Compiled form of ipaddr
+	 */
+	WildcardMask ipmatch;
 };
 
 /** QLine class
@@ -327,7 +373,7 @@ class CoreExport QLine : public XLine
 	 * @param nickname Nickname to match
 	 */
 	QLine(time_t s_time, long d, std::string src, std::string re, std::string nickname)
-		: XLine(s_time, d, src, re, "Q"), nick(nickname)
+		: XLine(s_time, d, src, re, "Q"), nick(nickname), nickmatch(nickname)
 	{
 	}
 
@@ -347,6 +393,10 @@ class CoreExport QLine : public XLine
 	/** Nickname mask
 	 */
 	std::string nick;
+
+	/** Compiled form of nick
+	 */
+	WildcardMask nickmatch;
 };
 
 /** XLineFactory is used to generate an XLine pointer, given just the
@@ -391,6 +441,16 @@ class CoreExport XLineFactory
 	virtual ~XLineFactory() { }
 };
 
+/** Index of the lines of one type, used by XLineManager to find the lines which might match a user
+ * without checking every line. Defined in xline.cpp.
+ */
+class XLineIndex;
+
+/** Index of the local users, used by XLineManager to find the users a line might match without
+ * checking every user. Defined in xline.cpp.
+ */
+class XLineUserIndex;
+
 /** XLineManager is a class used to manage glines, klines, elines, zlines and qlines,
  * or any other line created by a module. It also manages XLineFactory classes which
  * can generate a specialized XLine for use by another module.
@@ -413,6 +473,21 @@ class CoreExport XLineManager
 	 */
 	XLineContainer lookup_lines;
 
+	/** Indexes of the lines in lookup_lines, keyed by line type
+	 */
+	std::map<std::string, XLineIndex*> line_indexes;
+
+	/** Index of the local users
+	 */
+	XLineUserIndex* user_index;
+
+	/** Get the lines of a type which might match a user, expired lines are not skipped.
+	 * @param type The type of lines to look up
+	 * @param user The user to find the lines for
+	 * @param lines Vector to append the lines to, every line is added at most once
+	 */
+	void FindCandidates(const std::string& type, User* user, std::vector<XLine*>& lines);
+
  public:
 
 	/** Constructor
@@ -429,8 +504,29 @@ class CoreExport XLineManager
 	IdentHostPair IdentSplit(const std::string &ident_and_host);
 
 	/** Checks what users match e:lines and sets their ban exempt flag accordingly.
+	 * @param eline If not NULL, only the users this E-line might match are checked. The line
+	 * must have been removed from the index already.
+	 */
+	void CheckELines(XLine* eline = NULL);
+
+	/** Add a local user to the index of local users, or update the index after the real host,
+	 * IP address, ident or registration state of the user changed.
+	 * @param user The user to add
+	 */
+	void IndexUser(LocalUser* user);
+
+	/** Remove a local user from the index of local users
+	 * @param user The user to remove
+	 */
+	void UnindexUser(LocalUser* user);
+
+	/** Get the local users which might match a line
+	 * @param line The line to look up
+	 * @param users Vector to append the users to
+	 * @return True if the users were looked up, false if the line can't be looked up in the index
+	 * and every local user might match it. Nothing is appended in the latter case.
 	 */
-	void CheckELines();
+	bool FindUsers(XLine* line, std::vector<LocalUser*>& users);
 
 	/** Get all lines of a certain type to an XLineLookup (std::map<std::string, XLine*>).
 	 * NOTE: When this function runs any expired items are removed from the list before it
@@ -34,8 +34,11 @@ namespace
 	ChanModeReference limitmode(NULL, "limit");
 }
 
+/** The last value given out by Channel::InvalidateListCache() as a list mode generation */
+static uint64_t lastlistmodegen = 0;
+
 Channel::Channel(const std::string &cname, time_t ts)
-	: name(cname), age(ts), topicset(0)
+	: listmodegen(0), name(cname), age(ts), topicset(0)
 {
 	if (!ServerInstance->chanlist.insert(std::make_pair(cname, this)).second)
 		throw CoreException("Cannot create duplicate channel " + cname);
@@ -66,19 +69,19 @@ void Channel::SetTopic(User* u, const std::string& ntopic, time_t topicts, const
 
 Membership* Channel::AddUser(User* user)
 {
-	std::pair<MemberMap::iterator, bool> ret = userlist.insert(std::make_pair(user, insp::aligned_storage<Membership>()));
-	if (!ret.second)
+	if (userlist.Get(user))
 		return NULL;
 
-	Membership* memb = new(ret.first->second) Membership(user, this);
+	Membership* memb = new Membership(user, this);
+	userlist.insert(memb);
 	return memb;
 }
 
 void Channel::DelUser(User* user)
 {
-	MemberMap::iterator it = userlist.find(user);
-	if (it != userlist.end())
-		DelUser(it);
+	Membership* memb = userlist.Get(user);
+	if (memb)
+		DelUser(memb);
 }
 
 void Channel::CheckDestroy()
@@ -101,12 +104,11 @@ void Channel::CheckDestroy()
 	ServerInstance->GlobalCulls.AddItem(this);
 }
 
-void Channel::DelUser(const MemberMap::iterator& membiter)
+void Channel::DelUser(Membership* memb)
 {
-	Membership* memb = membiter->second;
 	memb->cull();
-	memb->~Membership();
-	userlist.erase(membiter);
+	userlist.erase(memb);
+	delete memb;
 
 	// If this channel became empty then it should be removed
 	CheckDestroy();
@@ -114,10 +116,7 @@ void Channel::DelUser(const MemberMap::iterator& membiter)
 
 Membership* Channel::GetUser(User* user)
 {
-	MemberMap::iterator i = userlist.find(user);
-	if (i == userlist.end())
-		return NULL;
-	return i->second;
+	return userlist.Get(user);
 }
 
 void Channel::SetDefaultModes()
@@ -342,23 +341,30 @@ Membership* Channel::ForceJoin(User* user, const std::string* privs, bool bursti
 
 bool Channel::IsBanned(User* user)
 {
+	// Members remember the result until the bans or the user change
+	Membership* memb = userlist.Get(user);
 	ModResult result;
-	FIRST_MOD_RESULT(OnCheckChannelBan, result, (user, this));
-
-	if (result != MOD_RES_PASSTHRU)
+	if ((memb) && (memb->GetCachedBan(0, result)))
 		return (result == MOD_RES_DENY);
 
-	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
-	const ListModeBase::ModeList* bans = banlm->GetList(this);
-	if (bans)
+	FIRST_MOD_RESULT(OnCheckChannelBan, result, (user, this));
+
+	if (result == MOD_RES_PASSTHRU)
 	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); it++)
-		{
-			if (CheckBan(user, it->mask))
-				return true;
-		}
+		ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
+		ListModeBase::MatchIndex* bans = banlm->GetMatchIndex(this);
+		if ((bans) && (bans->GetAll().Matches(user, this)))
+			result = MOD_RES_DENY;
 	}
-	return false;
+
+	if (memb)
+		memb->SetCachedBan(0, result);
+	return (result == MOD_RES_DENY);
+}
+
+void Channel::InvalidateListCache()
+{
+	listmodegen = ++lastlistmodegen;
 }
 
 bool Channel::CheckBan(User* user, const std::string& mask)
@@ -391,22 +397,24 @@ bool Channel::CheckBan(User* user, const std::string& mask)
 
 ModResult Channel::GetExtBanStatus(User *user, char type)
 {
+	Membership* memb = userlist.Get(user);
 	ModResult rv;
-	FIRST_MOD_RESULT(OnExtBanCheck, rv, (user, this, type));
-	if (rv != MOD_RES_PASSTHRU)
+	if ((memb) && (memb->GetCachedBan(type, rv)))
 		return rv;
 
-	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
-	const ListModeBase::ModeList* bans = banlm->GetList(this);
-	if (bans)
+	FIRST_MOD_RESULT(OnExtBanCheck, rv, (user, this, type));
+	if (rv == MOD_RES_PASSTHRU)
 	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); ++it)
-		{
-			if (CheckBan(user, it->mask))
-				return MOD_RES_DENY;
-		}
+		ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
+		ListModeBase::MatchIndex* bans = banlm->GetMatchIndex(this);
+		ListModeBase::MatchIndex::Group* extbans = (bans ? bans->GetExtBans(type) : NULL);
+		if ((extbans) && (extbans->Matches(user, this)))
+			rv = MOD_RES_DENY;
 	}
-	return MOD_RES_PASSTHRU;
+
+	if (memb)
+		memb->SetCachedBan(type, rv);
+	return rv;
 }
 
 /* Channel::PartUser
@@ -415,12 +423,10 @@ ModResult Channel::GetExtBanStatus(User *user, char type)
  */
 bool Channel::PartUser(User* user, std::string& reason)
 {
-	MemberMap::iterator membiter = userlist.find(user);
-
-	if (membiter == userlist.end())
+	Membership* memb = userlist.Get(user);
+	if (!memb)
 		return false;
 
-	Membership* memb = membiter->second;
 	CUList except_list;
 	FOREACH_MOD(OnUserPart, (memb, reason, except_list));
 
@@ -429,7 +435,7 @@ bool Channel::PartUser(User* user, std::string& reason)
 	// Remove this channel from the user's chanlist
 	user->chans.erase(memb);
 	// Remove the Membership from this channel's userlist and destroy it
-	this->DelUser(membiter);
+	this->DelUser(memb);
 
 	return true;
 }
@@ -444,7 +450,7 @@ void Channel::KickUser(User* src, const MemberMap::iterator& victimiter, const s
 	WriteAllExcept(src, false, 0, except_list, "KICK %s %s :%s", name.c_str(), victim->nick.c_str(), reason.c_str());
 
 	victim->chans.erase(memb);
-	this->DelUser(victimiter);
+	this->DelUser(memb);
 }
 
 void Channel::WriteChannel(User* user, const char* text, ...)
@@ -456,13 +462,11 @@ void Channel::WriteChannel(User* user, const char* text, ...)
 
 void Channel::WriteChannel(User* user, const std::string &text)
 {
-	const std::string message = ":" + user->GetFullHost() + " " + text;
+	const StreamSocket::SendQueue::Element message = LocalUser::PrepareLine(":" + user->GetFullHost() + " " + text);
 
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
-	{
-		if (IS_LOCAL(i->first))
-			i->first->Write(message);
-	}
+	const MemberMap::LocalList& locals = userlist.GetLocal();
+	for (MemberMap::LocalList::const_iterator i = locals.begin(); i != locals.end(); ++i)
+		i->first->Write(message);
 }
 
 void Channel::WriteChannelWithServ(const std::string& ServName, const char* text, ...)
@@ -474,13 +478,11 @@ void Channel::WriteChannelWithServ(const std::string& ServName, const char* text
 
 void Channel::WriteChannelWithServ(const std::string& ServName, const std::string &text)
 {
-	const std::string message = ":" + (ServName.empty() ? ServerInstance->Config->ServerName : ServName) + " " + text;
+	const StreamSocket::SendQueue::Element message = LocalUser::PrepareLine(":" + (ServName.empty() ? ServerInstance->Config->ServerName : ServName) + " " + text);
 
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
-	{
-		if (IS_LOCAL(i->first))
-			i->first->Write(message);
-	}
+	const MemberMap::LocalList& locals = userlist.GetLocal();
+	for (MemberMap::LocalList::const_iterator i = locals.begin(); i != locals.end(); ++i)
+		i->first->Write(message);
 }
 
 /* write formatted text from a source user to all users on a channel except
@@ -514,16 +516,25 @@ void Channel::RawWriteAllExcept(User* user, bool serversource, char status, CULi
 		PrefixMode* mh = ServerInstance->Modes->FindPrefix(status);
 		if (mh)
 			minrank = mh->GetPrefixRank();
+
+		// Nothing to do if no local member has the status we're after
+		if ((minrank) && (!userlist.CountLocal(minrank)))
+			return;
 	}
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
+
+	// Build the line once, every local recipient shares the same buffer
+	const StreamSocket::SendQueue::Element line = LocalUser::PrepareLine(out);
+	const MemberMap::LocalList& locals = userlist.GetLocal();
+	for (MemberMap::LocalList::const_iterator i = locals.begin(); i != locals.end(); ++i)
 	{
-		if (IS_LOCAL(i->first) && (except_list.find(i->first) == except_list.end()))
+		LocalUser* const curr = i->first;
+		if (except_list.find(curr) == except_list.end())
 		{
 			/* User doesn't have the status we're after */
 			if (minrank && i->second->getRank() < minrank)
 				continue;
 
-			i->first->Write(out);
+			curr->Write(line);
 		}
 	}
 }
@@ -577,6 +588,31 @@ void Channel::WriteNotice(const std::string& text)
 	WriteChannelWithServ(ServerInstance->Config->ServerName, rawmsg);
 }
 
+bool Membership::GetCachedBan(char type, ModResult& result)
+{
+	const std::pair<uint64_t, uint64_t> gens(chan->GetListModeGen(), user->GetIdentityGen());
+	if (bangens != gens)
+	{
+		bancache.clear();
+		bangens = gens;
+		return false;
+	}
+
+	insp::flat_map<char, int>::const_iterator it = bancache.find(type);
+	if (it == bancache.end())
+		return false;
+
+	result = ModResult(it->second);
+	return true;
+}
+
+void Membership::SetCachedBan(char type, ModResult result)
+{
+	// Only store results found with the current generations, see GetCachedBan()
+	if (bangens == std::make_pair(chan->GetListModeGen(), user->GetIdentityGen()))
+		bancache[type] = result.res;
+}
+
 /* returns the status character for a given user on a channel, e.g. @ for op,
  * % for halfop etc. If the user has several modes set, the highest mode
  * the user has must be returned.
@@ -626,15 +662,18 @@ std::string Membership::GetAllPrefixChars() const
 
 unsigned int Channel::GetPrefixValue(User* user)
 {
-	MemberMap::iterator m = userlist.find(user);
-	if (m == userlist.end())
+	Membership* memb = userlist.Get(user);
+	if (!memb)
 		return 0;
-	return m->second->getRank();
+	return memb->getRank();
 }
 
 bool Membership::SetPrefix(PrefixMode* delta_mh, bool adding)
 {
+	const char oldprefix = (modes.empty() ? 0 : modes[0]);
 	char prefix = delta_mh->GetModeChar();
+	bool changed = adding;
+	bool found = false;
 	for (unsigned int i = 0; i < modes.length(); i++)
 	{
 		char mchar = modes[i];
@@ -644,10 +683,29 @@ bool Membership::SetPrefix(PrefixMode* delta_mh, bool adding)
 			modes = modes.substr(0,i) +
 				(adding ? std::string(1, prefix) : "") +
 				modes.substr(mchar == prefix ? i+1 : i);
-			return adding != (mchar == prefix);
+			changed = (adding != (mchar == prefix));
+			found = true;
+			break;
 		}
 	}
-	if (adding)
+	if ((!found) && (adding))
 		modes.push_back(prefix);
-	return adding;
+
+	chan->userlist.UpdatePrefix(this, oldprefix);
+	return changed;
+}
+
+size_t Channel::MemberMap::CountLocal(unsigned int minrank) const
+{
+	if (!minrank)
+		return localmembers.size();
+
+	size_t count = 0;
+	for (PrefixCountMap::const_iterator i = localprefixcounts.begin(); i != localprefixcounts.end(); ++i)
+	{
+		PrefixMode* mh = ServerInstance->Modes->FindPrefixMode(i->first);
+		if ((mh) && (mh->GetPrefixRank() >= minrank))
+			count += i->second;
+	}
+	return count;
 }
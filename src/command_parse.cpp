@@ -107,15 +107,106 @@ bool CommandParser::LoopCall(User* user, Command* handler, const std::vector<std
 	return true;
 }
 
-Command* CommandParser::GetHandler(const std::string &commandname)
+namespace
 {
-	CommandMap::iterator n = cmdlist.find(commandname);
-	if (n != cmdlist.end())
-		return n->second;
+	/** Hash a command name case insensitively
+	 */
+	size_t HashCommandName(const std::string& name)
+	{
+		// FNV-1a
+		size_t hash = 2166136261U;
+		for (std::string::const_iterator i = name.begin(); i != name.end(); ++i)
+		{
+			hash ^= static_cast<unsigned char>(toupper(*i));
+			hash *= 16777619U;
+		}
+		return hash;
+	}
+
+	/** Read the next token from a line the same way as irc::tokenstream::GetToken()
+	 * @param line The line to read from
+	 * @param pos Position to start reading at, updated to the position after the token
+	 * @param token The token will be written here
+	 * @param allowtrailing True if the token may be a trailing parameter
+	 * @return True if a token was read, false if the end of the line was reached
+	 */
+	bool NextToken(const std::string& line, std::string::size_type& pos, std::string& token, bool allowtrailing)
+	{
+		pos = line.find_first_not_of(' ', pos);
+		if (pos == std::string::npos)
+			return false;
+
+		if ((allowtrailing) && (line[pos] == ':'))
+		{
+			token.assign(line, pos + 1, std::string::npos);
+			pos = std::string::npos;
+			return true;
+		}
 
+		std::string::size_type end = line.find(' ', pos);
+		if (end == std::string::npos)
+			end = line.length();
+
+		token.assign(line, pos, end - pos);
+		pos = end;
+		return true;
+	}
+}
+
+Command* CommandParser::GetHandler(const std::string &commandname)
+{
+	const size_t mask = cmdtable.size() - 1;
+	for (size_t i = HashCommandName(commandname) & mask; cmdtable[i]; i = (i + 1) & mask)
+	{
+		if (irc::equals(cmdtable[i]->name, commandname))
+			return cmdtable[i];
+	}
 	return NULL;
 }
 
+void CommandParser::RebuildTable()
+{
+	size_t size = 32;
+	while (size < cmdlist.size() * 2)
+		size *= 2;
+
+	cmdtable.assign(size, NULL);
+	const size_t mask = size - 1;
+	for (CommandMap::const_iterator n = cmdlist.begin(); n != cmdlist.end(); ++n)
+	{
+		size_t i = HashCommandName(n->first) & mask;
+		while (cmdtable[i])
+			i = (i + 1) & mask;
+		cmdtable[i] = n->second;
+	}
+}
+
+void CommandParser::SplitLine(const std::string& line, std::string& command, std::vector<std::string>& params)
+{
+	std::string::size_type pos = 0;
+	if (!NextToken(line, pos, command, false))
+		command.clear();
+
+	/* A client sent a nick prefix on their command (ick)
+	 * rhapsody and some braindead bouncers do this --
+	 * the rfc says they shouldnt but also says the ircd should
+	 * discard it if they do.
+	 */
+	if ((!command.empty()) && (command[0] == ':') && (!NextToken(line, pos, command, true)))
+		command.clear();
+
+	size_t count = 0;
+	for (;;)
+	{
+		if (count == params.size())
+			params.push_back(std::string());
+		if (!NextToken(line, pos, params[count], true))
+			break;
+		count++;
+	}
+	params.resize(count);
+}
+
 // calls a handler function for a command
 
 CmdResult CommandParser::CallHandler(const std::string& commandname, const std::vector<std::string>& parameters, User* user, Command** cmd)
@@ -161,24 +252,28 @@ CmdResult CommandParser::CallHandler(const std::string& commandname, const std::
 
 void CommandParser::ProcessCommand(LocalUser *user, std::string &cmd)
 {
-	std::vector<std::string> command_p;
-	irc::tokenstream tokens(cmd);
-	std::string command, token;
-	tokens.GetToken(command);
+	if (parsedepth == parsebuffers.size())
+		parsebuffers.push_back(ParseBuffer());
+	ParseBuffer& buffer = parsebuffers[parsedepth];
 
-	/* A client sent a nick prefix on their command (ick)
-	 * rhapsody and some braindead bouncers do this --
-	 * the rfc says they shouldnt but also says the ircd should
-	 * discard it if they do.
-	 */
-	if (command[0] == ':')
-		tokens.GetToken(command);
-
-	while (tokens.GetToken(token))
-		command_p.push_back(token);
+	SplitLine(cmd, buffer.command, buffer.params);
+	std::transform(buffer.command.begin(), buffer.command.end(), buffer.command.begin(), ::toupper);
 
-	std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+	parsedepth++;
+	try
+	{
+		ProcessCommand(user, cmd, buffer.command, buffer.params);
+	}
+	catch (...)
+	{
+		parsedepth--;
+		throw;
+	}
+	parsedepth--;
+}
 
+void CommandParser::ProcessCommand(LocalUser* user, std::string& cmd, std::string& command, std::vector<std::string>& command_p)
+{
 	/* find the command, check it exists */
 	Command* handler = GetHandler(command);
 
@@ -339,7 +434,10 @@ void CommandParser::RemoveCommand(Command* x)
 {
 	CommandMap::iterator n = cmdlist.find(x->name);
 	if (n != cmdlist.end() && n->second == x)
+	{
 		cmdlist.erase(n);
+		RebuildTable();
+	}
 }
 
 CommandBase::CommandBase(Module* mod, const std::string& cmd, unsigned int minpara, unsigned int maxpara)
@@ -400,13 +498,16 @@ bool CommandParser::AddCommand(Command *f)
 	if (cmdlist.find(f->name) == cmdlist.end())
 	{
 		cmdlist[f->name] = f;
+		RebuildTable();
 		return true;
 	}
 	return false;
 }
 
 CommandParser::CommandParser()
+	: parsedepth(0)
 {
+	RebuildTable();
 }
 
 std::string CommandParser::TranslateUIDs(const std::vector<TranslateType>& to, const std::vector<std::string>& source, bool prefix_final, CommandBase* custom_translator)
@@ -403,6 +403,7 @@ void ServerConfig::Fill()
 			national_case_insensitive_map = rfc_case_insensitive_map;
 		else
 			throw CoreException("<options:casemapping> must be set to 'ascii', or 'rfc1459'");
+		national_case_map_generation++;
 	}
 	else
 	{
@@ -426,6 +427,7 @@ void ServerConfig::Fill()
 	ServerDesc = server->getString("description", "Configure Me");
 	Network = server->getString("network", "Network");
 	NetBufferSize = ConfValue("performance")->getInt("netbuffersize", 10240, 1024, 65534);
+	IOThreads = ConfValue("performance")->getInt("iothreads", 0, 0, 64);
 	DisabledDontExist = ConfValue("disabled")->getBool("fakenonexistant");
 	UserStats = security->getString("userstats");
 	CustomVersion = security->getString("customversion");
@@ -829,6 +831,12 @@ void ConfigReaderThread::Finish()
 			}
 		}
 
+		// Ban checks may depend on the configuration of the core and modules (e.g. connect
+		// classes), discard any ban verdicts cached under the old one
+		const chan_hash& chans = ServerInstance->GetChans();
+		for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
+			i->second->InvalidateListCache();
+
 		// The description of this server may have changed - update it for WHOIS etc.
 		ServerInstance->FakeClient->server->description = Config->ServerDesc;
 
@@ -65,6 +65,8 @@ InspIRCd* ServerInstance = NULL;
  */
 unsigned const char *national_case_insensitive_map = rfc_case_insensitive_map;
 
+unsigned long national_case_map_generation = 0;
+
 
 /* Moved from exitcodes.h -- due to duplicate symbols -- Burlex
  * XXX this is a bit ugly. -- w00t
@@ -121,6 +123,7 @@ void InspIRCd::Cleanup()
 	DeleteZero(this->FakeClient);
 	DeleteZero(this->XLines);
 	DeleteZero(this->Config);
+	SocketEngine::SetIOThreadCount(0);
 	SocketEngine::Deinit();
 	Logs->CloseLogs();
 }
@@ -645,14 +648,15 @@ void InspIRCd::Run()
 			{
 				FOREACH_MOD(OnGarbageCollect, ());
 
-				// HACK: ELines are not expired properly at the moment but it can't be fixed as
-				// the 2.0 XLine system is a spaghetti nightmare. Instead we skip over expired
-				// ELines in XLineManager::CheckELines() and expire them here instead.
-				XLines->GetAll("E");
+				// Lines are only expired when they are looked at and XLineManager::MatchesLine()
+				// only looks at the lines which might match the user. Expired ELines are also
+				// skipped over in XLineManager::CheckELines(). Expire all of them here instead.
+				const std::vector<std::string> types = XLines->GetAllTypes();
+				for (std::vector<std::string>::const_iterator i = types.begin(); i != types.end(); ++i)
+					XLines->GetAll(*i);
 			}
 
 			Timers.TickTimers(TIME.tv_sec);
-			Users->DoBackgroundUserStuff();
 
 			if ((TIME.tv_sec % 5) == 0)
 			{
@@ -275,77 +275,11 @@ void StreamSocket::FlushSendQ(SendQueue& sq)
 		while (error.empty() && !sq.empty() && eventChange == FD_WANT_EDGE_WRITE)
 		{
 			// Prepare a writev() call to write all buffers efficiently
-			int bufcount = sq.size();
-
-			// cap the number of buffers at MYIOV_MAX
-			if (bufcount > MYIOV_MAX)
-			{
-				bufcount = MYIOV_MAX;
-			}
-
-			int rv_max = 0;
-			int rv;
-			{
-				SocketEngine::IOVector iovecs[MYIOV_MAX];
-				size_t j = 0;
-				for (SendQueue::const_iterator i = sq.begin(), end = i+bufcount; i != end; ++i, j++)
-				{
-					const SendQueue::Element& elem = *i;
-					iovecs[j].iov_base = const_cast<char*>(elem.data());
-					iovecs[j].iov_len = elem.length();
-					rv_max += elem.length();
-				}
-				rv = SocketEngine::WriteV(this, iovecs, bufcount);
-			}
-
-			if (rv == (int)sq.bytes())
-			{
-				// it's our lucky day, everything got written out. Fast cleanup.
-				// This won't ever happen if the number of buffers got capped.
-				sq.clear();
-			}
-			else if (rv > 0)
-			{
-				// Partial write. Clean out strings from the sendq
-				if (rv < rv_max)
-				{
-					// it's going to block now
-					eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
-				}
-				while (rv > 0 && !sq.empty())
-				{
-					const SendQueue::Element& front = sq.front();
-					if (front.length() <= (size_t)rv)
-					{
-						// this string got fully written out
-						rv -= front.length();
-						sq.pop_front();
-					}
-					else
-					{
-						// stopped in the middle of this string
-						sq.erase_front(rv);
-						rv = 0;
-					}
-				}
-			}
-			else if (rv == 0)
-			{
-				error = "Connection closed";
-			}
-			else if (SocketEngine::IgnoreError())
-			{
-				eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
-			}
-			else if (errno == EINTR)
-			{
-				// restart interrupted syscall
-				errno = 0;
-			}
-			else
-			{
-				error = SocketEngine::LastError();
-			}
+			SocketEngine::IOVector iovecs[MYIOV_MAX];
+			size_t rv_max;
+			const int bufcount = FillIOVector(sq, iovecs, rv_max);
+			const int rv = SocketEngine::WriteV(this, iovecs, bufcount);
+			eventChange = ProcessWriteResult(sq, rv, rv_max, errno);
 		}
 		if (!error.empty())
 		{
@@ -358,6 +292,116 @@ void StreamSocket::FlushSendQ(SendQueue& sq)
 		}
 }
 
+int StreamSocket::FillIOVector(const SendQueue& sq, SocketEngine::IOVector* iovecs, size_t& total)
+{
+	int bufcount = sq.size();
+
+	// cap the number of buffers at MYIOV_MAX
+	if (bufcount > MYIOV_MAX)
+	{
+		bufcount = MYIOV_MAX;
+	}
+
+	total = 0;
+	size_t j = 0;
+	for (SendQueue::const_iterator i = sq.begin(), end = i+bufcount; i != end; ++i, j++)
+	{
+		const SendQueue::Element& elem = *i;
+		iovecs[j].iov_base = const_cast<char*>(elem.data());
+		iovecs[j].iov_len = elem.length();
+		total += elem.length();
+	}
+	return bufcount;
+}
+
+int StreamSocket::ProcessWriteResult(SendQueue& sq, int rv, size_t total, int errnum)
+{
+	errno = errnum;
+	int eventChange = FD_WANT_EDGE_WRITE;
+	if (rv == (int)sq.bytes())
+	{
+		// it's our lucky day, everything got written out. Fast cleanup.
+		// This won't ever happen if the number of buffers got capped.
+		sq.clear();
+	}
+	else if (rv > 0)
+	{
+		// Partial write. Clean out strings from the sendq
+		if ((size_t)rv < total)
+		{
+			// it's going to block now
+			eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
+		}
+		while (rv > 0 && !sq.empty())
+		{
+			const SendQueue::Element& front = sq.front();
+			if (front.length() <= (size_t)rv)
+			{
+				// this string got fully written out
+				rv -= front.length();
+				sq.pop_front();
+			}
+			else
+			{
+				// stopped in the middle of this string
+				sq.erase_front(rv);
+				rv = 0;
+			}
+		}
+	}
+	else if (rv == 0)
+	{
+		error = "Connection closed";
+	}
+	else if (SocketEngine::IgnoreError())
+	{
+		eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
+	}
+	else if (errno == EINTR)
+	{
+		// restart interrupted syscall
+		errno = 0;
+	}
+	else
+	{
+		error = SocketEngine::LastError();
+	}
+	return eventChange;
+}
+
+bool StreamSocket::CanWriteThreaded() const
+{
+	// Data going through IOHooks has to be handled by the main thread
+	return ((!GetIOHook()) && (error.empty()) && (fd > -1) && (!sendq.empty()) && (!(GetEventMask() & FD_WRITE_WILL_BLOCK)));
+}
+
+int StreamSocket::PrepareThreadedWrite(std::vector<SocketEngine::IOVector>& iovecs, size_t& total)
+{
+	const size_t first = iovecs.size();
+	iovecs.resize(first + MYIOV_MAX);
+	const int bufcount = FillIOVector(sendq, &iovecs[first], total);
+	iovecs.resize(first + bufcount);
+	return bufcount;
+}
+
+void StreamSocket::FinishThreadedWrite(int rv, size_t total, int errnum)
+{
+	const int eventChange = ProcessWriteResult(sendq, rv, total, errnum);
+	if ((error.empty()) && (eventChange == FD_WANT_EDGE_WRITE) && (!sendq.empty()))
+	{
+		// More buffers were queued than a single writev() call takes, write the rest now
+		FlushSendQ(sendq);
+	}
+	else if (!error.empty())
+	{
+		SocketEngine::ChangeEventMask(this, FD_WANT_NO_READ | FD_WANT_NO_WRITE);
+	}
+	else
+	{
+		SocketEngine::ChangeEventMask(this, eventChange);
+	}
+}
+
 void StreamSocket::WriteData(const std::string &data)
 {
 	if (fd < 0)
@@ -373,6 +417,20 @@ void StreamSocket::WriteData(const std::string &data)
 	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
 }
 
+void StreamSocket::WriteData(const SendQueue::Element& data)
+{
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to write data to dead socket: %.*s",
+			(int)data.length(), data.data());
+		return;
+	}
+
+	sendq.push_back(data);
+
+	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
+}
+
 bool SocketTimeout::Tick(time_t)
 {
 	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "SocketTimeout::Tick");
@@ -416,6 +474,12 @@ void BufferedSocket::OnEventHandlerWrite()
 	this->StreamSocket::OnEventHandlerWrite();
 }
 
+bool BufferedSocket::CanWriteThreaded() const
+{
+	// OnEventHandlerWrite() has to see the first write event to call OnConnected()
+	return ((state == I_CONNECTED) && (StreamSocket::CanWriteThreaded()));
+}
+
 BufferedSocket::~BufferedSocket()
 {
 	this->Close();
@@ -522,6 +586,24 @@ void StreamSocket::AddIOHook(IOHook* newhook)
 	lasthook->SetNextHook(newhook);
 }
 
+void StreamSocket::InsertIOHook(IOHookMiddle* newhook)
+{
+	newhook->SetNextHook(iohook);
+	iohook = newhook;
+}
+
+IOHook* StreamSocket::GetLastHook() const
+{
+	IOHook* curr = GetIOHook();
+	IOHook* last = curr;
+	while (curr)
+	{
+		last = curr;
+		curr = GetNextHook(curr);
+	}
+	return last;
+}
+
 size_t StreamSocket::getSendQSize() const
 {
 	size_t ret = sendq.bytes();
@@ -28,6 +28,198 @@ ListModeBase::ListModeBase(Module* Creator, const std::string& Name, char modech
 	list = true;
 }
 
+ListModeBase::ListItem::ListItem(const std::string& Mask, const std::string& Setter, time_t Time)
+	: setter(Setter), mask(Mask), time(Time)
+{
+	// Extbans and masks without an '@' are never matched by Channel::CheckBan() so there is nothing to compile
+	std::string::size_type at = mask.find('@');
+	if ((mask.length() <= 2) || (mask[1] == ':') || (at == std::string::npos))
+		return;
+
+	nickident = WildcardMask(mask.substr(0, at));
+	host = WildcardMask(mask.substr(at + 1));
+}
+
+bool ListModeBase::ListItem::MatchUser(User* user) const
+{
+	if ((mask.length() <= 2) || (mask[1] == ':'))
+		return false;
+
+	// Build nick!ident on the stack, if the mask has no '@' nickident is empty and never matches
+	const std::string::size_type nicklen = user->nick.length();
+	const std::string::size_type identlen = user->ident.length();
+	char buffer[256];
+	std::string longnickident;
+	const char* nickidentstr = buffer;
+	if (nicklen + identlen + 2 <= sizeof(buffer))
+	{
+		memcpy(buffer, user->nick.c_str(), nicklen);
+		buffer[nicklen] = '!';
+		memcpy(buffer + nicklen + 1, user->ident.c_str(), identlen + 1);
+	}
+	else
+	{
+		longnickident = user->nick + "!" + user->ident;
+		nickidentstr = longnickident.c_str();
+	}
+
+	if (!nickident.Match(nickidentstr))
+		return false;
+
+	if ((host.Match(user->GetRealHost())) || (host.Match(user->GetDisplayedHost())))
+		return true;
+
+	// Same as InspIRCd::MatchCIDR(), which cannot succeed on a mask without a '/'
+	const std::string& hostmask = host.GetMask();
+	if ((hostmask.find('/') != std::string::npos) && (irc::sockets::MatchCIDR(user->GetIPString(), hostmask, true)))
+		return true;
+	return host.Match(user->GetIPString());
+}
+
+ListModeBase::MatchIndex::MatchIndex(const ModeList& list)
+	: casemapgen(national_case_map_generation)
+{
+	// Copy the extban masks first so the pointers to them stay valid
+	for (ModeList::const_iterator i = list.begin(); i != list.end(); ++i)
+	{
+		if ((i->mask.length() > 2) && (i->mask[1] == ':'))
+			extbanitems.push_back(ListItem(i->mask.substr(2), i->setter, i->time));
+	}
+
+	ModeList::const_iterator extban = extbanitems.begin();
+	for (ModeList::const_iterator i = list.begin(); i != list.end(); ++i)
+	{
+		all.Add(&*i);
+		if ((i->mask.length() > 2) && (i->mask[1] == ':'))
+			extbans[i->mask[0]].Add(&*extban++);
+	}
+}
+
+ListModeBase::MatchIndex::Group* ListModeBase::MatchIndex::GetExtBans(char type)
+{
+	insp::flat_map<char, Group>::iterator it = extbans.find(type);
+	if (it == extbans.end())
+		return NULL;
+	return &it->second;
+}
+
+void ListModeBase::MatchIndex::Group::Add(const ListItem* item)
+{
+	items.push_back(item);
+
+	// Only nick!ident@host masks can match without help from a module
+	const std::string& mask = item->mask;
+	if ((mask.length() <= 2) || (mask[1] == ':') || (mask.find('@') == std::string::npos))
+		return;
+
+	const std::string& host = item->host.GetMask();
+	if (host.find_first_of("*?") == std::string::npos)
+	{
+		std::string key(host);
+		for (std::string::iterator c = key.begin(); c != key.end(); ++c)
+			*c = national_case_insensitive_map[static_cast<unsigned char>(*c)];
+		hosts.insert(std::make_pair(key, item));
+	}
+	else
+	{
+		wild.push_back(item);
+	}
+
+	// irc::sockets::MatchCIDR() ignores everything up to the last '@' in the host part
+	const std::string::size_type at = host.rfind('@');
+	const std::string range(host, (at == std::string::npos ? 0 : at + 1));
+	const std::string::size_type slash = range.rfind('/');
+	if ((slash == std::string::npos) || (slash == range.length() - 1)
+		|| (range.find_first_not_of("0123456789", slash + 1) != std::string::npos)
+		|| (range.find_first_not_of("0123456789abcdefABCDEF.:") < slash))
+		return;
+
+	irc::sockets::sockaddrs sa;
+	if (!irc::sockets::aptosa(range.substr(0, slash), 0, sa))
+		return;
+
+	irc::sockets::cidr_mask cidr(range);
+	cidrs.insert(std::make_pair(cidr, item));
+	cidrlengths.insert(std::make_pair(cidr.type, cidr.length));
+}
+
+bool ListModeBase::MatchIndex::Group::FindHost(User* user, const std::string& host)
+{
+	folded.assign(host);
+	for (std::string::iterator c = folded.begin(); c != folded.end(); ++c)
+		*c = national_case_insensitive_map[static_cast<unsigned char>(*c)];
+
+	std::pair<HostMap::const_iterator, HostMap::const_iterator> range = hosts.equal_range(folded);
+	for (HostMap::const_iterator i = range.first; i != range.second; ++i)
+	{
+		if (i->second->MatchUser(user))
+			return true;
+	}
+	return false;
+}
+
+bool ListModeBase::MatchIndex::Group::FindMatch(User* user, Channel* chan)
+{
+	if ((hosts.empty()) && (cidrs.empty()) && (wild.empty()))
+		return false;
+
+	ResultCache::iterator cached = cache.find(user);
+	if ((cached != cache.end()) && (cached->second.first == user->GetIdentityGen()))
+		return cached->second.second;
+
+	bool result = false;
+	if (!hosts.empty())
+	{
+		result = ((FindHost(user, user->GetRealHost())) || (FindHost(user, user->GetIPString()))
+			|| ((user->GetDisplayedHost() != user->GetRealHost()) && (FindHost(user, user->GetDisplayedHost()))));
+	}
+
+	for (CIDRLengths::const_iterator i = cidrlengths.begin(); (!result) && (i != cidrlengths.end()); ++i)
+	{
+		if (i->first != user->client_sa.sa.sa_family)
+			continue;
+
+		std::pair<CIDRMap::const_iterator, CIDRMap::const_iterator> range = cidrs.equal_range(irc::sockets::cidr_mask(user->client_sa, i->second));
+		for (CIDRMap::const_iterator j = range.first; j != range.second; ++j)
+		{
+			if (j->second->MatchUser(user))
+			{
+				result = true;
+				break;
+			}
+		}
+	}
+
+	for (std::vector<const ListItem*>::const_iterator i = wild.begin(); (!result) && (i != wild.end()); ++i)
+		result = (*i)->MatchUser(user);
+
+	// Users who have left the channel are never removed so start over once there are too many
+	if (cache.size() > static_cast<size_t>(chan->GetUserCounter()) * 2 + 64)
+		cache.clear();
+	cache[user] = std::make_pair(user->GetIdentityGen(), result);
+	return result;
+}
+
+bool ListModeBase::MatchIndex::Group::Matches(User* user, Channel* chan)
+{
+	const bool found = FindMatch(user, chan);
+	if (ServerInstance->Modules->EventHandlers[I_OnCheckBan].empty())
+		return found;
+
+	// Modules may match or exempt any mask so every entry has to be offered to them, but
+	// when no mask matches by itself there is no need to check the masks again
+	for (std::vector<const ListItem*>::const_iterator i = items.begin(); i != items.end(); ++i)
+	{
+		ModResult result;
+		FIRST_MOD_RESULT(OnCheckBan, result, (user, chan, (*i)->mask));
+		if (result == MOD_RES_DENY)
+			return true;
+		if ((result == MOD_RES_PASSTHRU) && (found) && ((*i)->MatchUser(user)))
+			return true;
+	}
+	return false;
+}
+
 void ListModeBase::DisplayList(User* user, Channel* channel)
 {
 	ChanData* cd = extItem.get(channel);
@@ -187,6 +379,8 @@ ModeAction ListModeBase::OnModeChange(User* source, User*, Channel* channel, std
 		{
 			// And now add the mask onto the list...
 			cd->list.push_back(ListItem(parameter, source->nick, ServerInstance->Time()));
+			cd->InvalidateIndex();
+			channel->InvalidateListCache();
 			return MODEACTION_ALLOW;
 		}
 		else
@@ -205,6 +399,8 @@ ModeAction ListModeBase::OnModeChange(User* source, User*, Channel* channel, std
 				if (parameter == it->mask)
 				{
 					stdalgo::vector::swaperase(cd->list, it);
+					cd->InvalidateIndex();
+					channel->InvalidateListCache();
 					return MODEACTION_ALLOW;
 				}
 			}
@@ -127,6 +127,12 @@ bool ModuleManager::Load(const std::string& inputname, bool defer)
 
 	FOREACH_MOD(OnLoadModule, (mod));
 	PrioritizeHooks();
+
+	// The module may provide ban checks, discard any ban verdicts cached without them
+	const chan_hash& chans = ServerInstance->GetChans();
+	for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
+		i->second->InvalidateListCache();
+
 	ServerInstance->ISupport.Build();
 	return true;
 }
@@ -379,6 +379,8 @@ void ModuleManager::DoSafeUnload(Module* mod)
 		++c;
 		mod->OnCleanup(ExtensionItem::EXT_CHANNEL, chan);
 		chan->doUnhookExtensions(items);
+		// The module may have provided ban checks which the cached verdicts depend on
+		chan->InvalidateListCache();
 		const Channel::MemberMap& users = chan->GetUsers();
 		for (Channel::MemberMap::const_iterator mi = users.begin(); mi != users.end(); ++mi)
 		{
@@ -110,6 +110,14 @@ typedef gnutls_connection_end_t inspircd_gnutls_session_init_flags_t;
 #define INSPIRCD_GNUTLS_HAS_CORK
 #endif
 
+#if INSPIRCD_GNUTLS_HAS_VERSION(2, 10, 0)
+#define INSPIRCD_GNUTLS_HAS_TICKETS
+#endif
+
+#if INSPIRCD_GNUTLS_HAS_VERSION(3, 6, 3)
+#define INSPIRCD_GNUTLS_HAS_TLS13
+#endif
+
 static Module* thismod;
 
 class RandGen : public HandlerBase2<void, char*, size_t>
@@ -566,6 +574,151 @@ namespace GnuTLS
 		int ret() const { return retval; }
 	};
 
+	/** Sessions of clients which can be resumed, stored by GnuTLS through the db callbacks
+	 */
+	class SessionCache
+	{
+		struct Entry
+		{
+			std::string data;
+			time_t expires;
+		};
+
+		typedef std::map<std::string, Entry> EntryMap;
+		EntryMap entries;
+
+		/** Maximum number of sessions stored
+		 */
+		const unsigned long maxsize;
+
+		/** Number of seconds sessions can be resumed for
+		 */
+		const unsigned int timeout;
+
+		static std::string ToString(const gnutls_datum_t& datum)
+		{
+			return std::string(reinterpret_cast<const char*>(datum.data), datum.size);
+		}
+
+		static int Store(void* ptr, gnutls_datum_t key, gnutls_datum_t data)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			// Session ids are random so this evicts an arbitrary session when the cache is full
+			if ((cache->entries.size() >= cache->maxsize) && (!cache->entries.empty()))
+				cache->entries.erase(cache->entries.begin());
+
+			Entry& entry = cache->entries[ToString(key)];
+			entry.data = ToString(data);
+			entry.expires = ServerInstance->Time() + cache->timeout;
+			return 0;
+		}
+
+		static gnutls_datum_t Retrieve(void* ptr, gnutls_datum_t key)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			gnutls_datum_t ret = { NULL, 0 };
+
+			EntryMap::iterator it = cache->entries.find(ToString(key));
+			if (it == cache->entries.end())
+				return ret;
+
+			if (it->second.expires <= ServerInstance->Time())
+			{
+				cache->entries.erase(it);
+				return ret;
+			}
+
+			// GnuTLS frees the returned data
+			const std::string& data = it->second.data;
+			ret.data = static_cast<unsigned char*>(gnutls_malloc(data.length()));
+			if (ret.data)
+			{
+				memcpy(ret.data, data.data(), data.length());
+				ret.size = static_cast<unsigned int>(data.length());
+			}
+			return ret;
+		}
+
+		static int Remove(void* ptr, gnutls_datum_t key)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			cache->entries.erase(ToString(key));
+			return 0;
+		}
+
+	 public:
+		SessionCache(unsigned long size, unsigned int expiration)
+			: maxsize(size)
+			, timeout(expiration)
+		{
+		}
+
+		/** Make the given server session store its parameters in this cache and look up
+		 * the sessions clients ask to resume here
+		 */
+		void SetupSession(gnutls_session_t sess)
+		{
+			gnutls_db_set_cache_expiration(sess, timeout);
+			if (!maxsize)
+				return;
+
+			gnutls_db_set_ptr(sess, this);
+			gnutls_db_set_store_function(sess, Store);
+			gnutls_db_set_retrieve_function(sess, Retrieve);
+			gnutls_db_set_remove_function(sess, Remove);
+		}
+
+		size_t size() const { return entries.size(); }
+	};
+
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+	/** Key used to encrypt session tickets, held in memory only and replaced every rotation interval.
+	 * Tickets encrypted with a replaced key are rejected and the client does a full handshake.
+	 */
+	class TicketKey
+	{
+		gnutls_datum_t key;
+		time_t created;
+
+		/** Number of seconds a key is used for
+		 */
+		const time_t rotation;
+
+		void Free()
+		{
+			memset(key.data, 0, key.size);
+			gnutls_free(key.data);
+		}
+
+	 public:
+		TicketKey(time_t interval)
+			: created(ServerInstance->Time())
+			, rotation(interval)
+		{
+			ThrowOnError(gnutls_session_ticket_key_generate(&key), "Unable to generate session ticket key");
+		}
+
+		~TicketKey()
+		{
+			Free();
+		}
+
+		/** Enable session tickets encrypted with the current key on the given server session
+		 */
+		void SetupSession(gnutls_session_t sess)
+		{
+			gnutls_datum_t newkey;
+			if ((ServerInstance->Time() - created >= rotation) && (gnutls_session_ticket_key_generate(&newkey) >= 0))
+			{
+				Free();
+				key = newkey;
+				created = ServerInstance->Time();
+			}
+			gnutls_session_ticket_enable_server(sess, &key);
+		}
+	};
+#endif
+
 	class Profile
 	{
 		/** Name of this profile
@@ -596,6 +749,26 @@ namespace GnuTLS
 		 */
 		const bool requestclientcert;
 
+		/** Sessions clients can resume
+		 */
+		SessionCache sessioncache;
+
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+		/** Key session tickets are encrypted with, NULL if session tickets are disabled
+		 */
+		std::auto_ptr<TicketKey> ticketkey;
+#endif
+
+		/** Sessions of outgoing connections which can be resumed, keyed by the address of the peer
+		 */
+		typedef std::map<std::string, std::string> ClientSessionMap;
+		ClientSessionMap clientsessions;
+
+		/** Number of handshakes completed with and without resuming a session
+		 */
+		unsigned long fullhandshakes;
+		unsigned long resumedhandshakes;
+
 		static std::string ReadFile(const std::string& filename)
 		{
 			FileReader reader(filename);
@@ -649,6 +822,11 @@ namespace GnuTLS
 			unsigned int outrecsize;
 			bool requestclientcert;
 
+			unsigned long sessioncachesize;
+			unsigned int sessiontimeout;
+			bool sessiontickets;
+			time_t ticketrotation;
+
 			Config(const std::string& profilename, ConfigTag* tag)
 				: name(profilename)
 				, certstr(ReadFile(tag->getString("certfile", "cert.pem")))
@@ -658,6 +836,10 @@ namespace GnuTLS
 				, mindh(tag->getInt("mindhbits", 1024))
 				, hashstr(tag->getString("hash", "md5"))
 				, requestclientcert(tag->getBool("requestclientcert", true))
+				, sessioncachesize(tag->getInt("sessioncache", 20480, 0))
+				, sessiontimeout(tag->getDuration("sessiontimeout", 3600, 1))
+				, sessiontickets(tag->getBool("sessiontickets", true))
+				, ticketrotation(tag->getDuration("ticketkeyrotation", 3600, 60))
 			{
 				// Load trusted CA and revocation list, if set
 				std::string filename = tag->getString("cafile");
@@ -687,9 +869,16 @@ namespace GnuTLS
 			, priority(config.priostr)
 			, outrecsize(config.outrecsize)
 			, requestclientcert(config.requestclientcert)
+			, sessioncache(config.sessioncachesize, config.sessiontimeout)
+			, fullhandshakes(0)
+			, resumedhandshakes(0)
 		{
 			x509cred.SetDH(config.dh);
 			x509cred.SetCA(config.ca, config.crl);
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			if (config.sessiontickets)
+				ticketkey.reset(new TicketKey(config.ticketrotation));
+#endif
 		}
 		/** Set up the given session with the settings in this profile
 		 */
@@ -704,6 +893,50 @@ namespace GnuTLS
 				gnutls_certificate_server_set_request(sess, GNUTLS_CERT_REQUEST);
 		}
 
+		/** Let clients resume their sessions on the given server session, from our cache or from a ticket
+		 */
+		void SetupServerResumption(gnutls_session_t sess)
+		{
+			sessioncache.SetupSession(sess);
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			if (ticketkey.get())
+				ticketkey->SetupSession(sess);
+#endif
+		}
+
+		/** Offer the session of the last connection to the given peer for resumption on the given client session
+		 */
+		void SetupClientResumption(gnutls_session_t sess, const std::string& peer)
+		{
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			if (ticketkey.get())
+				gnutls_session_ticket_enable_client(sess);
+#endif
+			ClientSessionMap::const_iterator it = clientsessions.find(peer);
+			if (it != clientsessions.end())
+				gnutls_session_set_data(sess, it->second.data(), it->second.length());
+		}
+
+		/** Remember the session of an outgoing connection to resume it when connecting to the same peer again
+		 * @param peer Address of the peer
+		 * @param data Session data from gnutls_session_get_data2()
+		 */
+		void SetClientSession(const std::string& peer, const std::string& data)
+		{
+			clientsessions[peer] = data;
+		}
+
+		void CountHandshake(bool resumed)
+		{
+			if (resumed)
+				resumedhandshakes++;
+			else
+				fullhandshakes++;
+		}
+
+		size_t GetCachedSessionCount() const { return sessioncache.size(); }
+		unsigned long GetFullHandshakeCount() const { return fullhandshakes; }
+		unsigned long GetResumedHandshakeCount() const { return resumedhandshakes; }
 		const std::string& GetName() const { return name; }
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		gnutls_digest_algorithm_t GetHash() const { return hash.get(); }
@@ -720,6 +953,30 @@ class GnuTLSIOHook : public SSLIOHook
 	size_t gbuffersize;
 #endif
 
+	/** Address of the peer if this is an outgoing connection whose session has not been saved for resumption yet
+	 */
+	std::string resumepeer;
+
+	void SaveClientSession()
+	{
+		if (resumepeer.empty())
+			return;
+
+#ifdef INSPIRCD_GNUTLS_HAS_TLS13
+		// TLS 1.3 sessions can only be resumed once the server sent us a ticket after the handshake
+		if ((gnutls_protocol_get_version(sess) == GNUTLS_TLS1_3) && (!(gnutls_session_get_flags(sess) & GNUTLS_SFLAGS_SESSION_TICKET)))
+			return;
+#endif
+
+		gnutls_datum_t data;
+		if (gnutls_session_get_data2(sess, &data) >= 0)
+		{
+			GetProfile().SetClientSession(resumepeer, std::string(reinterpret_cast<const char*>(data.data), data.size));
+			gnutls_free(data.data);
+		}
+		resumepeer.clear();
+	}
+
 	void CloseSession()
 	{
 		if (this->sess)
@@ -769,6 +1026,8 @@ class GnuTLSIOHook : public SSLIOHook
 			// Change the seesion state
 			this->status = ISSL_HANDSHAKEN;
 
+			GetProfile().CountHandshake(gnutls_session_is_resumed(this->sess));
+			SaveClientSession();
 			VerifyCertificate();
 
 			// Finish writing, if any left
@@ -1067,6 +1326,15 @@ info_done_dealloc:
 #endif
 		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
 		GetProfile().SetupSession(sess);
+		if (flags == GNUTLS_SERVER)
+		{
+			GetProfile().SetupServerResumption(sess);
+		}
+		else
+		{
+			resumepeer = GetPeerAddress(sock);
+			GetProfile().SetupClientResumption(sess, resumepeer);
+		}
 
 		sock->AddIOHook(this);
 		Handshake(sock);
@@ -1094,6 +1362,8 @@ info_done_dealloc:
 				// Schedule a read if there is still data in the GnuTLS buffer
 				if (gnutls_record_check_pending(sess) > 0)
 					SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+				// A TLS 1.3 server may have sent us a session ticket
+				SaveClientSession();
 				return 1;
 			}
 			else if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED)
@@ -1156,21 +1426,23 @@ info_done_dealloc:
 
 		while (!sendq.empty())
 		{
-			FlattenSendQueue(sendq, GetProfile().GetOutgoingRecordSize());
-			const StreamSocket::SendQueue::Element& buffer = sendq.front();
-			ret = HandleWriteRet(user, gnutls_record_send(this->sess, buffer.data(), buffer.length()));
+			size_t len;
+			const char* buffer = GetSendQueueData(sendq, GetProfile().GetOutgoingRecordSize(), len);
+			ret = HandleWriteRet(user, gnutls_record_send(this->sess, buffer, len));
 
+			if (ret == 0)
+				KeepSendQueueData(sendq, buffer, len);
 			if (ret <= 0)
 				return ret;
-			else if (ret < (int)buffer.length())
+			else if (ret < (int)len)
 			{
-				sendq.erase_front(ret);
+				ConsumeSendQueue(sendq, ret);
 				SocketEngine::ChangeEventMask(user, FD_WANT_SINGLE_WRITE);
 				return 0;
 			}
 
 			// Wrote entire record, continue sending
-			sendq.pop_front();
+			ConsumeSendQueue(sendq, len);
 		}
 #endif
 
@@ -1395,6 +1667,22 @@ class ModuleSSLGnuTLS : public Module
 		return Version("Provides SSL support for clients", VF_VENDOR);
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 't')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			GnuTLS::Profile& profile = (*i)->GetProfile();
+			stats.AddRow(304, "TLSSTATS Profile \"" + profile.GetName() + "\" (gnutls) had " +
+				ConvToStr(profile.GetFullHandshakeCount()) + " full and " + ConvToStr(profile.GetResumedHandshakeCount()) +
+				" resumed handshakes, " + ConvToStr(profile.GetCachedSessionCount()) + " sessions cached");
+		}
+
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) CXX11_OVERRIDE
 	{
 		const GnuTLSIOHook* const iohook = static_cast<GnuTLSIOHook*>(user->eh.GetModHook(this));
@@ -736,17 +736,17 @@ class mbedTLSIOHook : public SSLIOHook
 		// Session is ready for transferring application data
 		while (!sendq.empty())
 		{
-			FlattenSendQueue(sendq, GetProfile().GetOutgoingRecordSize());
-			const StreamSocket::SendQueue::Element& buffer = sendq.front();
-			int ret = mbedtls_ssl_write(&sess, reinterpret_cast<const unsigned char*>(buffer.data()), buffer.length());
-			if (ret == (int)buffer.length())
+			size_t len;
+			const char* buffer = GetSendQueueData(sendq, GetProfile().GetOutgoingRecordSize(), len);
+			int ret = mbedtls_ssl_write(&sess, reinterpret_cast<const unsigned char*>(buffer), len);
+			if (ret == (int)len)
 			{
 				// Wrote entire record, continue sending
-				sendq.pop_front();
+				ConsumeSendQueue(sendq, len);
 			}
 			else if (ret > 0)
 			{
-				sendq.erase_front(ret);
+				ConsumeSendQueue(sendq, ret);
 				SocketEngine::ChangeEventMask(sock, FD_WANT_SINGLE_WRITE);
 				return 0;
 			}
@@ -758,11 +758,13 @@ class mbedTLSIOHook : public SSLIOHook
 			}
 			else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE)
 			{
+				KeepSendQueueData(sendq, buffer, len);
 				SocketEngine::ChangeEventMask(sock, FD_WANT_SINGLE_WRITE);
 				return 0;
 			}
 			else if (ret == MBEDTLS_ERR_SSL_WANT_READ)
 			{
+				KeepSendQueueData(sendq, buffer, len);
 				SocketEngine::ChangeEventMask(sock, FD_WANT_POLL_READ);
 				return 0;
 			}
@@ -48,6 +48,8 @@
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 
 #ifdef _WIN32
 # pragma comment(lib, "ssleay32.lib")
@@ -68,6 +70,24 @@
 # define INSPIRCD_OPENSSL_OPAQUE_BIO
 #endif
 
+#ifdef SSL_OP_NO_TICKET
+# define INSPIRCD_OPENSSL_ENABLE_TICKETS
+#endif
+
+// OpenSSL 3.0 deprecates the session ticket key callback taking a HMAC_CTX in favour of one taking an EVP_MAC_CTX.
+#if ((!defined LIBRESSL_VERSION_NUMBER) && (OPENSSL_VERSION_NUMBER >= 0x30000000L))
+# define INSPIRCD_OPENSSL_EVP_TICKET_CB
+# include <openssl/core_names.h>
+typedef EVP_MAC_CTX TicketMACContext;
+#else
+typedef HMAC_CTX TicketMACContext;
+#endif
+
+// Kernel TLS needs Linux and an OpenSSL 3.0 or later built with support for it.
+#if ((defined __linux__) && (defined SSL_OP_ENABLE_KTLS) && (!defined OPENSSL_NO_KTLS))
+# define INSPIRCD_OPENSSL_ENABLE_KTLS
+#endif
+
 enum issl_status { ISSL_NONE, ISSL_HANDSHAKING, ISSL_OPEN };
 
 static bool SelfSigned = false;
@@ -80,6 +100,10 @@ char* get_error()
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
+static int OnNewClientSession(SSL* ssl, SSL_SESSION* session);
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cctx, TicketMACContext* hctx, int enc);
+#endif
 
 namespace OpenSSL
 {
@@ -119,6 +143,104 @@ namespace OpenSSL
 		}
 	};
 
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+	/** Keys used to encrypt and authenticate session tickets, held in memory only.
+	 * A new key is generated every rotation interval, tickets encrypted with the
+	 * previous key are still accepted for one more interval and get replaced.
+	 */
+	class TicketKeys
+	{
+		struct Key
+		{
+			unsigned char name[16];
+			unsigned char aeskey[32];
+			unsigned char hmackey[32];
+			time_t created;
+			bool usable;
+		};
+
+		/** The key new tickets are encrypted with and the one it replaced
+		 */
+		Key current;
+		Key previous;
+
+		/** Number of seconds a key is used to encrypt new tickets for
+		 */
+		const time_t rotation;
+
+		static void Generate(Key& key)
+		{
+			if ((RAND_bytes(key.name, sizeof(key.name)) <= 0) || (RAND_bytes(key.aeskey, sizeof(key.aeskey)) <= 0) || (RAND_bytes(key.hmackey, sizeof(key.hmackey)) <= 0))
+				throw Exception("Unable to generate session ticket key");
+			key.created = ServerInstance->Time();
+			key.usable = true;
+		}
+
+		void Rotate()
+		{
+			const time_t age = ServerInstance->Time() - current.created;
+			if (age < rotation)
+				return;
+
+			previous = current;
+			previous.usable = (age < rotation * 2);
+			Generate(current);
+		}
+
+		static bool InitMAC(TicketMACContext* hctx, Key& key)
+		{
+#ifdef INSPIRCD_OPENSSL_EVP_TICKET_CB
+			char digest[] = "SHA256";
+			OSSL_PARAM params[3];
+			params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmackey, sizeof(key.hmackey));
+			params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0);
+			params[2] = OSSL_PARAM_construct_end();
+			return EVP_MAC_CTX_set_params(hctx, params);
+#else
+			return HMAC_Init_ex(hctx, key.hmackey, sizeof(key.hmackey), EVP_sha256(), NULL);
+#endif
+		}
+
+	 public:
+		TicketKeys(time_t interval)
+			: rotation(interval)
+		{
+			Generate(current);
+			previous.usable = false;
+		}
+
+		/** Set up the contexts for encrypting a new ticket or decrypting one sent by a client, called by OpenSSL
+		 * @return 1 if the ticket can be used, 2 if it can be used but should be replaced, 0 if it was
+		 * encrypted with an unknown key and -1 on error
+		 */
+		int Setup(unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cctx, TicketMACContext* hctx, int enc)
+		{
+			Rotate();
+			if (enc)
+			{
+				memcpy(keyname, current.name, sizeof(current.name));
+				if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+					return -1;
+				if ((!EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, current.aeskey, iv)) || (!InitMAC(hctx, current)))
+					return -1;
+				return 1;
+			}
+
+			Key* key;
+			if (!memcmp(keyname, current.name, sizeof(current.name)))
+				key = &current;
+			else if ((previous.usable) && (!memcmp(keyname, previous.name, sizeof(previous.name))))
+				key = &previous;
+			else
+				return 0;
+
+			if ((!InitMAC(hctx, *key)) || (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aeskey, iv)))
+				return -1;
+			return (key == &current ? 1 : 2);
+		}
+	};
+#endif
+
 	class Context
 	{
 		SSL_CTX* const ctx;
@@ -225,6 +347,45 @@ namespace OpenSSL
 			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, OnVerify);
 		}
 
+		void SetSessionIdContext(const std::string& sidctx)
+		{
+			// Sessions are only resumed on a context with the same id, this is required when verifying client certificates
+			SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(sidctx.data()), std::min<size_t>(sidctx.length(), SSL_MAX_SID_CTX_LENGTH));
+		}
+
+		void SetServerSessionCache(long size, long timeout)
+		{
+			SSL_CTX_set_timeout(ctx, timeout);
+			if (size <= 0)
+				return;
+
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(ctx, size);
+		}
+
+		void SetClientSessionCallback()
+		{
+			// We keep the sessions ourselves so they can be looked up by the address of the peer
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(ctx, OnNewClientSession);
+		}
+
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+		void SetTicketKeyCallback()
+		{
+#ifdef INSPIRCD_OPENSSL_EVP_TICKET_CB
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, OnTicketKey);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, OnTicketKey);
+#endif
+		}
+#endif
+
+		long GetCachedSessionCount() const
+		{
+			return SSL_CTX_sess_number(ctx);
+		}
+
 		SSL* CreateServerSession()
 		{
 			SSL* sess = SSL_new(ctx);
@@ -271,6 +432,34 @@ namespace OpenSSL
 		 */
 		const unsigned int outrecsize;
 
+		/** True if session tickets are issued and accepted, false if not
+		 */
+		const bool sessiontickets;
+
+		/** True if the encryption of application data is handed to the kernel when possible, false if not
+		 */
+		bool ktls;
+
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+		/** Keys session tickets are encrypted with
+		 */
+		TicketKeys ticketkeys;
+#endif
+
+		/** Sessions of outgoing connections which can be resumed, keyed by the address of the peer
+		 */
+		typedef std::map<std::string, SSL_SESSION*> ClientSessionMap;
+		ClientSessionMap clientsessions;
+
+		/** Number of handshakes completed with and without resuming a session
+		 */
+		unsigned long fullhandshakes;
+		unsigned long resumedhandshakes;
+
+		/** Number of connections whose writes were offloaded to kernel TLS
+		 */
+		unsigned long ktlsconns;
+
 		static int error_callback(const char* str, size_t len, void* u)
 		{
 			Profile* profile = reinterpret_cast<Profile*>(u);
@@ -295,6 +484,14 @@ namespace OpenSSL
 				setoptions |= SSL_OP_NO_SSLv3;
 			if (!tag->getBool("tlsv1", true))
 				setoptions |= SSL_OP_NO_TLSv1;
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+			if (sessiontickets)
+				clearoptions |= SSL_OP_NO_TICKET;
+#endif
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+			if (ktls)
+				setoptions |= SSL_OP_ENABLE_KTLS;
+#endif
 
 			if (!setoptions && !clearoptions)
 				return; // Nothing to do
@@ -312,7 +509,30 @@ namespace OpenSSL
 			, clictx(SSL_CTX_new(SSLv23_client_method()))
 			, allowrenego(tag->getBool("renegotiation")) // Disallow by default
 			, outrecsize(tag->getInt("outrecsize", 2048, 512, 16384))
+			, sessiontickets(tag->getBool("sessiontickets", true))
+			, ktls(tag->getBool("ktls"))
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+			, ticketkeys(tag->getDuration("ticketkeyrotation", 3600, 60))
+#endif
+			, fullhandshakes(0)
+			, resumedhandshakes(0)
+			, ktlsconns(0)
 		{
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+			// A renegotiation would have to rekey a connection the kernel already encrypts
+			if ((ktls) && (allowrenego))
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Kernel TLS can't be used together with renegotiation, disabling it for profile %s", name.c_str());
+				ktls = false;
+			}
+#else
+			if (ktls)
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Kernel TLS is not supported by this build, disabling it for profile %s", name.c_str());
+				ktls = false;
+			}
+#endif
+
 			if ((!ctx.SetDH(dh)) || (!clictx.SetDH(dh)))
 				throw Exception("Couldn't set DH parameters");
 
@@ -368,11 +588,68 @@ namespace OpenSSL
 			clictx.SetVerifyCert();
 			if (tag->getBool("requestclientcert", true))
 				ctx.SetVerifyCert();
+
+			// Let clients resume their sessions with an abbreviated handshake, from our cache or from a ticket
+			ctx.SetSessionIdContext(name);
+			ctx.SetServerSessionCache(tag->getInt("sessioncache", 20480, 0), tag->getDuration("sessiontimeout", 3600, 1));
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+			if (sessiontickets)
+				ctx.SetTicketKeyCallback();
+#endif
+			clictx.SetClientSessionCallback();
 		}
 
+		~Profile()
+		{
+			for (ClientSessionMap::iterator i = clientsessions.begin(); i != clientsessions.end(); ++i)
+				SSL_SESSION_free(i->second);
+		}
+
+		/** Remember the session of an outgoing connection to resume it when connecting to the same peer again
+		 * @param peer Address of the peer
+		 * @param session Session to remember, the profile takes ownership of it
+		 */
+		void SetClientSession(const std::string& peer, SSL_SESSION* session)
+		{
+			std::pair<ClientSessionMap::iterator, bool> ret = clientsessions.insert(std::make_pair(peer, session));
+			if (!ret.second)
+			{
+				SSL_SESSION_free(ret.first->second);
+				ret.first->second = session;
+			}
+		}
+
+		void CountHandshake(bool resumed)
+		{
+			if (resumed)
+				resumedhandshakes++;
+			else
+				fullhandshakes++;
+		}
+
+		void CountKTLSConnection() { ktlsconns++; }
+
 		const std::string& GetName() const { return name; }
 		SSL* CreateServerSession() { return ctx.CreateServerSession(); }
-		SSL* CreateClientSession() { return clictx.CreateClientSession(); }
+
+		SSL* CreateClientSession(StreamSocket* sock)
+		{
+			SSL* sess = clictx.CreateClientSession();
+			// Offer the session of the last connection to this peer for resumption
+			ClientSessionMap::const_iterator it = clientsessions.find(SSLIOHook::GetPeerAddress(sock));
+			if (it != clientsessions.end())
+				SSL_set_session(sess, it->second);
+			return sess;
+		}
+
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+		TicketKeys& GetTicketKeys() { return ticketkeys; }
+#endif
+		long GetCachedSessionCount() const { return ctx.GetCachedSessionCount(); }
+		unsigned long GetFullHandshakeCount() const { return fullhandshakes; }
+		unsigned long GetResumedHandshakeCount() const { return resumedhandshakes; }
+		unsigned long GetKTLSConnectionCount() const { return ktlsconns; }
+		bool UseKTLS() const { return ktls; }
 		const EVP_MD* GetDigest() { return digest; }
 		bool AllowRenegotiation() const { return allowrenego; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
@@ -457,14 +734,58 @@ class OpenSSLIOHook : public SSLIOHook
 {
  private:
 	SSL* sess;
+	StreamSocket* const streamsock;
 	issl_status status;
 	bool data_to_write;
 
+	/** True if the kernel encrypts what we write to the socket, false if OpenSSL does
+	 */
+	bool ktlssend;
+
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+	/** True if OpenSSL reads and writes the socket itself through a socket BIO, which is needed for kernel TLS
+	 */
+	bool socketbio;
+
+	/** Number of bytes the socket BIO had read and written when the statistics were last updated
+	 */
+	uint64_t bioread;
+	uint64_t biowritten;
+#endif
+
+	/** Do what our BIO does on every read and write if OpenSSL does the socket I/O itself:
+	 * count the transferred data in the socket engine statistics and tell the socket engine when
+	 * the socket would block
+	 * @param sock Socket of this hook
+	 * @param ret Return value of the SSL_* call which did I/O
+	 */
+	void UpdateSocketState(StreamSocket* sock, int ret)
+	{
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+		if (!socketbio)
+			return;
+
+		BIO* const bio = SSL_get_rbio(sess);
+		const uint64_t nowread = BIO_number_read(bio);
+		const uint64_t nowwritten = BIO_number_written(bio);
+		SocketEngine::UpdateStats(nowread - bioread, nowwritten - biowritten);
+		bioread = nowread;
+		biowritten = nowwritten;
+
+		const int err = (ret < 0 ? SSL_get_error(sess, ret) : SSL_ERROR_NONE);
+		if (err == SSL_ERROR_WANT_READ)
+			SocketEngine::ChangeEventMask(sock, FD_READ_WILL_BLOCK);
+		else if (err == SSL_ERROR_WANT_WRITE)
+			SocketEngine::ChangeEventMask(sock, FD_WRITE_WILL_BLOCK);
+#endif
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
 		ERR_clear_error();
 		int ret = SSL_do_handshake(sess);
+		UpdateSocketState(user, ret);
 		if (ret < 0)
 		{
 			int err = SSL_get_error(sess, ret);
@@ -490,8 +811,18 @@ class OpenSSLIOHook : public SSLIOHook
 		else if (ret > 0)
 		{
 			// Handshake complete.
+			GetProfile().CountHandshake(SSL_session_reused(sess));
 			VerifyCertificate();
 
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+			// OpenSSL falls back to encrypting in userspace if the kernel or the cipher can't do it
+			if ((GetProfile().UseKTLS()) && (BIO_get_ktls_send(SSL_get_wbio(sess))))
+			{
+				ktlssend = true;
+				GetProfile().CountKTLSConnection();
+			}
+#endif
+
 			status = ISSL_OPEN;
 
 			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
@@ -585,9 +916,7 @@ class OpenSSLIOHook : public SSLIOHook
 			// The other side is trying to renegotiate, kill the connection and change status
 			// to ISSL_NONE so CheckRenego() closes the session
 			status = ISSL_NONE;
-			BIO* bio = SSL_get_rbio(sess);
-			EventHandler* eh = static_cast<StreamSocket*>(BIO_get_data(bio));
-			SocketEngine::Shutdown(eh, 2);
+			SocketEngine::Shutdown(streamsock, 2);
 		}
 	}
 
@@ -624,17 +953,35 @@ class OpenSSLIOHook : public SSLIOHook
 	OpenSSLIOHook(IOHookProvider* hookprov, StreamSocket* sock, SSL* session)
 		: SSLIOHook(hookprov)
 		, sess(session)
+		, streamsock(sock)
 		, status(ISSL_NONE)
 		, data_to_write(false)
+		, ktlssend(false)
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+		, socketbio(GetProfile().UseKTLS())
+		, bioread(0)
+		, biowritten(0)
+#endif
 	{
-		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+		// OpenSSL can only hand the keys to the kernel when it does the socket I/O itself
+		if (socketbio)
+		{
+			BIO* bio = BIO_new_socket(sock->GetFd(), BIO_NOCLOSE);
+			SSL_set_bio(sess, bio, bio);
+		}
+		else
+#endif
+		{
+			// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
 #ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
-		BIO* bio = BIO_new(biomethods);
+			BIO* bio = BIO_new(biomethods);
 #else
-		BIO* bio = BIO_new(&biomethods);
+			BIO* bio = BIO_new(&biomethods);
 #endif
-		BIO_set_data(bio, sock);
-		SSL_set_bio(sess, bio, bio);
+			BIO_set_data(bio, sock);
+			SSL_set_bio(sess, bio, bio);
+		}
 
 		SSL_set_ex_data(sess, exdataindex, this);
 		sock->AddIOHook(this);
@@ -659,6 +1006,7 @@ class OpenSSLIOHook : public SSLIOHook
 			char* buffer = ServerInstance->GetReadBuffer();
 			size_t bufsiz = ServerInstance->Config->NetBufferSize;
 			int ret = SSL_read(sess, buffer, bufsiz);
+			UpdateSocketState(user, ret);
 
 			if (!CheckRenego(user))
 				return -1;
@@ -713,27 +1061,42 @@ class OpenSSLIOHook : public SSLIOHook
 		if (prepret <= 0)
 			return prepret;
 
+#ifdef INSPIRCD_OPENSSL_ENABLE_KTLS
+		if (ktlssend)
+		{
+			// The kernel encrypts the data, write the send queue as it is
+			user->FlushSendQ(sendq);
+			if (!user->getError().empty())
+			{
+				CloseSession();
+				return -1;
+			}
+			return (sendq.empty() ? 1 : 0);
+		}
+#endif
+
 		data_to_write = true;
 
 		// Session is ready for transferring application data
 		while (!sendq.empty())
 		{
 			ERR_clear_error();
-			FlattenSendQueue(sendq, GetProfile().GetOutgoingRecordSize());
-			const StreamSocket::SendQueue::Element& buffer = sendq.front();
-			int ret = SSL_write(sess, buffer.data(), buffer.size());
+			size_t len;
+			const char* buffer = GetSendQueueData(sendq, GetProfile().GetOutgoingRecordSize(), len);
+			int ret = SSL_write(sess, buffer, len);
+			UpdateSocketState(user, ret);
 
 			if (!CheckRenego(user))
 				return -1;
 
-			if (ret == (int)buffer.length())
+			if (ret == (int)len)
 			{
 				// Wrote entire record, continue sending
-				sendq.pop_front();
+				ConsumeSendQueue(sendq, len);
 			}
 			else if (ret > 0)
 			{
-				sendq.erase_front(ret);
+				ConsumeSendQueue(sendq, ret);
 				SocketEngine::ChangeEventMask(user, FD_WANT_SINGLE_WRITE);
 				return 0;
 			}
@@ -748,11 +1111,13 @@ class OpenSSLIOHook : public SSLIOHook
 
 				if (err == SSL_ERROR_WANT_WRITE)
 				{
+					KeepSendQueueData(sendq, buffer, len);
 					SocketEngine::ChangeEventMask(user, FD_WANT_SINGLE_WRITE);
 					return 0;
 				}
 				else if (err == SSL_ERROR_WANT_READ)
 				{
+					KeepSendQueueData(sendq, buffer, len);
 					SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ);
 					return 0;
 				}
@@ -788,6 +1153,7 @@ class OpenSSLIOHook : public SSLIOHook
 	}
 
 	bool IsHandshakeDone() const { return (status == ISSL_OPEN); }
+	StreamSocket* GetSocket() const { return streamsock; }
 	OpenSSL::Profile& GetProfile();
 };
 
@@ -797,6 +1163,22 @@ static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc)
 	hook->SSLInfoCallback(where, rc);
 }
 
+static int OnNewClientSession(SSL* ssl, SSL_SESSION* session)
+{
+	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
+	hook->GetProfile().SetClientSession(SSLIOHook::GetPeerAddress(hook->GetSocket()), session);
+	// We took ownership of the session
+	return 1;
+}
+
+#ifdef INSPIRCD_OPENSSL_ENABLE_TICKETS
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cctx, TicketMACContext* hctx, int enc)
+{
+	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
+	return hook->GetProfile().GetTicketKeys().Setup(keyname, iv, cctx, hctx, enc);
+}
+#endif
+
 static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
 {
 	BIO_clear_retry_flags(bio);
@@ -867,7 +1249,7 @@ class OpenSSLIOHookProvider : public IOHookProvider
 
 	void OnConnect(StreamSocket* sock) CXX11_OVERRIDE
 	{
-		new OpenSSLIOHook(this, sock, profile.CreateClientSession());
+		new OpenSSLIOHook(this, sock, profile.CreateClientSession(sock));
 	}
 
 	OpenSSL::Profile& GetProfile() { return profile; }
@@ -1000,6 +1382,25 @@ class ModuleSSLOpenSSL : public Module
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 't')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			OpenSSL::Profile& profile = (*i)->GetProfile();
+			stats.AddRow(304, "TLSSTATS Profile \"" + profile.GetName() + "\" (openssl) had " +
+				ConvToStr(profile.GetFullHandshakeCount()) + " full and " + ConvToStr(profile.GetResumedHandshakeCount()) +
+				" resumed handshakes, " + ConvToStr(profile.GetCachedSessionCount()) + " sessions cached");
+			if (profile.UseKTLS())
+				stats.AddRow(304, "TLSSTATS Profile \"" + profile.GetName() + "\" (openssl) offloaded " +
+					ConvToStr(profile.GetKTLSConnectionCount()) + " connections to kernel TLS");
+		}
+
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) CXX11_OVERRIDE
 	{
 		const OpenSSLIOHook* const iohook = static_cast<OpenSSLIOHook*>(user->eh.GetModHook(this));
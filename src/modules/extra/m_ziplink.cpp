@@ -0,0 +1,361 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// $CompilerFlags: find_compiler_flags("zlib" "")
+/// $LinkerFlags: find_linker_flags("zlib" "-lz")
+
+/// $PackageInfo: require_system("centos") zlib-devel pkgconfig
+/// $PackageInfo: require_system("darwin") pkg-config
+/// $PackageInfo: require_system("debian") zlib1g-dev pkg-config
+/// $PackageInfo: require_system("ubuntu") zlib1g-dev pkg-config
+
+#include "inspircd.h"
+#include "modules/ziplink.h"
+
+#include <zlib.h>
+
+/** Settings read from the <ziplink> tag
+ */
+struct ZipLinkConfig
+{
+	/** zlib compression level, 1-9
+	 */
+	int level;
+
+	/** zlib memory level, 1-9
+	 */
+	int memlevel;
+
+	/** Number of bytes compressed before the output is flushed at the next line boundary,
+	 * even if more data is waiting to be compressed
+	 */
+	size_t flushsize;
+
+	/** Maximum number of bytes the data received in a single read may decompress to,
+	 * the link is closed if it decompresses to more
+	 */
+	size_t maxinflate;
+
+	ZipLinkConfig()
+		: level(6)
+		, memlevel(8)
+		, flushsize(16384)
+		, maxinflate(4194304)
+	{
+	}
+};
+
+/** Returns a monotonic timestamp in microseconds, used to measure the time spent compressing
+ */
+static unsigned long long GetZipClock()
+{
+#ifdef _WIN32
+	return GetTickCount64() * 1000;
+#elif defined HAS_CLOCK_GETTIME
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000ULL) + tv.tv_usec;
+#endif
+}
+
+class ZlibLinkProvider : public ZipLinkProvider
+{
+ public:
+	ZipLinkConfig config;
+
+	ZlibLinkProvider(Module* mod)
+		: ZipLinkProvider(mod, "zlib")
+	{
+	}
+
+	ZipLinkIOHook* Hook(StreamSocket* sock) CXX11_OVERRIDE;
+
+	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE
+	{
+		Hook(sock);
+	}
+
+	void OnConnect(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		Hook(sock);
+	}
+};
+
+/** Compresses each direction of a connection as a single zlib stream.
+ * The compressor is flushed at the end of every write, which always ends with a complete line,
+ * so the peer never has to wait for more data to decompress a line it was sent.
+ */
+class ZlibLinkHook : public ZipLinkIOHook
+{
+	/** Settings of the provider, updated on rehash
+	 */
+	const ZipLinkConfig& config;
+
+	z_stream deflatestream;
+	z_stream inflatestream;
+
+	/** True if data written to the socket is compressed
+	 */
+	bool compressing;
+
+	/** True if data read from the socket is decompressed
+	 */
+	bool decompressing;
+
+	/** Compress data and append the output to a string
+	 * @param data Data to compress
+	 * @param len Length of the data
+	 * @param flush Z_NO_FLUSH to let zlib buffer the output, Z_SYNC_FLUSH to output everything
+	 * @param out String to append the compressed data to
+	 * @return True on success, false on error
+	 */
+	bool Deflate(const char* data, size_t len, int flush, std::string& out)
+	{
+		deflatestream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		deflatestream.avail_in = len;
+		const size_t chunksize = std::max<size_t>(len / 2, 1024);
+		do
+		{
+			const size_t oldlen = out.length();
+			out.resize(oldlen + chunksize);
+			deflatestream.next_out = reinterpret_cast<Bytef*>(&out[oldlen]);
+			deflatestream.avail_out = chunksize;
+			const int ret = deflate(&deflatestream, flush);
+			out.resize(oldlen + chunksize - deflatestream.avail_out);
+			if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+				return false;
+		}
+		while (deflatestream.avail_out == 0);
+		return true;
+	}
+
+	/** Compress everything in a send queue into the send queue of the hook
+	 * @param uppersendq Data to compress, emptied on success
+	 * @return True on success, false on error
+	 */
+	bool Compress(StreamSocket::SendQueue& uppersendq)
+	{
+		const unsigned long long started = GetZipClock();
+
+		std::string out;
+		size_t pending = 0;
+		for (StreamSocket::SendQueue::const_iterator i = uppersendq.begin(); i != uppersendq.end(); ++i)
+		{
+			const StreamSocket::SendQueue::Element& elem = *i;
+			pending += elem.length();
+
+			// Let the peer start on long writes, such as a netburst, before the whole write is compressed
+			const bool endofline = ((!elem.empty()) && (elem.data()[elem.length() - 1] == '\n'));
+			const int flush = ((pending >= config.flushsize) && (endofline) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+			if (!Deflate(elem.data(), elem.length(), flush, out))
+				return false;
+
+			if (flush == Z_SYNC_FLUSH)
+				pending = 0;
+		}
+
+		if ((pending) && (!Deflate(NULL, 0, Z_SYNC_FLUSH, out)))
+			return false;
+
+		stats.rawout += uppersendq.bytes();
+		stats.wireout += out.length();
+		stats.usecs += GetZipClock() - started;
+
+		uppersendq.clear();
+		GetSendQ().push_back(StreamSocket::SendQueue::Element(out));
+		return true;
+	}
+
+	/** Decompress data and append the output to a string
+	 * @param data Data to decompress
+	 * @param out String to append the decompressed data to
+	 * @param error Set to the reason on failure
+	 * @return True on success, false if the data is invalid or decompresses to more than maxinflate bytes
+	 */
+	bool Decompress(const std::string& data, std::string& out, std::string& error)
+	{
+		static const size_t chunksize = 16384;
+		const unsigned long long started = GetZipClock();
+		const size_t oldsize = out.length();
+
+		inflatestream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		inflatestream.avail_in = data.length();
+		while (true)
+		{
+			const size_t oldlen = out.length();
+			out.resize(oldlen + chunksize);
+			inflatestream.next_out = reinterpret_cast<Bytef*>(&out[oldlen]);
+			inflatestream.avail_out = chunksize;
+			const int ret = inflate(&inflatestream, Z_SYNC_FLUSH);
+			out.resize(oldlen + chunksize - inflatestream.avail_out);
+
+			// The stream is never ended by the peer, Z_STREAM_END is an error as well
+			if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+			{
+				error = "Received invalid compressed data";
+				return false;
+			}
+
+			if (out.length() - oldsize > config.maxinflate)
+			{
+				error = "Received compressed data decompressing to more than " + ConvToStr(config.maxinflate) + " bytes";
+				return false;
+			}
+
+			// Everything was decompressed if zlib did not fill the output buffer
+			if (inflatestream.avail_out != 0)
+				break;
+		}
+
+		stats.wirein += data.length();
+		stats.rawin += out.length() - oldsize;
+		stats.usecs += GetZipClock() - started;
+		return true;
+	}
+
+ public:
+	ZlibLinkHook(ZlibLinkProvider* provider)
+		: ZipLinkIOHook(provider)
+		, config(provider->config)
+		, compressing(false)
+		, decompressing(false)
+	{
+		memset(&deflatestream, 0, sizeof(deflatestream));
+		memset(&inflatestream, 0, sizeof(inflatestream));
+	}
+
+	~ZlibLinkHook()
+	{
+		if (compressing)
+			deflateEnd(&deflatestream);
+		if (decompressing)
+			inflateEnd(&inflatestream);
+	}
+
+	bool StartCompress(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		if (compressing)
+			return true;
+
+		if (deflateInit2(&deflatestream, config.level, Z_DEFLATED, MAX_WBITS, config.memlevel, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+
+		// What was written before compression was started goes out as it is
+		GetSendQ().moveall(sock->GetSendQ());
+		compressing = true;
+		return true;
+	}
+
+	bool StartDecompress(StreamSocket* sock, std::string& recvq) CXX11_OVERRIDE
+	{
+		if (decompressing)
+			return true;
+
+		if (inflateInit(&inflatestream) != Z_OK)
+			return false;
+		decompressing = true;
+
+		std::string compressed;
+		compressed.swap(recvq);
+		std::string error;
+		return Decompress(compressed, recvq, error);
+	}
+
+	int OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) CXX11_OVERRIDE
+	{
+		if (uppersendq.empty())
+			return 1;
+
+		if (!compressing)
+		{
+			GetSendQ().moveall(uppersendq);
+			return 1;
+		}
+
+		if (!Compress(uppersendq))
+		{
+			sock->SetError("Compression failed");
+			return -1;
+		}
+		return 1;
+	}
+
+	int OnStreamSocketRead(StreamSocket* sock, std::string& destrecvq) CXX11_OVERRIDE
+	{
+		std::string& myrecvq = GetRecvQ();
+		if (!decompressing)
+		{
+			destrecvq.append(myrecvq);
+			myrecvq.clear();
+			return 1;
+		}
+
+		std::string error;
+		const bool success = Decompress(myrecvq, destrecvq, error);
+		myrecvq.clear();
+		if (!success)
+		{
+			sock->SetError(error);
+			return -1;
+		}
+		return 1;
+	}
+
+	void OnStreamSocketClose(StreamSocket* sock) CXX11_OVERRIDE
+	{
+	}
+};
+
+ZipLinkIOHook* ZlibLinkProvider::Hook(StreamSocket* sock)
+{
+	ZlibLinkHook* const hook = new ZlibLinkHook(this);
+	sock->InsertIOHook(hook);
+	return hook;
+}
+
+class ModuleZipLink : public Module
+{
+	reference<ZlibLinkProvider> zlibprov;
+
+ public:
+	ModuleZipLink()
+		: zlibprov(new ZlibLinkProvider(this))
+	{
+	}
+
+	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
+	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("ziplink");
+
+		ZipLinkConfig config;
+		config.level = tag->getInt("level", 6, 1, 9);
+		config.memlevel = tag->getInt("memlevel", 8, 1, 9);
+		config.flushsize = tag->getInt("flushsize", 16384, 512);
+		config.maxinflate = tag->getInt("maxinflate", 4194304, 65536);
+		zlibprov->config = config;
+	}
+
+	Version GetVersion() CXX11_OVERRIDE
+	{
+		return Version("Provides compression of server links", VF_VENDOR);
+	}
+};
+
+MODULE_INIT(ModuleZipLink)
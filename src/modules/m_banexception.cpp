@@ -58,20 +58,15 @@ class ModuleBanException : public Module
 
 	ModResult OnExtBanCheck(User *user, Channel *chan, char type) CXX11_OVERRIDE
 	{
-		ListModeBase::ModeList* list = be.GetList(chan);
-		if (!list)
+		ListModeBase::MatchIndex* index = be.GetMatchIndex(chan);
+		if (!index)
 			return MOD_RES_PASSTHRU;
 
-		for (ListModeBase::ModeList::iterator it = list->begin(); it != list->end(); it++)
+		ListModeBase::MatchIndex::Group* list = index->GetExtBans(type);
+		if ((list) && (list->Matches(user, chan)))
 		{
-			if (it->mask[0] != type || it->mask[1] != ':')
-				continue;
-
-			if (chan->CheckBan(user, it->mask.substr(2)))
-			{
-				// They match an entry on the list, so let them pass this.
-				return MOD_RES_ALLOW;
-			}
+			// They match an entry on the list, so let them pass this.
+			return MOD_RES_ALLOW;
 		}
 
 		return MOD_RES_PASSTHRU;
@@ -79,20 +74,17 @@ class ModuleBanException : public Module
 
 	ModResult OnCheckChannelBan(User* user, Channel* chan) CXX11_OVERRIDE
 	{
-		ListModeBase::ModeList* list = be.GetList(chan);
-		if (!list)
+		ListModeBase::MatchIndex* index = be.GetMatchIndex(chan);
+		if (!index)
 		{
 			// No list, proceed normally
 			return MOD_RES_PASSTHRU;
 		}
 
-		for (ListModeBase::ModeList::iterator it = list->begin(); it != list->end(); it++)
+		if (index->GetAll().Matches(user, chan))
 		{
-			if (chan->CheckBan(user, it->mask))
-			{
-				// They match an entry on the list, so let them in.
-				return MOD_RES_ALLOW;
-			}
+			// They match an entry on the list, so let them in.
+			return MOD_RES_ALLOW;
 		}
 		return MOD_RES_PASSTHRU;
 	}
@@ -83,18 +83,10 @@ class ModuleChannelNames : public Module
 				ServerInstance->Modes->Process(ServerInstance->FakeClient, c, NULL, removepermchan);
 			}
 
-			Channel::MemberMap& users = c->userlist;
-			for (Channel::MemberMap::iterator j = users.begin(); j != users.end(); )
-			{
-				if (IS_LOCAL(j->first))
-				{
-					// KickUser invalidates the iterator
-					Channel::MemberMap::iterator it = j++;
-					c->KickUser(ServerInstance->FakeClient, it, "Channel name no longer valid");
-				}
-				else
-					++j;
-			}
+			// KickUser invalidates iterators, kick from a copy of the local member list
+			const Channel::MemberMap::LocalList locals = c->userlist.GetLocal();
+			for (Channel::MemberMap::LocalList::const_iterator j = locals.begin(); j != locals.end(); ++j)
+				c->KickUser(ServerInstance->FakeClient, j->first, "Channel name no longer valid");
 		}
 		badchan = false;
 	}
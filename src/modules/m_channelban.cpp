@@ -52,6 +52,39 @@ class ModuleBadChannelExtban : public Module
 		return MOD_RES_PASSTHRU;
 	}
 
+	/* Verdicts cached for a user depend on the channels they are in and their status there */
+	void OnPostJoin(Membership* memb) CXX11_OVERRIDE
+	{
+		memb->user->InvalidateCache();
+	}
+
+	void OnUserPart(Membership* memb, std::string& partmessage, CUList& except_list) CXX11_OVERRIDE
+	{
+		memb->user->InvalidateCache();
+	}
+
+	void OnUserKick(User* source, Membership* memb, const std::string& reason, CUList& except_list) CXX11_OVERRIDE
+	{
+		memb->user->InvalidateCache();
+	}
+
+	void OnMode(User* user, User* usertarget, Channel* chantarget, const Modes::ChangeList& changelist, ModeParser::ModeProcessFlag processflags, const std::string& output_mode) CXX11_OVERRIDE
+	{
+		if (!chantarget)
+			return;
+
+		const Modes::ChangeList::List& list = changelist.getlist();
+		for (Modes::ChangeList::List::const_iterator i = list.begin(); i != list.end(); ++i)
+		{
+			if (!i->mh->IsPrefixMode())
+				continue;
+
+			User* target = ServerInstance->FindNick(i->param);
+			if (target)
+				target->InvalidateCache();
+		}
+	}
+
 	void On005Numeric(std::map<std::string, std::string>& tokens) CXX11_OVERRIDE
 	{
 		tokens["EXTBAN"].push_back('j');
@@ -93,20 +93,18 @@ class CommandClearChan : public Command
 
 		std::string mask;
 		// Now remove all local non-opers from the channel
-		Channel::MemberMap& users = chan->userlist;
-		for (Channel::MemberMap::iterator i = users.begin(); i != users.end(); )
+		// Removing members invalidates iterators, work on a copy of the local member list
+		const Channel::MemberMap::LocalList locals = chan->userlist.GetLocal();
+		for (Channel::MemberMap::LocalList::const_iterator i = locals.begin(); i != locals.end(); ++i)
 		{
-			User* curr = i->first;
-			const Channel::MemberMap::iterator currit = i;
-			++i;
-
-			if (!IS_LOCAL(curr) || curr->IsOper())
+			LocalUser* curr = i->first;
+			if (curr->IsOper())
 				continue;
 
 			// If kicking users, remove them and skip the QuitUser()
 			if (kick)
 			{
-				chan->KickUser(ServerInstance->FakeClient, currit, reason);
+				chan->KickUser(ServerInstance->FakeClient, curr, reason);
 				continue;
 			}
 
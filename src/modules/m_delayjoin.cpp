@@ -96,10 +96,10 @@ ModResult ModuleDelayJoin::OnNamesListItem(User* issuer, Membership* memb, std::
 
 static void populate(CUList& except, Membership* memb)
 {
-	const Channel::MemberMap& users = memb->chan->GetUsers();
-	for (Channel::MemberMap::const_iterator i = users.begin(); i != users.end(); ++i)
+	const Channel::MemberMap::LocalList& locals = memb->chan->GetUsers().GetLocal();
+	for (Channel::MemberMap::LocalList::const_iterator i = locals.begin(); i != locals.end(); ++i)
 	{
-		if (i->first == memb->user || !IS_LOCAL(i->first))
+		if (i->first == memb->user)
 			continue;
 		except.insert(i->first);
 	}
@@ -77,11 +77,11 @@ class ModuleHostCycle : public Module
 					modeline.append(" ").append(user->nick);
 			}
 
-			const Channel::MemberMap& ulist = c->GetUsers();
-			for (Channel::MemberMap::const_iterator j = ulist.begin(); j != ulist.end(); ++j)
+			const Channel::MemberMap::LocalList& locals = c->GetUsers().GetLocal();
+			for (Channel::MemberMap::LocalList::const_iterator j = locals.begin(); j != locals.end(); ++j)
 			{
-				LocalUser* u = IS_LOCAL(j->first);
-				if (u == NULL || u == user)
+				LocalUser* u = j->first;
+				if (u == user)
 					continue;
 				if (u->already_sent == silent_id)
 					continue;
@@ -58,17 +58,9 @@ public:
 
 	ModResult OnCheckInvite(User* user, Channel* chan) CXX11_OVERRIDE
 	{
-		ListModeBase::ModeList* list = ie.GetList(chan);
-		if (list)
-		{
-			for (ListModeBase::ModeList::iterator it = list->begin(); it != list->end(); it++)
-			{
-				if (chan->CheckBan(user, it->mask))
-				{
-					return MOD_RES_ALLOW;
-				}
-			}
-		}
+		ListModeBase::MatchIndex* index = ie.GetMatchIndex(chan);
+		if ((index) && (index->GetAll().Matches(user, chan)))
+			return MOD_RES_ALLOW;
 
 		return MOD_RES_PASSTHRU;
 	}
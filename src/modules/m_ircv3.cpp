@@ -78,21 +78,22 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 		 * account is the joining user's account if he's logged in, otherwise it's an asterisk (*).
 		 */
 
-		std::string line;
-		std::string mode;
+		// The lines are built once and shared between the sendqs of all recipients
+		StreamSocket::SendQueue::Element line;
+		StreamSocket::SendQueue::Element mode;
 
-		const Channel::MemberMap& userlist = memb->chan->GetUsers();
-		for (Channel::MemberMap::const_iterator it = userlist.begin(); it != userlist.end(); ++it)
+		const Channel::MemberMap::LocalList& locals = memb->chan->GetUsers().GetLocal();
+		for (Channel::MemberMap::LocalList::const_iterator it = locals.begin(); it != locals.end(); ++it)
 		{
-			// Send the extended join line if the current member is local, has the extended-join cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_extendedjoin.get(member)) && (excepts.find(member) == excepts.end()))
+			// Send the extended join line if the current member has the extended-join cap and isn't excepted
+			LocalUser* member = it->first;
+			if ((cap_extendedjoin.get(member)) && (excepts.find(member) == excepts.end()))
 			{
 				// Construct the lines we're going to send if we haven't constructed them already
 				if (line.empty())
 				{
 					bool has_account = false;
-					line = ":" + memb->user->GetFullHost() + " JOIN " + memb->chan->name + " ";
+					std::string joinline = ":" + memb->user->GetFullHost() + " JOIN " + memb->chan->name + " ";
 					const AccountExtItem* accountext = GetAccountExtItem();
 					if (accountext)
 					{
@@ -100,25 +101,27 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 						accountname = accountext->get(memb->user);
 						if (accountname)
 						{
-							line += *accountname;
+							joinline += *accountname;
 							has_account = true;
 						}
 					}
 
 					if (!has_account)
-						line += "*";
+						joinline += "*";
 
-					line += " :" + memb->user->fullname;
+					joinline += " :" + memb->user->fullname;
+					line = LocalUser::PrepareLine(joinline);
 
 					// If the joining user received privileges from another module then we must send them as well,
 					// since silencing the normal join means the MODE will be silenced as well
 					if (!memb->modes.empty())
 					{
 						const std::string& modefrom = ServerInstance->Config->CycleHostsFromUser ? memb->user->GetFullHost() : ServerInstance->Config->ServerName;
-						mode = ":" + modefrom + " MODE " + memb->chan->name + " +" + memb->modes;
+						std::string modeline = ":" + modefrom + " MODE " + memb->chan->name + " +" + memb->modes;
 
 						for (unsigned int i = 0; i < memb->modes.length(); i++)
-							mode += " " + memb->user->nick;
+							modeline += " " + memb->user->nick;
+						mode = LocalUser::PrepareLine(modeline);
 					}
 				}
 
@@ -153,14 +156,14 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 		if ((!cap_awaynotify.IsActive()) || (!memb->user->IsAway()))
 			return;
 
-		std::string line = ":" + memb->user->GetFullHost() + " AWAY :" + memb->user->awaymsg;
+		const StreamSocket::SendQueue::Element line = LocalUser::PrepareLine(":" + memb->user->GetFullHost() + " AWAY :" + memb->user->awaymsg);
 
-		const Channel::MemberMap& userlist = memb->chan->GetUsers();
-		for (Channel::MemberMap::const_iterator it = userlist.begin(); it != userlist.end(); ++it)
+		const Channel::MemberMap::LocalList& locals = memb->chan->GetUsers().GetLocal();
+		for (Channel::MemberMap::LocalList::const_iterator it = locals.begin(); it != locals.end(); ++it)
 		{
-			// Send the away notify line if the current member is local, has the away-notify cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_awaynotify.get(member)) && (last_excepts.find(member) == last_excepts.end()) && (it->second != memb))
+			// Send the away notify line if the current member has the away-notify cap and isn't excepted
+			LocalUser* member = it->first;
+			if ((cap_awaynotify.get(member)) && (last_excepts.find(member) == last_excepts.end()) && (it->second != memb))
 			{
 				member->Write(line);
 			}
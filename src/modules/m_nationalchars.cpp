@@ -241,6 +241,7 @@ class ModuleNationalChars : public Module
 			return;
 
 		memcpy(prev_map, national_case_insensitive_map, sizeof(prev_map));
+		national_case_map_generation++;
 
 		RehashHashmap(ServerInstance->Users.clientlist);
 		RehashHashmap(ServerInstance->Users.uuidlist);
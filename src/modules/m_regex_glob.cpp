@@ -23,14 +23,16 @@
 
 class GlobRegex : public Regex
 {
+	WildcardMask mask;
+
 public:
-	GlobRegex(const std::string& rx) : Regex(rx)
+	GlobRegex(const std::string& rx) : Regex(rx), mask(rx)
 	{
 	}
 
 	bool Matches(const std::string& text) CXX11_OVERRIDE
 	{
-		return InspIRCd::Match(text, this->regex_string);
+		return mask.Match(text);
 	}
 };
 
@@ -105,6 +105,8 @@ class AccountExtItemImpl : public AccountExtItem
 		User* user = static_cast<User*>(container);
 
 		StringExtItem::unserialize(format, container, value);
+		// Account extbans match against this, so ban verdicts cached for the user are stale
+		user->InvalidateCache();
 
 		// If we are being reloaded then don't send the numeric or run the event
 		if (format == FORMAT_INTERNAL)
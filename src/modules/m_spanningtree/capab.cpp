@@ -20,6 +20,7 @@
 
 
 #include "inspircd.h"
+#include "modules/ziplink.h"
 
 #include "treeserver.h"
 #include "utils.h"
@@ -37,6 +38,17 @@ static CompatMod compatmods[] =
 	{ "m_watch.so", VF_OPTCOMMON }
 };
 
+/** Compression methods for server links, most preferred first */
+static const char* const compressmethods[] = { "zstd", "zlib" };
+
+static ZipLinkProvider* FindZipLinkProvider(const std::string& method)
+{
+	ServiceProvider* prov = ServerInstance->Modules->FindService(SERVICE_IOHOOK, "ziplink/" + method);
+	if ((!prov) || (static_cast<IOHookProvider*>(prov)->type != IOHookProvider::IOH_COMPRESS))
+		return NULL;
+	return static_cast<ZipLinkProvider*>(prov);
+}
+
 std::string TreeSocket::MyModules(int filter)
 {
 	const ModuleManager::ModuleMap& modlist = ServerInstance->Modules->GetModules();
@@ -167,6 +179,14 @@ void TreeSocket::SendCapabilities(int phase)
 	if (proto_version == 1202)
 		extra.append(" PROTOCOL="+ConvToStr(ProtocolVersion));
 
+	const std::string resync = Utils->Journal.GetID();
+	if (!resync.empty())
+		extra.append(" RESYNC="+resync);
+
+	offeredcompress = GetCompressMethods();
+	if (!offeredcompress.empty())
+		extra.append(" COMPRESS="+offeredcompress);
+
 	this->WriteLine("CAPAB CAPABILITIES " /* Preprocessor does this one. */
 			":NICKMAX="+ConvToStr(ServerInstance->Config->Limits.NickMax)+
 			" CHANMAX="+ConvToStr(ServerInstance->Config->Limits.ChanMax)+
@@ -251,6 +271,8 @@ bool TreeSocket::Capab(const parameterlist &params)
 			return false;
 		}
 
+		compat = CompatTable::Get(proto_version);
+
 		SendCapabilities(2);
 	}
 	else if (params[0] == "END")
@@ -390,6 +412,15 @@ bool TreeSocket::Capab(const parameterlist &params)
 			this->SendError("CAPAB negotiation failed: "+reason);
 			return false;
 		}
+
+		std::map<std::string, std::string>::const_iterator resync = capab->CapKeys.find("RESYNC");
+		if (resync != capab->CapKeys.end())
+			resyncid = resync->second;
+	}
+	else if ((params[0] == "COMPRESS") && (params.size() == 2))
+	{
+		if (!StartDecompression(params[1]))
+			return false;
 	}
 	else if ((params[0] == "MODULES") && (params.size() == 2))
 	{
@@ -441,3 +472,98 @@ bool TreeSocket::Capab(const parameterlist &params)
 	}
 	return true;
 }
+
+std::string TreeSocket::GetCompressMethods()
+{
+	// Outgoing connections are only compressed if the link block allows it, the
+	// remote server won't compress if we don't advertise any methods
+	if ((LinkState == CONNECTING) && (!capab->link->Compress))
+		return std::string();
+
+	std::string methods;
+	for (size_t i = 0; i < sizeof(compressmethods)/sizeof(compressmethods[0]); i++)
+	{
+		if (!FindZipLinkProvider(compressmethods[i]))
+			continue;
+
+		if (!methods.empty())
+			methods.push_back(',');
+		methods.append(compressmethods[i]);
+	}
+	return methods;
+}
+
+ZipLinkIOHook* TreeSocket::GetZipLinkHook(const std::string& method)
+{
+	ZipLinkProvider* prov = FindZipLinkProvider(method);
+	if (!prov)
+		return NULL;
+
+	// Both directions share one hook, it may have been created by the other direction already
+	ZipLinkIOHook* hook = ZipLinkIOHook::Find(this);
+	if (!hook)
+		return prov->Hook(this);
+
+	if (hook->prov != prov)
+		return NULL;
+	return hook;
+}
+
+bool TreeSocket::StartCompression()
+{
+	std::map<std::string, std::string>::const_iterator it = capab->CapKeys.find("COMPRESS");
+	if (it == capab->CapKeys.end())
+		return true;
+
+	// Use the method we prefer most out of the ones both servers support
+	irc::commasepstream ourmethods(offeredcompress);
+	for (std::string method; ourmethods.GetToken(method); )
+	{
+		irc::commasepstream theirmethods(it->second);
+		for (std::string theirmethod; theirmethods.GetToken(theirmethod); )
+		{
+			if (theirmethod != method)
+				continue;
+
+			ZipLinkIOHook* hook = GetZipLinkHook(method);
+			if (!hook)
+				return false;
+
+			// Everything after this line is compressed
+			this->WriteLine("CAPAB COMPRESS " + method);
+			return hook->StartCompress(this);
+		}
+	}
+	return true;
+}
+
+bool TreeSocket::StartDecompression(const std::string& method)
+{
+	// Decompressing costs memory and CPU time, never do it for a server that may not be
+	// the one it claims to be or with a method we have not offered
+	bool offered = false;
+	irc::commasepstream ourmethods(offeredcompress);
+	for (std::string ourmethod; ourmethods.GetToken(ourmethod); )
+	{
+		if (ourmethod == method)
+		{
+			offered = true;
+			break;
+		}
+	}
+
+	if ((!offered) || (LinkState == CONNECTING) || (LinkState == WAIT_AUTH_1))
+	{
+		this->SendError("CAPAB negotiation failed: Unexpected compression with " + method);
+		return false;
+	}
+
+	// Everything after this line is compressed
+	ZipLinkIOHook* hook = GetZipLinkHook(method);
+	if ((!hook) || (!hook->StartDecompress(this, recvq)))
+	{
+		this->SendError("CAPAB negotiation failed: Unable to decompress data compressed with " + method);
+		return false;
+	}
+	return true;
+}
@@ -24,298 +24,444 @@
 
 static std::string newline("\n");
 
-void TreeSocket::WriteLineNoCompat(const std::string& line)
+namespace
+{
+	// Translators for servers using the 1202 protocol
+
+	bool TranslateIJOIN(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// Convert
+		// :<uid> IJOIN <chan> <membid> [<ts> [<flags>]]
+		// to
+		// :<sid> FJOIN <chan> <ts> + [<flags>],<uuid>
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = line.find(' ', c + 1);
+		// Erase membership id first
+		line.erase(c, d-c);
+		if (d == std::string::npos)
+		{
+			// No TS or modes in the command
+			// :22DAAAAAB IJOIN #chan
+			const std::string channame(line, b+1, c-b-1);
+			Channel* chan = ServerInstance->FindChan(channame);
+			if (!chan)
+				return false;
+
+			line.push_back(' ');
+			line.append(ConvToStr(chan->age));
+			line.append(" + ,");
+		}
+		else
+		{
+			d = line.find(' ', c + 1);
+			if (d == std::string::npos)
+			{
+				// TS present, no modes
+				// :22DAAAAAC IJOIN #chan 12345
+				line.append(" + ,");
+			}
+			else
+			{
+				// Both TS and modes are present
+				// :22DAAAAAC IJOIN #chan 12345 ov
+				std::string::size_type e = line.find(' ', d + 1);
+				if (e != std::string::npos)
+					line.erase(e);
+
+				line.insert(d, " +");
+				line.push_back(',');
+			}
+		}
+
+		// Move the uuid to the end and replace the I with an F
+		line.append(line.substr(1, 9));
+		line.erase(4, 6);
+		line[5] = 'F';
+		return true;
+	}
+
+	bool TranslateDrop(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		return false;
+	}
+
+	bool TranslateMETADATA(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// Drop TS for channel METADATA, translate METADATA operquit into an OPERQUIT command
+		// :sid METADATA #target TS extname ...
+		//     A        B       C  D
+		if (b == std::string::npos)
+			return false;
+
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = line.find(' ', c + 1);
+		if (d == std::string::npos)
+			return false;
+
+		if (line[b + 1] == '#')
+		{
+			// We're sending channel metadata
+			line.erase(c, d-c);
+		}
+		else if (!line.compare(c, d-c, " operquit", 9))
+		{
+			// ":22D METADATA 22DAAAAAX operquit :message" -> ":22DAAAAAX OPERQUIT :message"
+			line = ":" + line.substr(b+1, c-b) + "OPERQUIT" + line.substr(d);
+		}
+		return true;
+	}
+
+	bool TranslateFTOPIC(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// Drop channel TS for FTOPIC
+		// :sid FTOPIC #target TS TopicTS setter :newtopic
+		//     A      B       C  D       E      F
+		// :uid FTOPIC #target TS TopicTS :newtopic
+		//     A      B       C  D       E
+		if (b == std::string::npos)
+			return false;
+
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = line.find(' ', c + 1);
+		if (d == std::string::npos)
+			return false;
+
+		std::string::size_type e = line.find(' ', d + 1);
+		if (line[e+1] == ':')
+		{
+			line.erase(c, e-c);
+			line.erase(a+1, 1);
+		}
+		else
+			line.erase(c, d-c);
+		return true;
+	}
+
+	bool TranslatePING(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// :22D PING 20D
+		if (line.length() < 13)
+			return false;
+
+		// Insert the source SID (and a space) between the command and the first parameter
+		line.insert(10, line.substr(1, 4));
+		return true;
+	}
+
+	bool TranslateOPERTYPE(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		std::string::size_type colon = line.find(':', b);
+		if (colon != std::string::npos)
+		{
+			for (std::string::iterator i = line.begin()+colon; i != line.end(); ++i)
+			{
+				if (*i == ' ')
+					*i = '_';
+			}
+			line.erase(colon, 1);
+		}
+		return true;
+	}
+
+	bool TranslateINVITE(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// :22D INVITE 22DAAAAAN #chan TS ExpirationTime
+		//     A      B         C     D  E
+		if (b == std::string::npos)
+			return false;
+
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = line.find(' ', c + 1);
+		if (d == std::string::npos)
+			return false;
+
+		std::string::size_type e = line.find(' ', d + 1);
+		// If there is no expiration time then everything will be erased from 'd'
+		line.erase(d, e-d);
+		return true;
+	}
+
+	bool TranslateFJOIN(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// Strip membership ids
+		// :22D FJOIN #chan 1234 +f 4:3 :o,22DAAAAAB:15 o,22DAAAAAA:15
+		// :22D FJOIN #chan 1234 +f 4:3 o,22DAAAAAB:15
+		// :22D FJOIN #chan 1234 +Pf 4:3 :
+
+		// If the last parameter is prefixed by a colon then it's a userlist which may have 0 or more users;
+		// if it isn't, then it is a single member
+		std::string::size_type spcolon = line.find(" :");
+		if (spcolon != std::string::npos)
+		{
+			spcolon++;
+			// Loop while there is a ':' in the userlist, this is never true if the channel is empty
+			std::string::size_type pos = std::string::npos;
+			while ((pos = line.rfind(':', pos-1)) > spcolon)
+			{
+				// Find the next space after the ':'
+				std::string::size_type sp = line.find(' ', pos);
+				// Erase characters between the ':' and the next space after it, including the ':' but not the space;
+				// if there is no next space, everything will be erased between pos and the end of the line
+				line.erase(pos, sp-pos);
+			}
+		}
+		else
+		{
+			// Last parameter is a single member
+			std::string::size_type sp = line.rfind(' ');
+			std::string::size_type colon = line.find(':', sp);
+			line.erase(colon);
+		}
+		return true;
+	}
+
+	bool TranslateKICK(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// Strip membership id if the KICK has one
+		if (b == std::string::npos)
+			return false;
+
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = line.find(' ', c + 1);
+		if ((d < line.size()-1) && (line[d+1] != ':'))
+		{
+			// There is a third parameter which doesn't begin with a colon, erase it
+			std::string::size_type e = line.find(' ', d + 1);
+			line.erase(d, e-d);
+		}
+		return true;
+	}
+
+	bool TranslateSINFO(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// :22D SINFO version :InspIRCd-3.0
+		//     A     B       C
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		// Only translating SINFO version, discard everything else
+		if (line.compare(b, 9, " version ", 9))
+			return false;
+
+		line = line.substr(0, 5) + "VERSION" + line.substr(c);
+		return true;
+	}
+
+	bool TranslateSERVER(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// :001 SERVER inspircd.test 002 [<anything> ...] :gecos
+		//     A      B             C
+		std::string::size_type c = line.find(' ', b + 1);
+		if (c == std::string::npos)
+			return false;
+
+		std::string::size_type d = c + 4;
+		std::string::size_type spcolon = line.find(" :", d);
+		if (spcolon == std::string::npos)
+			return false;
+
+		line.erase(d, spcolon-d);
+		line.insert(c, " * 0");
+
+		if (sock->IsBurstSent())
+		{
+			// Synthesize a :<newserver> BURST <time> message and send it right after the SERVER
+			spcolon = line.find(" :");
+			const std::string burst = CmdBuilder(line.substr(spcolon-3, 3), "BURST").push_int(ServerInstance->Time()).str();
+			line.append(newline).append(burst);
+		}
+		return true;
+	}
+
+	bool TranslateNUM(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b)
+	{
+		// :<sid> NUM <numeric source sid> <target uuid> <3 digit number> <params>
+		// Translate to
+		// :<sid> PUSH <target uuid> :<numeric source name> <3 digit number> <target nick> <params>
+
+		TreeServer* const numericsource = Utils->FindServerID(line.substr(9, 3));
+		if (!numericsource)
+			return false;
+
+		// The nick of the target is necessary for building the PUSH message
+		User* const target = ServerInstance->FindUUID(line.substr(13, UIDGenerator::UUID_LENGTH));
+		if (!target)
+			return false;
+
+		std::string push = InspIRCd::Format(":%.*s PUSH %s ::%s %.*s %s", 3, line.c_str()+1, target->uuid.c_str(), numericsource->GetName().c_str(), 3, line.c_str()+23, target->nick.c_str());
+		push.append(line, 26, std::string::npos);
+		push.swap(line);
+		return true;
+	}
+}
+
+CompatTable::CompatTable(long version)
+{
+	if (version < 1205)
+	{
+		Add("IJOIN", TranslateIJOIN);
+		Add("RESYNC", TranslateDrop);
+		Add("METADATA", TranslateMETADATA);
+		Add("FTOPIC", TranslateFTOPIC);
+		Add("PING", TranslatePING);
+		Add("PONG", TranslatePING);
+		Add("OPERTYPE", TranslateOPERTYPE);
+		Add("INVITE", TranslateINVITE);
+		Add("FJOIN", TranslateFJOIN);
+		Add("KICK", TranslateKICK);
+		Add("SINFO", TranslateSINFO);
+		// Whether a BURST has to be synthesized depends on the state of the link
+		Add("SERVER", TranslateSERVER, true);
+		Add("NUM", TranslateNUM);
+	}
+}
+
+void CompatTable::Add(const std::string& cmd, Translator translator, bool perlink)
+{
+	Entry& entry = entries[cmd];
+	entry.translator = translator;
+	entry.perlink = perlink;
+}
+
+const CompatTable::Entry* CompatTable::Find(const std::string& line, std::string::size_type a, std::string::size_type b) const
 {
-	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %s", this->GetFd(), line.c_str());
-	this->WriteData(line);
-	this->WriteData(newline);
+	const std::string command(line, a + 1, b-a-1);
+	EntryMap::const_iterator it = entries.find(command);
+	if (it == entries.end())
+		return NULL;
+	return &it->second;
 }
 
-void TreeSocket::WriteLine(const std::string& original_line)
+const CompatTable* CompatTable::Get(long version)
+{
+	if (version >= ProtocolVersion)
+		return NULL;
+
+	// 1202 is the only older protocol we can link with
+	static const CompatTable table1202(1202);
+	return &table1202;
+}
+
+const StreamSocket::SendQueue::Element& TreeLine::GetElement()
+{
+	if (elem.empty())
+	{
+		std::string buf;
+		buf.reserve(line.length() + 1);
+		buf.append(line).push_back('\n');
+		elem = Element::Take(buf);
+	}
+	return elem;
+}
+
+bool TreeLine::Translate(TreeSocket* sock, const CompatTable* table, Element& out)
+{
+	if (translatedfor == table)
+	{
+		out = translated;
+		return !dropped;
+	}
+
+	const std::string::size_type a = line.find(' ');
+	const std::string::size_type b = line.find(' ', a + 1);
+	const CompatTable::Entry* entry = table->Find(line, a, b);
+	if (!entry)
+	{
+		// Not translated, share the buffer with servers using the current protocol
+		out = GetElement();
+	}
+	else
+	{
+		std::string buf(line);
+		if (!entry->translator(sock, buf, a, b))
+		{
+			if (entry->perlink)
+				return false;
+
+			translatedfor = table;
+			dropped = true;
+			return false;
+		}
+
+		buf.push_back('\n');
+		out = Element::Take(buf);
+		if (entry->perlink)
+			return true;
+	}
+
+	translatedfor = table;
+	translated = out;
+	return true;
+}
+
+void TreeSocket::WriteLineNoCompat(const SendQueue::Element& line)
+{
+	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %.*s", this->GetFd(), (int)line.length() - 1, line.data());
+	if ((burst) && (DeferBurstLine(line)))
+		return;
+
+	// Lines of a burst go to the send queue right away, its size limits how much of the burst is generated
+	if ((burst) || (LinkState != CONNECTED))
+	{
+		FlushLines();
+		this->WriteData(line);
+		return;
+	}
+
+	if (pendinglines.empty())
+		SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
+	pendinglines.append(line.data(), line.length());
+}
+
+void TreeSocket::FlushLines()
+{
+	if (!pendinglines.empty())
+		this->WriteData(SendQueue::Element::Take(pendinglines));
+}
+
+void TreeSocket::WriteLine(const std::string& line)
+{
+	TreeLine treeline(line);
+	WriteLine(treeline);
+}
+
+void TreeSocket::WriteLine(TreeLine& line)
 {
 	if (LinkState == CONNECTED)
 	{
-		if (original_line.c_str()[0] != ':')
+		if (line.str().c_str()[0] != ':')
 		{
 			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Sending line without server prefix!");
-			WriteLine(":" + ServerInstance->Config->GetSID() + " " + original_line);
+			WriteLine(":" + ServerInstance->Config->GetSID() + " " + line.str());
 			return;
 		}
-		if (proto_version != ProtocolVersion)
+
+		if (compat)
 		{
-			std::string line = original_line;
-			std::string::size_type a = line.find(' ');
-			std::string::size_type b = line.find(' ', a + 1);
-			std::string command(line, a + 1, b-a-1);
-			// now try to find a translation entry
-			// TODO a more efficient lookup method will be needed later
-			if (proto_version < 1205)
-			{
-				if (command == "IJOIN")
-				{
-					// Convert
-					// :<uid> IJOIN <chan> <membid> [<ts> [<flags>]]
-					// to
-					// :<sid> FJOIN <chan> <ts> + [<flags>],<uuid>
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					// Erase membership id first
-					line.erase(c, d-c);
-					if (d == std::string::npos)
-					{
-						// No TS or modes in the command
-						// :22DAAAAAB IJOIN #chan
-						const std::string channame(line, b+1, c-b-1);
-						Channel* chan = ServerInstance->FindChan(channame);
-						if (!chan)
-							return;
-
-						line.push_back(' ');
-						line.append(ConvToStr(chan->age));
-						line.append(" + ,");
-					}
-					else
-					{
-						d = line.find(' ', c + 1);
-						if (d == std::string::npos)
-						{
-							// TS present, no modes
-							// :22DAAAAAC IJOIN #chan 12345
-							line.append(" + ,");
-						}
-						else
-						{
-							// Both TS and modes are present
-							// :22DAAAAAC IJOIN #chan 12345 ov
-							std::string::size_type e = line.find(' ', d + 1);
-							if (e != std::string::npos)
-								line.erase(e);
-
-							line.insert(d, " +");
-							line.push_back(',');
-						}
-					}
-
-					// Move the uuid to the end and replace the I with an F
-					line.append(line.substr(1, 9));
-					line.erase(4, 6);
-					line[5] = 'F';
-				}
-				else if (command == "RESYNC")
-					return;
-				else if (command == "METADATA")
-				{
-					// Drop TS for channel METADATA, translate METADATA operquit into an OPERQUIT command
-					// :sid METADATA #target TS extname ...
-					//     A        B       C  D
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
-
-					if (line[b + 1] == '#')
-					{
-						// We're sending channel metadata
-						line.erase(c, d-c);
-					}
-					else if (!line.compare(c, d-c, " operquit", 9))
-					{
-						// ":22D METADATA 22DAAAAAX operquit :message" -> ":22DAAAAAX OPERQUIT :message"
-						line = ":" + line.substr(b+1, c-b) + "OPERQUIT" + line.substr(d);
-					}
-				}
-				else if (command == "FTOPIC")
-				{
-					// Drop channel TS for FTOPIC
-					// :sid FTOPIC #target TS TopicTS setter :newtopic
-					//     A      B       C  D       E      F
-					// :uid FTOPIC #target TS TopicTS :newtopic
-					//     A      B       C  D       E
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
-
-					std::string::size_type e = line.find(' ', d + 1);
-					if (line[e+1] == ':')
-					{
-						line.erase(c, e-c);
-						line.erase(a+1, 1);
-					}
-					else
-						line.erase(c, d-c);
-				}
-				else if ((command == "PING") || (command == "PONG"))
-				{
-					// :22D PING 20D
-					if (line.length() < 13)
-						return;
-
-					// Insert the source SID (and a space) between the command and the first parameter
-					line.insert(10, line.substr(1, 4));
-				}
-				else if (command == "OPERTYPE")
-				{
-					std::string::size_type colon = line.find(':', b);
-					if (colon != std::string::npos)
-					{
-						for (std::string::iterator i = line.begin()+colon; i != line.end(); ++i)
-						{
-							if (*i == ' ')
-								*i = '_';
-						}
-						line.erase(colon, 1);
-					}
-				}
-				else if (command == "INVITE")
-				{
-					// :22D INVITE 22DAAAAAN #chan TS ExpirationTime
-					//     A      B         C     D  E
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
-
-					std::string::size_type e = line.find(' ', d + 1);
-					// If there is no expiration time then everything will be erased from 'd'
-					line.erase(d, e-d);
-				}
-				else if (command == "FJOIN")
-				{
-					// Strip membership ids
-					// :22D FJOIN #chan 1234 +f 4:3 :o,22DAAAAAB:15 o,22DAAAAAA:15
-					// :22D FJOIN #chan 1234 +f 4:3 o,22DAAAAAB:15
-					// :22D FJOIN #chan 1234 +Pf 4:3 :
-
-					// If the last parameter is prefixed by a colon then it's a userlist which may have 0 or more users;
-					// if it isn't, then it is a single member
-					std::string::size_type spcolon = line.find(" :");
-					if (spcolon != std::string::npos)
-					{
-						spcolon++;
-						// Loop while there is a ':' in the userlist, this is never true if the channel is empty
-						std::string::size_type pos = std::string::npos;
-						while ((pos = line.rfind(':', pos-1)) > spcolon)
-						{
-							// Find the next space after the ':'
-							std::string::size_type sp = line.find(' ', pos);
-							// Erase characters between the ':' and the next space after it, including the ':' but not the space;
-							// if there is no next space, everything will be erased between pos and the end of the line
-							line.erase(pos, sp-pos);
-						}
-					}
-					else
-					{
-						// Last parameter is a single member
-						std::string::size_type sp = line.rfind(' ');
-						std::string::size_type colon = line.find(':', sp);
-						line.erase(colon);
-					}
-				}
-				else if (command == "KICK")
-				{
-					// Strip membership id if the KICK has one
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if ((d < line.size()-1) && (original_line[d+1] != ':'))
-					{
-						// There is a third parameter which doesn't begin with a colon, erase it
-						std::string::size_type e = line.find(' ', d + 1);
-						line.erase(d, e-d);
-					}
-				}
-				else if (command == "SINFO")
-				{
-					// :22D SINFO version :InspIRCd-3.0
-					//     A     B       C
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					// Only translating SINFO version, discard everything else
-					if (line.compare(b, 9, " version ", 9))
-						return;
-
-					line = line.substr(0, 5) + "VERSION" + line.substr(c);
-				}
-				else if (command == "SERVER")
-				{
-					// :001 SERVER inspircd.test 002 [<anything> ...] :gecos
-					//     A      B             C
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = c + 4;
-					std::string::size_type spcolon = line.find(" :", d);
-					if (spcolon == std::string::npos)
-						return;
-
-					line.erase(d, spcolon-d);
-					line.insert(c, " * 0");
-
-					if (burstsent)
-					{
-						WriteLineNoCompat(line);
-
-						// Synthesize a :<newserver> BURST <time> message
-						spcolon = line.find(" :");
-						line = CmdBuilder(line.substr(spcolon-3, 3), "BURST").push_int(ServerInstance->Time()).str();
-					}
-				}
-				else if (command == "NUM")
-				{
-					// :<sid> NUM <numeric source sid> <target uuid> <3 digit number> <params>
-					// Translate to
-					// :<sid> PUSH <target uuid> :<numeric source name> <3 digit number> <target nick> <params>
-
-					TreeServer* const numericsource = Utils->FindServerID(line.substr(9, 3));
-					if (!numericsource)
-						return;
-
-					// The nick of the target is necessary for building the PUSH message
-					User* const target = ServerInstance->FindUUID(line.substr(13, UIDGenerator::UUID_LENGTH));
-					if (!target)
-						return;
-
-					std::string push = InspIRCd::Format(":%.*s PUSH %s ::%s %.*s %s", 3, line.c_str()+1, target->uuid.c_str(), numericsource->GetName().c_str(), 3, line.c_str()+23, target->nick.c_str());
-					push.append(line, 26, std::string::npos);
-					push.swap(line);
-				}
-			}
-			WriteLineNoCompat(line);
+			SendQueue::Element translated;
+			if (line.Translate(this, compat, translated))
+				WriteLineNoCompat(translated);
 			return;
 		}
 	}
 
-	WriteLineNoCompat(original_line);
+	WriteLineNoCompat(line.GetElement());
 }
 
 namespace
@@ -350,7 +496,10 @@ bool TreeSocket::PreProcessOldProtocolMessage(User*& who, std::string& cmd, std:
 		{
 			// If it's a PING with 1 parameter, reply with a PONG now, if it's a PONG with 1 parameter (weird), do nothing
 			if (cmd[1] == 'I')
+			{
+				FlushLines();
 				this->WriteData(":" + ServerInstance->Config->GetSID() + " PONG " + params[0] + newline);
+			}
 
 			// Don't process this message further
 			return false;
@@ -0,0 +1,135 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+class TreeSocket;
+
+/** Translations of outgoing lines for servers using an older protocol, keyed by command.
+ * There is one table for every older protocol we can link with, a socket looks up the
+ * table of its protocol once after CAPAB START and uses it for every line it sends.
+ */
+class CompatTable
+{
+ public:
+	/** Translate a line in place
+	 * @param sock Socket the line is sent on
+	 * @param line Line to translate, beginning with the source prefix
+	 * @param a Position of the space before the command
+	 * @param b Position of the space after the command, npos if the line has no parameters
+	 * @return True if the translated line should be sent, false if it must be dropped
+	 */
+	typedef bool (*Translator)(TreeSocket* sock, std::string& line, std::string::size_type a, std::string::size_type b);
+
+	struct Entry
+	{
+		/** Function translating the command */
+		Translator translator;
+
+		/** True if the translation depends on the state of the socket, false if all sockets
+		 * using this table get the same translation of a line
+		 */
+		bool perlink;
+	};
+
+ private:
+	typedef TR1NS::unordered_map<std::string, Entry> EntryMap;
+
+	/** Translations, keyed by command name
+	 */
+	EntryMap entries;
+
+	/** Add a translation to the table
+	 * @param cmd Command to translate
+	 * @param translator Translator function
+	 * @param perlink True if the translation depends on the state of the socket
+	 */
+	void Add(const std::string& cmd, Translator translator, bool perlink = false);
+
+	CompatTable(long version);
+
+ public:
+	/** Find the translation of a command
+	 * @param line Line to translate, beginning with the source prefix
+	 * @param a Position of the space before the command
+	 * @param b Position of the space after the command, npos if the line has no parameters
+	 * @return Translation of the command or NULL if it is sent unchanged
+	 */
+	const Entry* Find(const std::string& line, std::string::size_type a, std::string::size_type b) const;
+
+	/** Get the table to use for a protocol version
+	 * @param version Protocol version of the remote server
+	 * @return Table for the protocol or NULL if lines are sent unchanged
+	 */
+	static const CompatTable* Get(long version);
+};
+
+/** A line being sent to one or more servers.
+ * The line is only converted into a send queue element once and the same buffer is
+ * queued on every socket that sends it unchanged. Servers using an older protocol share
+ * the translation as well, unless it depends on the state of their socket.
+ */
+class TreeLine
+{
+	typedef StreamSocket::SendQueue::Element Element;
+
+	/** Line to send, without a new line character at the end
+	 */
+	const std::string& line;
+
+	/** The line with a new line character appended, empty until needed
+	 */
+	Element elem;
+
+	/** Table the cached translation was made with, NULL if there is none
+	 */
+	const CompatTable* translatedfor;
+
+	/** Cached translation of the line, with a new line character appended
+	 */
+	Element translated;
+
+	/** True if the line is dropped by translatedfor
+	 */
+	bool dropped;
+
+ public:
+	explicit TreeLine(const std::string& str)
+		: line(str)
+		, translatedfor(NULL)
+		, dropped(false)
+	{
+	}
+
+	/** Get the line
+	 * @return Line without a new line character at the end
+	 */
+	const std::string& str() const { return line; }
+
+	/** Get the line as a send queue element
+	 * @return Element holding the line with a new line character appended
+	 */
+	const Element& GetElement();
+
+	/** Get the line translated for a socket
+	 * @param sock Socket the line is sent on
+	 * @param table Translation table of the socket
+	 * @param out Element to store the translated line in, with a new line character appended
+	 * @return True if the line should be sent, false if it must be dropped
+	 */
+	bool Translate(TreeSocket* sock, const CompatTable* table, Element& out);
+};
@@ -33,6 +33,7 @@ class Link : public refcountbase
 	std::vector<std::string> AllowMasks;
 	bool HiddenFromStats;
 	std::string Hook;
+	bool Compress;
 	int Timeout;
 	std::string Bind;
 	bool Hidden;
@@ -42,6 +42,7 @@ ModuleSpanningTree::ModuleSpanningTree()
 	, currmembid(0)
 	, eventprov(this, "event/spanningtree")
 	, DNS(this, "DNS")
+	, routecache("routecache", ExtensionItem::EXT_CHANNEL, this)
 	, loopCall(false)
 {
 }
@@ -446,6 +447,8 @@ void ModuleSpanningTree::OnUserConnect(LocalUser* user)
 
 void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by_local, CUList& excepts)
 {
+	InvalidateRoutes(memb->chan, memb->user);
+
 	// Only do this for local users
 	if (!IS_LOCAL(memb->user))
 		return;
@@ -500,6 +503,8 @@ void ModuleSpanningTree::OnChangeIdent(User* user, const std::string &ident)
 
 void ModuleSpanningTree::OnUserPart(Membership* memb, std::string &partmessage, CUList& excepts)
 {
+	InvalidateRoutes(memb->chan, memb->user);
+
 	if (IS_LOCAL(memb->user))
 	{
 		CmdBuilder params(memb->user, "PART");
@@ -521,6 +526,9 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const
 	}
 	else
 	{
+		for (User::ChanList::iterator i = user->chans.begin(); i != user->chans.end(); ++i)
+			routecache.unset((*i)->chan);
+
 		// Hide the message if one of the following is true:
 		// - User is being quit due to a netsplit and quietbursts is on
 		// - Server is a silent uline
@@ -555,6 +563,8 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts)
 {
+	InvalidateRoutes(memb->chan, memb->user);
+
 	if ((!IS_LOCAL(source)) && (source != ServerInstance->FakeClient))
 		return;
 
@@ -684,7 +694,13 @@ void ModuleSpanningTree::OnOper(User* user, const std::string &opertype)
 
 void ModuleSpanningTree::OnAddLine(User* user, XLine *x)
 {
-	if (!x->IsBurstable() || loopCall || (user && !IS_LOCAL(user)))
+	if (!x->IsBurstable())
+		return;
+
+	// Journal every change, no matter where it came from, servers relinking after a split may have missed it
+	Utils->Journal.Add(CommandAddLine::Builder(x, ServerInstance->FakeClient).str());
+
+	if (loopCall || (user && !IS_LOCAL(user)))
 		return;
 
 	if (!user)
@@ -695,7 +711,14 @@ void ModuleSpanningTree::OnAddLine(User* user, XLine *x)
 
 void ModuleSpanningTree::OnDelLine(User* user, XLine *x)
 {
-	if (!x->IsBurstable() || loopCall || (user && !IS_LOCAL(user)))
+	if (!x->IsBurstable())
+		return;
+
+	CmdBuilder delline(ServerInstance->FakeClient, "DELLINE");
+	delline.push(x->type).push(x->Displayable());
+	Utils->Journal.Add(delline.str());
+
+	if (loopCall || (user && !IS_LOCAL(user)))
 		return;
 
 	if (!user)
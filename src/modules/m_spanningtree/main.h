@@ -76,11 +76,25 @@ class ModuleSpanningTree : public Module
 	 */
 	Events::ModuleEventProvider eventprov;
 
+	/** Invalidate the routes cached for a channel if a remote user joins or leaves it
+	 * @param chan Channel whose membership changes
+	 * @param user User joining or leaving
+	 */
+	void InvalidateRoutes(Channel* chan, User* user)
+	{
+		if (!IS_LOCAL(user))
+			routecache.unset(chan);
+	}
+
  public:
 	dynamic_reference<DNS::Manager> DNS;
 
 	ServerCommandManager CmdManager;
 
+	/** Routes of channel messages, cached per channel
+	 */
+	SimpleExtItem<ChannelRoutes> routecache;
+
 	/** Set to true if inside a spanningtree call, to prevent sending
 	 * xlines and other things back to their source
 	 */
@@ -95,6 +95,92 @@ struct TreeSocket::BurstState
 	BurstState(TreeSocket* sock) : server(sock) { }
 };
 
+/** Returns a monotonic timestamp in milliseconds, used to measure the time spent on a burst
+ */
+static unsigned long GetBurstClock()
+{
+#ifdef _WIN32
+	return GetTickCount();
+#elif defined HAS_CLOCK_GETTIME
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+#endif
+}
+
+/** A netburst which is being sent to a server.
+ * The burst is generated in parts, whenever the socket has written most of what was generated before,
+ * so a large burst neither stalls the main loop nor has to be held in memory as a whole.
+ * Users and channels are recorded when the burst begins and are looked up again when it is their turn,
+ * the ones which are gone by then are skipped. Everything else sent to the server while the burst is in
+ * progress is held back until ENDBURST, so the server is never told about changes to something it
+ * doesn't know about yet.
+ */
+class TreeSocket::NetBurst
+{
+ public:
+	enum Phase
+	{
+		PHASE_USERS,
+		PHASE_CHANNELS,
+		PHASE_NETWORK,
+		PHASE_END
+	};
+
+	BurstState bs;
+
+	/** Part of the burst currently being generated */
+	Phase phase;
+
+	/** UUIDs of the users to introduce */
+	std::vector<std::string> users;
+
+	/** Names of the channels to sync */
+	std::vector<std::string> channels;
+
+	/** Position in the user or channel list, depending on the phase */
+	size_t pos;
+
+	/** Lines which are sent after ENDBURST */
+	std::string deferred;
+
+	/** True while lines of the burst itself are being written */
+	bool generating;
+
+	/** Number of bytes generated so far */
+	unsigned long bytes;
+
+	/** Time when the burst began, as returned by GetBurstClock() */
+	const unsigned long started;
+
+	NetBurst(TreeSocket* sock)
+		: bs(sock)
+		, phase(PHASE_USERS)
+		, pos(0)
+		, generating(false)
+		, bytes(0)
+		, started(GetBurstClock())
+	{
+		const user_hash& userlist = ServerInstance->Users->GetUsers();
+		users.reserve(userlist.size());
+		for (user_hash::const_iterator i = userlist.begin(); i != userlist.end(); ++i)
+		{
+			User* user = i->second;
+			if (user->registered == REG_ALL)
+				users.push_back(user->uuid);
+		}
+
+		const chan_hash& chans = ServerInstance->GetChans();
+		channels.reserve(chans.size());
+		for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
+			channels.push_back(i->second->name);
+	}
+};
+
 /** This function is called when we want to send a netburst to a local
  * server. There is a set order we must do this, because for example
  * users require their servers to exist, and channels require their
@@ -107,26 +193,197 @@ void TreeSocket::DoBurst(TreeServer* s)
 		capab->auth_fingerprint ? "SSL certificate fingerprint and " : "",
 		capab->auth_challenge ? "challenge-response" : "plaintext password");
 	this->CleanNegotiationInfo();
+
+	burst = new NetBurst(this);
+	burst->generating = true;
 	this->WriteLine(CmdBuilder("BURST").push_int(ServerInstance->Time()));
 	// Introduce all servers behind us
 	this->SendServers(Utils->TreeRoot, s);
+	burst->generating = false;
+	this->burstsent = true;
 
-	BurstState bs(this);
-	// Introduce all users
-	this->SendUsers(bs);
+	// Users, channels and everything else follow as fast as the socket takes them
+	ContinueBurst();
+}
+
+bool TreeSocket::GenerateBurst()
+{
+	burst->generating = true;
+	while ((burst->phase != NetBurst::PHASE_END) && (getSendQSize() < Utils->BurstBuffer))
+	{
+		switch (burst->phase)
+		{
+			case NetBurst::PHASE_USERS:
+			{
+				if (burst->pos == burst->users.size())
+				{
+					burst->phase = NetBurst::PHASE_CHANNELS;
+					burst->pos = 0;
+					break;
+				}
+
+				User* user = ServerInstance->FindUUID(burst->users[burst->pos++]);
+				if ((user) && (user->registered == REG_ALL))
+					SendUser(user, burst->bs);
+			}
+			break;
+
+			case NetBurst::PHASE_CHANNELS:
+			{
+				if (burst->pos == burst->channels.size())
+				{
+					burst->phase = NetBurst::PHASE_NETWORK;
+					burst->pos = 0;
+					break;
+				}
+
+				Channel* chan = ServerInstance->FindChan(burst->channels[burst->pos++]);
+				if (chan)
+					SyncChannel(chan, burst->bs);
+			}
+			break;
+
+			case NetBurst::PHASE_NETWORK:
+			{
+				// Send all xlines, or only what changed if the server was split from us for a short time
+				if (!this->SendXLineChanges())
+					this->SendXLines();
+				FOREACH_MOD(OnSyncNetwork, (burst->bs.server));
+				burst->phase = NetBurst::PHASE_END;
+			}
+			break;
+
+			case NetBurst::PHASE_END:
+			break;
+		}
+	}
+	burst->generating = false;
+	return (burst->phase == NetBurst::PHASE_END);
+}
+
+void TreeSocket::ContinueBurst()
+{
+	const unsigned long deadline = GetBurstClock() + Utils->BurstTimeSlice;
+	while ((burst) && (getError().empty()))
+	{
+		if (GenerateBurst())
+		{
+			EndBurst();
+			DoWrite();
+			// Stop polling for writability if we did that to resume the burst
+			if ((getError().empty()) && (getSendQSize() == 0))
+				SocketEngine::ChangeEventMask(this, FD_WANT_EDGE_WRITE);
+			return;
+		}
+
+		DoWrite();
 
-	// Sync all channels
-	const chan_hash& chans = ServerInstance->GetChans();
-	for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
-		SyncChannel(i->second, bs);
+		// If the socket did not take everything we'll get a write event once it's writable again
+		if (getSendQSize() != 0)
+			return;
 
-	// Send all xlines
-	this->SendXLines();
-	FOREACH_MOD(OnSyncNetwork, (bs.server));
+		if (GetBurstClock() >= deadline)
+		{
+			// Let other sockets have their turn, resume in the next main loop iteration
+			SocketEngine::ChangeEventMask(this, FD_WANT_POLL_WRITE);
+			return;
+		}
+	}
+}
+
+void TreeSocket::EndBurst()
+{
+	NetBurst* const nb = burst;
+	burst = NULL;
+
+	// ENDBURST is only added to the pending lines, it must be queued before the lines held back during the burst
 	this->WriteLine(CmdBuilder("ENDBURST"));
-	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \2"+ s->GetName()+"\2.");
+	FlushLines();
+	this->WriteData(nb->deferred);
 
-	this->burstsent = true;
+	const unsigned long elapsed = GetBurstClock() - nb->started;
+	ServerInstance->SNO->WriteToSnoMask('l', "Finished bursting to \2%s\2 (%lu bytes in %lu ms).",
+		MyRoot->GetName().c_str(), nb->bytes, elapsed);
+	delete nb;
+}
+
+void TreeSocket::AbortBurst()
+{
+	delete burst;
+	burst = NULL;
+}
+
+bool TreeSocket::DeferBurstLine(const SendQueue::Element& line)
+{
+	if (burst->generating)
+	{
+		burst->bytes += line.length();
+		return false;
+	}
+
+	// PING, PONG and ERROR don't depend on the state of the network, delaying them could time out the link
+	const char* cmd = line.data();
+	const char* const end = cmd + line.length();
+	if (*cmd == ':')
+	{
+		cmd = std::find(cmd, end, ' ');
+		if (cmd == end)
+			return false;
+		cmd++;
+	}
+
+	const size_t cmdlen = end - cmd;
+	if (((cmdlen > 5) && ((!memcmp(cmd, "PING ", 5)) || (!memcmp(cmd, "PONG ", 5)))) || ((cmdlen > 6) && (!memcmp(cmd, "ERROR ", 6))))
+		return false;
+
+	// Nothing is sent on a link which is being closed
+	if (!getError().empty())
+		return true;
+
+	// The network changes faster than the server takes the burst, give up instead of holding back more and more
+	if (burst->deferred.length() + line.length() > Utils->BurstDeferLimit)
+	{
+		burst->deferred.clear();
+		SendError("Held back more than " + ConvToStr(Utils->BurstDeferLimit) + " bytes while sending netburst");
+		return true;
+	}
+
+	burst->deferred.append(line.data(), line.length());
+	return true;
+}
+
+bool TreeSocket::CanWriteThreaded() const
+{
+	return ((!burst) && (pendinglines.empty()) && (BufferedSocket::CanWriteThreaded()));
+}
+
+void TreeSocket::OnEventHandlerWrite()
+{
+	FlushLines();
+	BufferedSocket::OnEventHandlerWrite();
+	if ((burst) && (getError().empty()))
+	{
+		ContinueBurst();
+		if (!getError().empty())
+			OnError(I_ERR_WRITE);
+	}
+}
+
+std::string TreeSocket::GetBurstProgress() const
+{
+	if (!burst)
+		return std::string();
+
+	static const char* const phasenames[] = { "users", "channels", "network", "end" };
+	const size_t usersdone = (burst->phase == NetBurst::PHASE_USERS ? burst->pos : burst->users.size());
+	const size_t chansdone = (burst->phase == NetBurst::PHASE_USERS ? 0 : burst->phase == NetBurst::PHASE_CHANNELS ? burst->pos : burst->channels.size());
+	const unsigned long elapsed = GetBurstClock() - burst->started;
+	const double rate = (elapsed ? burst->bytes / (elapsed / 1000.0) / 1024.0 : 0);
+
+	return InspIRCd::Format("%s: phase %s users %lu/%lu channels %lu/%lu sent %lu bytes in %lu ms (%.2fK/s) held back %lu bytes",
+		MyRoot->GetName().c_str(), phasenames[burst->phase], (unsigned long)usersdone, (unsigned long)burst->users.size(),
+		(unsigned long)chansdone, (unsigned long)burst->channels.size(), burst->bytes, elapsed, rate,
+		(unsigned long)burst->deferred.size());
 }
 
 void TreeSocket::SendServerInfo(TreeServer* from)
@@ -270,35 +527,25 @@ void TreeSocket::SyncChannel(Channel* chan)
 	SyncChannel(chan, bs);
 }
 
-/** Send all users and their state, including oper and away status and global metadata */
-void TreeSocket::SendUsers(BurstState& bs)
+/** Send a user and its state, including oper and away status and global metadata */
+void TreeSocket::SendUser(User* user, BurstState& bs)
 {
-	ProtocolInterface::Server& piserver = bs.server;
-
-	const user_hash& users = ServerInstance->Users->GetUsers();
-	for (user_hash::const_iterator u = users.begin(); u != users.end(); ++u)
-	{
-		User* user = u->second;
-		if (user->registered != REG_ALL)
-			continue;
-
-		this->WriteLine(CommandUID::Builder(user));
-
-		if (user->IsOper())
-			this->WriteLine(CommandOpertype::Builder(user));
+	this->WriteLine(CommandUID::Builder(user));
 
-		if (user->IsAway())
-			this->WriteLine(CommandAway::Builder(user));
+	if (user->IsOper())
+		this->WriteLine(CommandOpertype::Builder(user));
 
-		const Extensible::ExtensibleStore& exts = user->GetExtList();
-		for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
-		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_NETWORK, u->second, i->second);
-			if (!value.empty())
-				this->WriteLine(CommandMetadata::Builder(user, item->name, value));
-		}
+	if (user->IsAway())
+		this->WriteLine(CommandAway::Builder(user));
 
-		FOREACH_MOD(OnSyncUser, (user, piserver));
+	const Extensible::ExtensibleStore& exts = user->GetExtList();
+	for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
+	{
+		ExtensionItem* item = i->first;
+		std::string value = item->serialize(FORMAT_NETWORK, user, i->second);
+		if (!value.empty())
+			this->WriteLine(CommandMetadata::Builder(user, item->name, value));
 	}
+
+	FOREACH_MOD(OnSyncUser, (user, bs.server));
 }
@@ -19,10 +19,13 @@
 
 
 #include "inspircd.h"
+#include "modules/ziplink.h"
 
 #include "main.h"
 #include "utils.h"
 #include "link.h"
+#include "treeserver.h"
+#include "treesocket.h"
 
 ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 {
@@ -44,6 +47,36 @@ ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 		}
 		return MOD_RES_DENY;
 	}
+	else if (stats.GetSymbol() == 'B')
+	{
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			TreeSocket* sock = (*i)->GetSocket();
+			if (sock->IsSendingBurst())
+				stats.AddRow(249, sock->GetBurstProgress());
+		}
+		return MOD_RES_DENY;
+	}
+	else if (stats.GetSymbol() == 'W')
+	{
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			TreeServer* server = *i;
+			ZipLinkIOHook* hook = ZipLinkIOHook::Find(server->GetSocket());
+			if (!hook)
+				continue;
+
+			const ZipLinkStats& zs = hook->GetStats();
+			stats.AddRow(249, InspIRCd::Format("%s: %s sent %llu bytes as %llu (%.1f%%) received %llu bytes as %llu (%.1f%%) time spent %llu ms",
+				server->GetName().c_str(), hook->prov->name.c_str(),
+				zs.rawout, zs.wireout, (zs.rawout ? 100.0 * zs.wireout / zs.rawout : 100.0),
+				zs.rawin, zs.wirein, (zs.rawin ? 100.0 * zs.wirein / zs.rawin : 100.0),
+				zs.usecs / 1000));
+		}
+		return MOD_RES_DENY;
+	}
 	else if (stats.GetSymbol() == 'U')
 	{
 		ConfigTagList tags = ServerInstance->Config->ConfTags("uline");
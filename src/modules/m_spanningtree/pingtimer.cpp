@@ -37,6 +37,8 @@ PingTimer::State PingTimer::TickInternal()
 	{
 		// Last ping was answered, send next ping
 		server->GetSocket()->WriteLine(CmdBuilder("PING").push(server->GetID()));
+		if (server->IsLocal())
+			server->GetSocket()->OnResyncPing();
 		LastPingMsec = ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
 		// Warn next unless warnings are disabled. If they are, jump straight to timeout.
 		if (Utils->PingWarnTime)
@@ -97,6 +99,9 @@ void PingTimer::OnPong()
 	long ts = ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
 	server->rtt = ts - LastPingMsec;
 
+	if (server->IsLocal())
+		server->GetSocket()->OnResyncPong();
+
 	// Change state to send ping next, also reschedules the timer appropriately
 	SetState(PS_SENDPING);
 }
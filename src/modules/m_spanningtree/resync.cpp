@@ -0,0 +1,134 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "resync.h"
+#include "treesocket.h"
+#include "treeserver.h"
+#include "utils.h"
+
+ResyncJournal::ResyncJournal()
+	: id(ServerInstance->GenRandomStr(16))
+	, lastseq(0)
+	, maxentries(0)
+	, maxage(0)
+{
+}
+
+std::string ResyncJournal::GetID() const
+{
+	if (!maxentries)
+		return std::string();
+	return id;
+}
+
+void ResyncJournal::Prune()
+{
+	const time_t oldest = ServerInstance->Time() - maxage;
+	while ((!entries.empty()) && ((entries.size() > maxentries) || (entries.front().time < oldest)))
+		entries.pop_front();
+
+	for (ResumeMap::iterator i = resumepoints.begin(); i != resumepoints.end(); )
+	{
+		if (i->second.time < oldest)
+			resumepoints.erase(i++);
+		else
+			++i;
+	}
+}
+
+void ResyncJournal::Add(const std::string& line)
+{
+	// Changes are numbered even if they're not kept, a resume point can't be used if the journal was off for a while
+	lastseq++;
+	if (!maxentries)
+		return;
+
+	Entry entry;
+	entry.seq = lastseq;
+	entry.time = ServerInstance->Time();
+	entry.line = line;
+	entries.push_back(entry);
+	Prune();
+}
+
+void ResyncJournal::SetResumePoint(const std::string& sid, const std::string& peerid, Seq seq)
+{
+	if (!maxentries)
+		return;
+
+	ResumePoint& point = resumepoints[sid];
+	point.peerid = peerid;
+	point.seq = seq;
+	point.time = ServerInstance->Time();
+}
+
+bool ResyncJournal::GetChanges(const std::string& sid, const std::string& peerid, std::vector<std::string>& lines)
+{
+	Prune();
+
+	ResumeMap::const_iterator it = resumepoints.find(sid);
+	if ((it == resumepoints.end()) || (it->second.peerid != peerid))
+		return false;
+
+	// Everything after the resume point has to be in the journal, otherwise the server missed changes we no longer have
+	const Seq resumeseq = it->second.seq;
+	const Seq firstseq = (entries.empty() ? lastseq + 1 : entries.front().seq);
+	if (resumeseq + 1 < firstseq)
+		return false;
+
+	for (std::deque<Entry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		if (i->seq > resumeseq)
+			lines.push_back(i->line);
+	}
+	return true;
+}
+
+void TreeSocket::OnResyncPing()
+{
+	// Lines are sent in order, so the answer to this PING means the server has seen everything before it.
+	// During a burst PINGs overtake the lines held back until the end of the burst, their answer proves nothing.
+	resyncpingseq = Utils->Journal.GetLastSeq();
+	resyncpending = (burst == NULL);
+}
+
+void TreeSocket::OnResyncPong()
+{
+	if (!resyncpending)
+		return;
+
+	resyncseq = resyncpingseq;
+	resyncpending = false;
+	resyncacked = true;
+}
+
+bool TreeSocket::SendXLineChanges()
+{
+	if (resyncid.empty())
+		return false;
+
+	std::vector<std::string> lines;
+	if (!Utils->Journal.GetChanges(MyRoot->GetID(), resyncid, lines))
+		return false;
+
+	ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Sending %u X-line change(s) to %s instead of all X-lines", (unsigned int)lines.size(), MyRoot->GetName().c_str());
+	for (std::vector<std::string>::const_iterator i = lines.begin(); i != lines.end(); ++i)
+		WriteLine(*i);
+	return true;
+}
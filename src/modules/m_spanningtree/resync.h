@@ -0,0 +1,119 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/** Journal of the X-line changes seen by this server.
+ * Users and channel memberships behind a split are forgotten by both sides, but X-lines are
+ * kept. When a server relinks shortly after a split, only the X-line changes it missed are
+ * sent to it instead of every X-line we know about.
+ *
+ * What a server has seen is tracked with PINGs: once it answers a PING, it has processed
+ * every change journaled before the PING was sent. The journal is identified by a random
+ * id exchanged in CAPAB, so a server which restarted or reloaded this module in the
+ * meantime is sent all X-lines again.
+ */
+class ResyncJournal
+{
+ public:
+	/** Sequence number of a change, the first change is 1
+	 */
+	typedef unsigned long Seq;
+
+ private:
+	struct Entry
+	{
+		Seq seq;
+		time_t time;
+		std::string line;
+	};
+
+	/** Point up to which a server that has split from us had seen our changes
+	 */
+	struct ResumePoint
+	{
+		/** Journal id of the server */
+		std::string peerid;
+		/** Last change the server has seen */
+		Seq seq;
+		/** Time of the split */
+		time_t time;
+	};
+
+	typedef std::map<std::string, ResumePoint> ResumeMap;
+
+	/** Random id of this journal
+	 */
+	const std::string id;
+
+	/** Journaled changes, oldest first
+	 */
+	std::deque<Entry> entries;
+
+	/** Sequence number of the last change journaled
+	 */
+	Seq lastseq;
+
+	/** Resume points of servers that have split, keyed by their SID
+	 */
+	ResumeMap resumepoints;
+
+	/** Remove changes and resume points which are too old or don't fit into the journal
+	 */
+	void Prune();
+
+ public:
+	/** Maximum number of changes kept, 0 to disable the journal
+	 */
+	size_t maxentries;
+
+	/** Number of seconds changes and resume points are kept
+	 */
+	time_t maxage;
+
+	ResyncJournal();
+
+	/** Get the id of the journal, sent to other servers in CAPAB
+	 * @return Journal id or an empty string if the journal is disabled
+	 */
+	std::string GetID() const;
+
+	/** Get the sequence number of the last change
+	 * @return Sequence number of the last change, 0 if nothing was journaled yet
+	 */
+	Seq GetLastSeq() const { return lastseq; }
+
+	/** Add a change to the journal
+	 * @param line Server to server message making the change
+	 */
+	void Add(const std::string& line);
+
+	/** Remember what a server which has split from us has seen
+	 * @param sid SID of the server
+	 * @param peerid Journal id of the server
+	 * @param seq Sequence number of the last change the server has seen
+	 */
+	void SetResumePoint(const std::string& sid, const std::string& peerid, Seq seq);
+
+	/** Get the changes a relinking server has missed
+	 * @param sid SID of the server
+	 * @param peerid Journal id the server sent in CAPAB
+	 * @param lines Vector to append the messages to
+	 * @return True if the changes were found, false if the server has to be sent all X-lines
+	 */
+	bool GetChanges(const std::string& sid, const std::string& peerid, std::vector<std::string>& lines);
+};
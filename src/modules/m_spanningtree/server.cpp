@@ -161,6 +161,12 @@ bool TreeSocket::Outbound_Reply_Server(parameterlist &params)
 		 * While we're at it, create a treeserver object so we know about them.
 		 *   -- w
 		 */
+		if (!StartCompression())
+		{
+			this->SendError("Unable to start compression");
+			return false;
+		}
+
 		FinishAuth(params[0], params[3], params.back(), x->Hidden);
 
 		return true;
@@ -217,6 +223,13 @@ bool TreeSocket::Inbound_Server(parameterlist &params)
 
 		// move to the next state, we are now waiting for THEM.
 		this->LinkState = WAIT_AUTH_2;
+
+		// They have authenticated themselves, everything we send from now on may be compressed
+		if (!StartCompression())
+		{
+			this->SendError("Unable to start compression");
+			return false;
+		}
 		return true;
 	}
 
@@ -25,6 +25,9 @@
 #include "inspircd.h"
 
 #include "utils.h"
+#include "compattable.h"
+
+class ZipLinkIOHook;
 
 /*
  * The server list in InspIRCd is maintained as two structures
@@ -90,19 +93,54 @@ struct CapabData
 class TreeSocket : public BufferedSocket
 {
 	struct BurstState;
+	class NetBurst;
 
 	std::string linkID;			/* Description for this link */
 	ServerState LinkState;			/* Link state */
 	CapabData* capab;			/* Link setup data (held until burst is sent) */
 	TreeServer* MyRoot;			/* The server we are talking to */
 	int proto_version;			/* Remote protocol version */
+	const CompatTable* compat;		/* Translations for the remote protocol, NULL if none are needed */
+
+	/** Compression methods we offered to the server in CAPAB, the only ones it may compress the data it sends with
+	 */
+	std::string offeredcompress;
 
-	/** True if we've sent our burst.
+	/** True if we've sent the server list of our burst.
 	 * This only changes the behavior of message translation for 1202 protocol servers and it can be
 	 * removed once 1202 support is dropped.
 	 */
 	bool burstsent;
 
+	/** Netburst being sent to the server, NULL if there is none in progress
+	 */
+	NetBurst* burst;
+
+	/** Lines written since the socket was last written to, queued on the send queue as one buffer
+	 * before each write so that a busy link gets one buffer per main loop iteration instead of one per line
+	 */
+	std::string pendinglines;
+
+	/** Journal id the server sent in CAPAB, empty if it doesn't support resyncing after a split
+	 */
+	std::string resyncid;
+
+	/** Last change in our journal when the unanswered PING was sent to the server
+	 */
+	ResyncJournal::Seq resyncpingseq;
+
+	/** Last change in our journal the server is known to have seen
+	 */
+	ResyncJournal::Seq resyncseq;
+
+	/** True if the server has been sent everything up to resyncpingseq when we sent the last PING
+	 */
+	bool resyncpending;
+
+	/** True if resyncseq is valid
+	 */
+	bool resyncacked;
+
 	/** Checks if the given servername and sid are both free
 	 */
 	bool CheckDuplicate(const std::string& servername, const std::string& sid);
@@ -114,8 +152,39 @@ class TreeSocket : public BufferedSocket
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan, BurstState& bs);
 
-	/** Send all users and their oper state, away state and metadata */
-	void SendUsers(BurstState& bs);
+	/** Send a user and its oper state, away state and metadata */
+	void SendUser(User* user, BurstState& bs);
+
+	/** Generate the next part of the netburst, until the send queue holds at least
+	 * BurstBuffer bytes or the burst is complete.
+	 * @return True if everything up to (but excluding) ENDBURST has been generated
+	 */
+	bool GenerateBurst();
+
+	/** Generate and write the netburst for as long as the socket takes data and the time
+	 * allowed for a single main loop iteration is not used up.
+	 */
+	void ContinueBurst();
+
+	/** Send ENDBURST followed by the messages that were held back during the burst
+	 */
+	void EndBurst();
+
+	/** Drop the netburst in progress without sending the rest of it
+	 */
+	void AbortBurst();
+
+	/** Hold back a line from being sent if a burst is in progress
+	 * @param line Line to send with a new line character at the end
+	 * @return True if the line was saved to be sent after the burst, false if it should be sent now
+	 */
+	bool DeferBurstLine(const SendQueue::Element& line);
+
+	/** Sockets which are sending a burst have to generate the next part of it on every
+	 * write event, and pending lines have to be queued before writing, so the writes of
+	 * those sockets are never given to the I/O threads.
+	 */
+	bool CanWriteThreaded() const CXX11_OVERRIDE;
 
 	/** Send all additional info about the given server to this server */
 	void SendServerInfo(TreeServer* from);
@@ -151,10 +220,14 @@ class TreeSocket : public BufferedSocket
 	 */
 	Link* AuthRemote(const parameterlist& params);
 
-	/** Write a line on this socket with a new line character appended, skipping all translation for old protocols
-	 * @param line Line to write without a new line character at the end
+	/** Write a line on this socket, skipping all translation for old protocols
+	 * @param line Line to write with a new line character at the end
+	 */
+	void WriteLineNoCompat(const SendQueue::Element& line);
+
+	/** Move the pending lines to the send queue
 	 */
-	void WriteLineNoCompat(const std::string& line);
+	void FlushLines();
 
  public:
 	const time_t age;
@@ -248,6 +321,30 @@ class TreeSocket : public BufferedSocket
 
 	bool Capab(const parameterlist &params);
 
+	/** Get the compression methods we can use on this link
+	 * @return Comma separated list of compression methods, most preferred first, empty if the link is not compressed
+	 */
+	std::string GetCompressMethods();
+
+	/** Get the compression hook of this socket, hook the socket if it has none
+	 * @param method Compression method the hook must use
+	 * @return Compression hook or NULL if the method is not available
+	 */
+	ZipLinkIOHook* GetZipLinkHook(const std::string& method);
+
+	/** Start compressing the data we send, if the remote server supports a compression method we do.
+	 * Called once the remote server has authenticated itself.
+	 * @return True on success or if there is nothing to compress with, false on error
+	 */
+	bool StartCompression();
+
+	/** Start decompressing the data the remote server sends, after it sent CAPAB COMPRESS.
+	 * The link is closed if the server has not authenticated itself yet or if we did not offer the method.
+	 * @param method Compression method the server uses
+	 * @return True if decompression was started, false if the link was closed
+	 */
+	bool StartDecompression(const std::string& method);
+
 	/** Send one or more FJOINs for a channel of users.
 	 * If the length of a single line is more than 480-NICKMAX
 	 * in length, it is split over multiple lines.
@@ -257,6 +354,11 @@ class TreeSocket : public BufferedSocket
 	/** Send G, Q, Z and E lines */
 	void SendXLines();
 
+	/** Send the X-line changes the server missed while it was split from us
+	 * @return True if the changes were sent, false if the server has to be sent all X-lines
+	 */
+	bool SendXLineChanges();
+
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan);
 
@@ -272,10 +374,43 @@ class TreeSocket : public BufferedSocket
 	 */
 	void OnDataReady() CXX11_OVERRIDE;
 
+	/** Write pending data and continue the netburst, if one is in progress
+	 */
+	void OnEventHandlerWrite() CXX11_OVERRIDE;
+
+	/** Check if a netburst is being sent on this socket
+	 * @return True if the burst has not been completely sent yet
+	 */
+	bool IsSendingBurst() const { return (burst != NULL); }
+
+	/** Get a description of how far the netburst sent on this socket has progressed
+	 * @return Progress and throughput of the burst, empty if there is no burst in progress
+	 */
+	std::string GetBurstProgress() const;
+
+	/** Called when a PING is sent to the server, remembers how much of our journal it covers
+	 */
+	void OnResyncPing();
+
+	/** Called when the server answers our PING, it has seen our journal up to the point the PING was sent
+	 */
+	void OnResyncPong();
+
 	/** Send one or more complete lines down the socket
 	 */
 	void WriteLine(const std::string& line);
 
+	/** Send a line which may be sent to other servers as well down the socket.
+	 * The line is translated at most once for all servers using the same older protocol.
+	 * @param line Line to send
+	 */
+	void WriteLine(TreeLine& line);
+
+	/** Check whether the server list of our burst has been sent
+	 * @return True if the server list has been sent, false otherwise
+	 */
+	bool IsBurstSent() const { return burstsent; }
+
 	/** Handle ERROR command */
 	void Error(parameterlist &params);
 
@@ -37,8 +37,10 @@
  * and only do minor initialization tasks ourselves.
  */
 TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const std::string& ipaddr)
-	: linkID(link->Name), LinkState(CONNECTING), MyRoot(NULL), proto_version(0)
-	, burstsent(false), age(ServerInstance->Time())
+	: linkID(link->Name), LinkState(CONNECTING), MyRoot(NULL), proto_version(0), compat(NULL)
+	, burstsent(false), burst(NULL)
+	, resyncpingseq(0), resyncseq(0), resyncpending(false), resyncacked(false)
+	, age(ServerInstance->Time())
 {
 	capab = new CapabData;
 	capab->link = link;
@@ -54,8 +56,10 @@ TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const std::string& ipaddr)
  */
 TreeSocket::TreeSocket(int newfd, ListenSocket* via, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server)
 	: BufferedSocket(newfd)
-	, linkID("inbound from " + client->addr()), LinkState(WAIT_AUTH_1), MyRoot(NULL), proto_version(0)
-	, burstsent(false), age(ServerInstance->Time())
+	, linkID("inbound from " + client->addr()), LinkState(WAIT_AUTH_1), MyRoot(NULL), proto_version(0), compat(NULL)
+	, burstsent(false), burst(NULL)
+	, resyncpingseq(0), resyncseq(0), resyncpending(false), resyncacked(false)
+	, age(ServerInstance->Time())
 {
 	capab = new CapabData;
 	capab->capab_phase = 0;
@@ -100,6 +104,7 @@ CullResult TreeSocket::cull()
 TreeSocket::~TreeSocket()
 {
 	delete capab;
+	AbortBurst();
 }
 
 /** When an outbound connection finishes connecting, we receive
@@ -140,6 +145,7 @@ void TreeSocket::OnError(BufferedSocketError e)
 void TreeSocket::SendError(const std::string &errormessage)
 {
 	WriteLine("ERROR :"+errormessage);
+	FlushLines();
 	DoWrite();
 	LinkState = DYING;
 	SetError(errormessage);
@@ -206,8 +206,13 @@ void TreeSocket::ProcessLine(std::string &line)
 			 * State CONNECTED:
 			 *  Credentials have been exchanged, we've gotten their 'BURST' (or sent ours).
 			 *  Anything from here on should be accepted a little more reasonably.
+			 *  The server we connected to starts compressing right after the SERVER
+			 *  which put us into this state, so CAPAB COMPRESS is accepted here too.
 			 */
-			this->ProcessConnectedLine(prefix, command, params);
+			if ((command == "CAPAB") && (params.size() == 2) && (params[0] == "COMPRESS"))
+				this->StartDecompression(params[1]);
+			else
+				this->ProcessConnectedLine(prefix, command, params);
 		break;
 		case DYING:
 		break;
@@ -363,14 +368,24 @@ void TreeSocket::Close()
 		return;
 
 	ServerInstance->GlobalCulls.AddItem(this);
+	FlushLines();
 	this->BufferedSocket::Close();
 	SetError("Remote host closed connection");
 
+	// Nothing more of the burst can be sent
+	AbortBurst();
+
 	// Connection closed.
 	// If the connection is fully up (state CONNECTED)
 	// then propogate a netsplit to all peers.
 	if (MyRoot)
+	{
+		// Remember what the server has seen, so it only has to be sent what it missed if it comes back soon
+		if ((resyncacked) && (!resyncid.empty()))
+			Utils->Journal.SetResumePoint(MyRoot->GetID(), resyncid, resyncseq);
+
 		MyRoot->SQuit(getError());
+	}
 
 	ServerInstance->SNO->WriteGlobalSno('l', "Connection to '\2%s\2' failed.",linkID.c_str());
 
@@ -162,9 +162,43 @@ void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeSocketSet
 	return;
 }
 
+const ChannelRoutes::RouteList& SpanningTreeUtilities::GetChannelRoutes(Channel* c)
+{
+	ChannelRoutes* cache = Creator->routecache.get(c);
+	if ((cache) && (cache->membercount == c->GetUserCounter()))
+		return cache->routes;
+
+	if (!cache)
+	{
+		cache = new ChannelRoutes;
+		Creator->routecache.set(c, cache);
+	}
+	cache->routes.clear();
+	cache->membercount = c->GetUserCounter();
+
+	const Channel::MemberMap& ulist = c->GetUsers();
+	for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
+	{
+		if (IS_LOCAL(i->first))
+			continue;
+
+		// There are only a few directly linked servers, a linear search is the fastest
+		TreeSocket* const sock = TreeServer::Get(i->first)->GetSocket();
+		ChannelRoutes::RouteList::iterator route = cache->routes.begin();
+		while ((route != cache->routes.end()) && (route->first != sock))
+			++route;
+
+		if (route == cache->routes.end())
+			cache->routes.push_back(std::make_pair(sock, 1));
+		else
+			route->second++;
+	}
+	return cache->routes;
+}
+
 void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, TreeServer* omitroute)
 {
-	const std::string& FullLine = params.str();
+	TreeLine FullLine(params.str());
 
 	const TreeServer::ChildServers& children = TreeRoot->GetChildren();
 	for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
@@ -228,7 +262,13 @@ void SpanningTreeUtilities::ReadConfiguration()
 	HideULines = security->getBool("hideulines");
 	AnnounceTSChange = options->getBool("announcets");
 	AllowOptCommon = options->getBool("allowmismatch");
-	quiet_bursts = ServerInstance->Config->ConfValue("performance")->getBool("quietbursts");
+	ConfigTag* performance = ServerInstance->Config->ConfValue("performance");
+	quiet_bursts = performance->getBool("quietbursts");
+	BurstBuffer = performance->getInt("burstbuffer", 65536, 4096);
+	BurstTimeSlice = performance->getInt("bursttimeslice", 20, 1, 1000);
+	BurstDeferLimit = performance->getInt("burstdeferlimit", 4194304, 65536);
+	Journal.maxentries = performance->getInt("journalsize", 10000, 0);
+	Journal.maxage = performance->getDuration("journalage", 3600, 60);
 	PingWarnTime = options->getDuration("pingwarning");
 	PingFreq = options->getDuration("serverpingfreq");
 
@@ -260,6 +300,7 @@ void SpanningTreeUtilities::ReadConfiguration()
 		L->HiddenFromStats = tag->getBool("statshidden");
 		L->Timeout = tag->getDuration("timeout", 30);
 		L->Hook = tag->getString("ssl");
+		L->Compress = tag->getBool("compress", true);
 		L->Bind = tag->getString("bind");
 		L->Hidden = tag->getBool("hidden");
 
@@ -347,12 +388,37 @@ void SpanningTreeUtilities::SendChannelMessage(const std::string& prefix, Channe
 		msg.push_raw(status);
 	msg.push_raw(target->name).push_last(text);
 
-	TreeSocketSet list;
-	this->GetListOfServersForChannel(target, list, status, exempt_list);
-	for (TreeSocketSet::iterator i = list.begin(); i != list.end(); ++i)
+	TreeLine line(msg.str());
+	if (status != 0)
 	{
-		TreeSocket* Sock = *i;
-		if (Sock != omit)
-			Sock->WriteLine(msg);
+		// Messages to members with a prefix are rare, find the servers of those members every time
+		TreeSocketSet list;
+		this->GetListOfServersForChannel(target, list, status, exempt_list);
+		for (TreeSocketSet::iterator i = list.begin(); i != list.end(); ++i)
+		{
+			TreeSocket* Sock = *i;
+			if (Sock != omit)
+				Sock->WriteLine(line);
+		}
+		return;
+	}
+
+	// Find the servers of exempt remote members, a server is skipped if all members behind it are exempt
+	std::vector<TreeSocket*> exemptsocks;
+	for (CUList::const_iterator i = exempt_list.begin(); i != exempt_list.end(); ++i)
+	{
+		User* const user = *i;
+		if ((!IS_LOCAL(user)) && (target->HasUser(user)))
+			exemptsocks.push_back(TreeServer::Get(user)->GetSocket());
+	}
+
+	const ChannelRoutes::RouteList& routes = GetChannelRoutes(target);
+	for (ChannelRoutes::RouteList::const_iterator i = routes.begin(); i != routes.end(); ++i)
+	{
+		TreeSocket* const Sock = i->first;
+		if ((Sock == omit) || ((size_t)std::count(exemptsocks.begin(), exemptsocks.end(), Sock) >= i->second))
+			continue;
+
+		Sock->WriteLine(line);
 	}
 }
@@ -24,6 +24,7 @@
 
 #include "inspircd.h"
 #include "cachetimer.h"
+#include "resync.h"
 
 class TreeServer;
 class TreeSocket;
@@ -39,6 +40,25 @@ extern SpanningTreeUtilities* Utils;
  */
 typedef TR1NS::unordered_map<std::string, TreeServer*, irc::insensitive, irc::StrHashComp> server_hash;
 
+/** Directly linked servers a channel has members behind, cached per channel.
+ * The cache is dropped when a remote user joins or leaves the channel, and rebuilt if the
+ * member count changed since it was built, which catches members removed after the hooks ran.
+ */
+struct ChannelRoutes
+{
+	/** A directly linked server and the number of members of the channel behind it
+	 */
+	typedef std::vector<std::pair<TreeSocket*, unsigned int> > RouteList;
+
+	/** Servers the channel has members behind
+	 */
+	RouteList routes;
+
+	/** Member count of the channel when the cache was built
+	 */
+	long membercount;
+};
+
 /** Contains helper functions and variables for this module,
  * and keeps them out of the global namespace
  */
@@ -72,6 +92,22 @@ class SpanningTreeUtilities : public classbase
 	 */
 	bool quiet_bursts;
 
+	/** Number of bytes of a netburst that are generated ahead of what the socket has written
+	 */
+	unsigned long BurstBuffer;
+
+	/** Maximum number of milliseconds spent generating a netburst in one main loop iteration
+	 */
+	unsigned int BurstTimeSlice;
+
+	/** Maximum number of bytes held back while a netburst is being sent, the link is closed if there are more
+	 */
+	unsigned long BurstDeferLimit;
+
+	/** X-line changes replayed to servers relinking after a short split
+	 */
+	ResyncJournal Journal;
+
 	/* Number of seconds that a server can go without ping
 	 * before opers are warned of high latency.
 	 */
@@ -140,6 +176,12 @@ class SpanningTreeUtilities : public classbase
 	 */
 	void GetListOfServersForChannel(Channel* c, TreeSocketSet& list, char status, const CUList& exempt_list);
 
+	/** Get the directly linked servers a channel has members behind, from the cache if it is up to date
+	 * @param c Channel to get the servers of
+	 * @return Servers with the number of members of the channel behind each
+	 */
+	const ChannelRoutes::RouteList& GetChannelRoutes(Channel* c);
+
 	/** Find a server by name or SID
 	 */
 	TreeServer* FindServer(const std::string &ServerName);
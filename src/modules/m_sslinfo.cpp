@@ -37,6 +37,8 @@ class SSLCertExt : public ExtensionItem {
 		ssl_cert* old = static_cast<ssl_cert*>(set_raw(item, value));
 		if (old && old->refcount_dec())
 			delete old;
+		// The fingerprint extban matches against this, so ban verdicts cached for the user are stale
+		static_cast<User*>(item)->InvalidateCache();
 	}
 
 	std::string serialize(SerializeFormat format, const Extensible* container, void* item) const
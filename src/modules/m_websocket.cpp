@@ -16,23 +16,330 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/// $CompilerFlags: require_version("zlib" "1.0") find_compiler_flags("zlib" "") -DHAS_ZLIB
+/// $LinkerFlags: require_version("zlib" "1.0") find_linker_flags("zlib" "-lz")
+
+/// $PackageInfo: require_system("centos") zlib-devel pkgconfig
+/// $PackageInfo: require_system("darwin") pkg-config
+/// $PackageInfo: require_system("debian") zlib1g-dev pkg-config
+/// $PackageInfo: require_system("ubuntu") zlib1g-dev pkg-config
 
 #include "inspircd.h"
 #include "iohook.h"
 #include "modules/hash.h"
+#include "modules/websocket.h"
+
+#ifdef HAS_ZLIB
+# include <zlib.h>
+#endif
 
 static const char MagicGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 static const char whitespace[] = " \t\r\n";
 static dynamic_reference_nocheck<HashProvider>* sha1;
 
+#ifdef HAS_ZLIB
+/** Settings of the permessage-deflate extension (RFC 7692), read from the <websocket> tag
+ */
+struct WebSocketConfig
+{
+	/** True if the permessage-deflate extension is accepted when clients offer it
+	 */
+	bool compress;
+
+	/** zlib compression level, 1-9
+	 */
+	int level;
+
+	/** zlib memory level used when compressing, 1-9
+	 */
+	int memlevel;
+
+	/** Base 2 logarithm of the largest window we compress with
+	 */
+	unsigned int windowbits;
+
+	/** Base 2 logarithm of the largest window clients are asked to compress with, if they allow it
+	 */
+	unsigned int clientwindowbits;
+
+	/** True to keep the compression context of a connection between messages. If false every line
+	 * is compressed on its own and the frame is shared by all recipients of the same line.
+	 */
+	bool contexttakeover;
+
+	WebSocketConfig()
+		: compress(false)
+		, level(Z_DEFAULT_COMPRESSION)
+		, memlevel(8)
+		, windowbits(15)
+		, clientwindowbits(15)
+		, contexttakeover(true)
+	{
+	}
+};
+
+/** Raw deflate (RFC 1951) stream compressing outgoing messages
+ */
+class Deflater
+{
+	z_stream zs;
+	bool initialized;
+
+ public:
+	Deflater()
+		: initialized(false)
+	{
+		memset(&zs, 0, sizeof(zs));
+	}
+
+	~Deflater()
+	{
+		if (initialized)
+			deflateEnd(&zs);
+	}
+
+	/** Initialize the stream
+	 * @param level Compression level
+	 * @param windowbits Base 2 logarithm of the window size, 9-15
+	 * @param memlevel Memory level
+	 * @return True if the stream is usable, false on error
+	 */
+	bool Init(int level, unsigned int windowbits, int memlevel)
+	{
+		// A negative window size tells zlib to omit the zlib header and trailer
+		initialized = (deflateInit2(&zs, level, Z_DEFLATED, -static_cast<int>(windowbits), memlevel, Z_DEFAULT_STRATEGY) == Z_OK);
+		return initialized;
+	}
+
+	/** Forget the compression context, the next message will not refer to earlier ones
+	 */
+	void Reset()
+	{
+		deflateReset(&zs);
+	}
+
+	/** Compress data and append the output to a string
+	 * @param data Data to compress
+	 * @param len Length of the data
+	 * @param flush Z_NO_FLUSH to buffer the output, Z_SYNC_FLUSH to complete the message
+	 * @param out String to append the compressed data to
+	 */
+	void Compress(const char* data, size_t len, int flush, std::string& out)
+	{
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		zs.avail_in = len;
+		const size_t chunksize = std::max<size_t>(len / 2, 1024);
+		do
+		{
+			const size_t oldlen = out.length();
+			out.resize(oldlen + chunksize);
+			zs.next_out = reinterpret_cast<Bytef*>(&out[oldlen]);
+			zs.avail_out = chunksize;
+			deflate(&zs, flush);
+			out.resize(oldlen + chunksize - zs.avail_out);
+		}
+		while (zs.avail_out == 0);
+	}
+
+	/** Remove the empty block ending every message completed with Z_SYNC_FLUSH as required by RFC 7692
+	 * @param out Compressed message
+	 */
+	static void StripFlushMarker(std::string& out)
+	{
+		if ((out.length() >= 4) && (out.compare(out.length() - 4, 4, "\x00\x00\xff\xff", 4) == 0))
+			out.erase(out.length() - 4);
+	}
+};
+
+/** Raw deflate (RFC 1951) stream decompressing incoming messages
+ */
+class Inflater
+{
+	z_stream zs;
+	bool initialized;
+
+ public:
+	Inflater()
+		: initialized(false)
+	{
+		memset(&zs, 0, sizeof(zs));
+	}
+
+	~Inflater()
+	{
+		if (initialized)
+			inflateEnd(&zs);
+	}
+
+	/** Initialize the stream
+	 * @param windowbits Base 2 logarithm of the largest window the peer compresses with, 8-15
+	 * @return True if the stream is usable, false on error
+	 */
+	bool Init(unsigned int windowbits)
+	{
+		initialized = (inflateInit2(&zs, -static_cast<int>(windowbits)) == Z_OK);
+		return initialized;
+	}
+
+	/** Decompress data and append the output to a string
+	 * @param data Data to decompress
+	 * @param len Length of the data
+	 * @param out String to append the decompressed data to
+	 * @param maxout Maximum number of bytes to append
+	 * @return Number of bytes appended, -1 if the data is invalid or decompresses to more than maxout bytes
+	 */
+	long Decompress(const char* data, size_t len, std::string& out, size_t maxout)
+	{
+		static const size_t chunksize = 4096;
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		zs.avail_in = len;
+		size_t produced = 0;
+		while (true)
+		{
+			const size_t oldlen = out.length();
+			out.resize(oldlen + chunksize);
+			zs.next_out = reinterpret_cast<Bytef*>(&out[oldlen]);
+			zs.avail_out = chunksize;
+			const int ret = inflate(&zs, Z_SYNC_FLUSH);
+			out.resize(oldlen + chunksize - zs.avail_out);
+			produced += chunksize - zs.avail_out;
+			if (produced > maxout)
+				return -1;
+
+			if (ret == Z_STREAM_END)
+			{
+				// The peer ended the stream with a final block, the next message starts a new one
+				inflateReset(&zs);
+				if (zs.avail_in == 0)
+					break;
+				continue;
+			}
+
+			if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+				return -1;
+
+			// Everything was decompressed if zlib did not fill the output buffer
+			if (zs.avail_out != 0)
+				break;
+		}
+		return produced;
+	}
+};
+#endif
+
 class WebSocketHookProvider : public IOHookProvider
 {
+#ifdef HAS_ZLIB
+	/** A line compressed into a complete frame, shared by all connections without context takeover
+	 */
+	struct CachedFrame
+	{
+		StreamSocket::SendQueue::Element line;
+		unsigned int windowbits;
+		StreamSocket::SendQueue::Element frame;
+	};
+
+	/** Number of recently sent lines whose frame is kept
+	 */
+	static const size_t MAXCACHEDFRAMES = 32;
+
+	WebSocketConfig config;
+
+	/** Frames of recently sent lines, most recent first
+	 */
+	std::deque<CachedFrame> framecache;
+
+	/** Deflaters compressing lines on their own, indexed by window bits and created on first use
+	 */
+	Deflater* shareddeflaters[16];
+
+	void ClearShared()
+	{
+		framecache.clear();
+		for (size_t i = 0; i < sizeof(shareddeflaters) / sizeof(shareddeflaters[0]); i++)
+		{
+			delete shareddeflaters[i];
+			shareddeflaters[i] = NULL;
+		}
+	}
+#endif
+
  public:
 	WebSocketHookProvider(Module* mod)
 		: IOHookProvider(mod, "websocket", IOHookProvider::IOH_UNKNOWN, true)
 	{
+#ifdef HAS_ZLIB
+		for (size_t i = 0; i < sizeof(shareddeflaters) / sizeof(shareddeflaters[0]); i++)
+			shareddeflaters[i] = NULL;
+#endif
+	}
+
+#ifdef HAS_ZLIB
+	~WebSocketHookProvider()
+	{
+		ClearShared();
+	}
+
+	const WebSocketConfig& GetConfig() const { return config; }
+
+	void SetConfig(const WebSocketConfig& newconfig)
+	{
+		// Frames and deflaters built with the old settings can't be reused
+		ClearShared();
+		config = newconfig;
 	}
 
+	/** Find the frame built earlier for a line
+	 * @param line Line to find the frame of
+	 * @param windowbits Window size the frame has to be compressed with
+	 * @return Frame of the line or NULL if it is not cached
+	 */
+	const StreamSocket::SendQueue::Element* FindFrame(const StreamSocket::SendQueue::Element& line, unsigned int windowbits) const
+	{
+		for (std::deque<CachedFrame>::const_iterator i = framecache.begin(); i != framecache.end(); ++i)
+		{
+			if ((i->windowbits == windowbits) && (i->line.SameData(line)))
+				return &i->frame;
+		}
+		return NULL;
+	}
+
+	/** Remember the frame of a line so other connections can send it without compressing it again
+	 * @param line Line the frame was built of
+	 * @param windowbits Window size the frame was compressed with
+	 * @param frame Complete frame including the header
+	 */
+	void AddFrame(const StreamSocket::SendQueue::Element& line, unsigned int windowbits, const StreamSocket::SendQueue::Element& frame)
+	{
+		CachedFrame entry;
+		entry.line = line;
+		entry.windowbits = windowbits;
+		entry.frame = frame;
+		framecache.push_front(entry);
+		if (framecache.size() > MAXCACHEDFRAMES)
+			framecache.pop_back();
+	}
+
+	/** Get the deflater compressing lines without context takeover
+	 * @param windowbits Window size to compress with
+	 * @return Deflater or NULL if it could not be initialized
+	 */
+	Deflater* GetSharedDeflater(unsigned int windowbits)
+	{
+		Deflater*& deflater = shareddeflaters[windowbits];
+		if (!deflater)
+		{
+			deflater = new Deflater;
+			if (!deflater->Init(config.level, windowbits, config.memlevel))
+			{
+				delete deflater;
+				deflater = NULL;
+			}
+		}
+		return deflater;
+	}
+#endif
+
 	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE;
 
 	void OnConnect(StreamSocket* sock) CXX11_OVERRIDE
@@ -70,6 +377,12 @@ class WebSocketHook : public IOHookMiddle
 		{
 			return std::string(req, bpos, len);
 		}
+
+		std::string ExtractLine(const std::string& req) const
+		{
+			const std::string::size_type epos = req.find_first_of("\r\n", bpos);
+			return std::string(req, bpos, epos - bpos);
+		}
 	};
 
 	enum OpCode
@@ -90,6 +403,9 @@ class WebSocketHook : public IOHookMiddle
 
 	static const unsigned char WS_MASKBIT = (1 << 7);
 	static const unsigned char WS_FINBIT = (1 << 7);
+	static const unsigned char WS_RSV1BIT = (1 << 6);
+	static const unsigned char WS_RSVBITS = (1 << 6) | (1 << 5) | (1 << 4);
+	static const unsigned char WS_OPCODEBITS = 0x0f;
 	static const unsigned char WS_PAYLOAD_LENGTH_MAGIC_LARGE = 126;
 	static const unsigned char WS_PAYLOAD_LENGTH_MAGIC_HUGE = 127;
 	static const size_t WS_MAX_PAYLOAD_LENGTH_SMALL = 125;
@@ -99,13 +415,46 @@ class WebSocketHook : public IOHookMiddle
 	// Clients sending ping or pong frames faster than this are killed
 	static const time_t MINPINGPONGDELAY = 10;
 
+#ifdef HAS_ZLIB
+	// Compressed messages decompressing to more than this are rejected
+	static const size_t MAXINFLATEDSIZE = WS_MAX_PAYLOAD_LENGTH_LARGE;
+#endif
+
 	State state;
 	time_t lastpingpong;
 
-	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode)
+	/** True if the permessage-deflate extension was negotiated, never set if zlib was not available at build time
+	 */
+	bool permessagedeflate;
+
+#ifdef HAS_ZLIB
+	/** True if our compression context is kept between messages, false if every line is compressed on its own
+	 */
+	bool contexttakeover;
+
+	/** Base 2 logarithm of the window sizes negotiated for our and the client's compressor
+	 */
+	unsigned int serverwindowbits;
+	unsigned int clientwindowbits;
+
+	/** Compression and decompression contexts of the connection, created on first use
+	 */
+	Deflater* deflater;
+	Inflater* inflater;
+
+	/** True if the data message being received is compressed
+	 */
+	bool compressedmsg;
+
+	/** Number of bytes the message being received decompressed to so far
+	 */
+	size_t inflatedsize;
+#endif
+
+	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode, bool compressed = false)
 	{
 		size_t pos = 0;
-		outbuf[pos++] = WS_FINBIT | opcode;
+		outbuf[pos++] = WS_FINBIT | (compressed ? WS_RSV1BIT : 0) | opcode;
 
 		if (sendlength <= WS_MAX_PAYLOAD_LENGTH_SMALL)
 		{
@@ -128,23 +477,254 @@ class WebSocketHook : public IOHookMiddle
 		return pos;
 	}
 
-	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode)
+	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode, bool compressed = false)
 	{
 		unsigned char header[MAXHEADERSIZE];
-		const size_t n = FillHeader(header, size, opcode);
+		const size_t n = FillHeader(header, size, opcode, compressed);
 
 		return StreamSocket::SendQueue::Element(reinterpret_cast<const char*>(header), n);
 	}
 
-	int HandleAppData(StreamSocket* sock, std::string& appdataout, bool allowlarge)
+#ifdef HAS_ZLIB
+	WebSocketHookProvider* GetProvider() const
+	{
+		IOHookProvider* hookprov = prov;
+		return static_cast<WebSocketHookProvider*>(hookprov);
+	}
+
+	/** Build a complete frame for a line, compressed on its own if that makes it smaller
+	 * @param line Line to send
+	 * @return Frame holding the line
+	 */
+	StreamSocket::SendQueue::Element PrepareLineFrame(const StreamSocket::SendQueue::Element& line)
+	{
+		std::string payload;
+		Deflater* const shareddeflater = GetProvider()->GetSharedDeflater(serverwindowbits);
+		if (shareddeflater)
+		{
+			shareddeflater->Compress(line.data(), line.length(), Z_SYNC_FLUSH, payload);
+			shareddeflater->Reset();
+			Deflater::StripFlushMarker(payload);
+		}
+
+		// Messages may be sent uncompressed when compressing doesn't pay off
+		const bool compressed = ((shareddeflater) && (payload.length() < line.length()));
+		if (!compressed)
+			payload.assign(line.data(), line.length());
+
+		unsigned char header[MAXHEADERSIZE];
+		const size_t headerlen = FillHeader(header, payload.length(), OP_BINARY, compressed);
+		payload.insert(0, reinterpret_cast<const char*>(header), headerlen);
+		return StreamSocket::SendQueue::Element::Take(payload);
+	}
+
+	/** Send every line in a sendq as a separate message compressed without context takeover.
+	 * Frames are cached by the provider so a line sent to many connections is only compressed once.
+	 * @param uppersendq SendQ of the layer above, emptied
+	 */
+	void SendSharedFrames(StreamSocket::SendQueue& uppersendq)
+	{
+		StreamSocket::SendQueue& mysendq = GetSendQ();
+		WebSocketHookProvider* const provider = GetProvider();
+		for (StreamSocket::SendQueue::const_iterator i = uppersendq.begin(); i != uppersendq.end(); ++i)
+		{
+			const StreamSocket::SendQueue::Element* const cached = provider->FindFrame(*i, serverwindowbits);
+			if (cached)
+			{
+				mysendq.push_back(*cached);
+				continue;
+			}
+
+			const StreamSocket::SendQueue::Element frame = PrepareLineFrame(*i);
+			provider->AddFrame(*i, serverwindowbits, frame);
+			mysendq.push_back(frame);
+		}
+		uppersendq.clear();
+	}
+
+	/** Send the contents of a sendq as a single message compressed with the context of the connection
+	 * @param sock Socket to send the message on
+	 * @param uppersendq SendQ of the layer above, emptied
+	 * @return True on success, false if the compressor could not be initialized
+	 */
+	bool SendCompressedMessage(StreamSocket* sock, StreamSocket::SendQueue& uppersendq)
+	{
+		if (!deflater)
+		{
+			const WebSocketConfig& config = GetProvider()->GetConfig();
+			deflater = new Deflater;
+			if (!deflater->Init(config.level, serverwindowbits, config.memlevel))
+			{
+				sock->SetError("WebSocket: Unable to initialize compression");
+				return false;
+			}
+		}
+
+		std::string compressed;
+		for (StreamSocket::SendQueue::const_iterator i = uppersendq.begin(); i != uppersendq.end(); ++i)
+			deflater->Compress(i->data(), i->length(), Z_NO_FLUSH, compressed);
+		deflater->Compress(NULL, 0, Z_SYNC_FLUSH, compressed);
+		Deflater::StripFlushMarker(compressed);
+
+		StreamSocket::SendQueue& mysendq = GetSendQ();
+		mysendq.push_back(PrepareSendQElem(compressed.length(), OP_BINARY, true));
+		mysendq.push_back(StreamSocket::SendQueue::Element::Take(compressed));
+		uppersendq.clear();
+		return true;
+	}
+
+	/** Decompress (part of) the payload of a compressed message
+	 * @param sock Socket the message was received on
+	 * @param data Compressed data
+	 * @param len Length of the data
+	 * @param destrecvq Recvq of the layer above to append the decompressed data to
+	 * @return True on success, false on error
+	 */
+	bool InflatePayload(StreamSocket* sock, const char* data, size_t len, std::string& destrecvq)
+	{
+		if (!inflater)
+		{
+			inflater = new Inflater;
+			if (!inflater->Init(clientwindowbits))
+			{
+				sock->SetError("WebSocket: Unable to initialize decompression");
+				return false;
+			}
+		}
+
+		const long ret = inflater->Decompress(data, len, destrecvq, MAXINFLATEDSIZE - inflatedsize);
+		if (ret < 0)
+		{
+			sock->SetError("WebSocket: Invalid or too large compressed message");
+			return false;
+		}
+
+		inflatedsize += ret;
+		return true;
+	}
+
+	static std::string TrimWhitespace(const std::string& str)
+	{
+		const std::string::size_type bpos = str.find_first_not_of(whitespace);
+		if (bpos == std::string::npos)
+			return std::string();
+		const std::string::size_type epos = str.find_last_not_of(whitespace);
+		return str.substr(bpos, epos - bpos + 1);
+	}
+
+	/** Parse a window bits extension parameter
+	 * @param value Value of the parameter, may be quoted
+	 * @return Window bits or 0 if the value is invalid
+	 */
+	static unsigned int ParseWindowBits(std::string value)
+	{
+		if ((value.length() > 2) && (value[0] == '"') && (value[value.length()-1] == '"'))
+			value = value.substr(1, value.length() - 2);
+		if ((value.empty()) || (value.find_first_not_of("0123456789") != std::string::npos))
+			return 0;
+
+		const unsigned int bits = ConvToInt(value);
+		return (((bits >= 8) && (bits <= 15)) ? bits : 0);
+	}
+
+	/** Accept the first permessage-deflate offer of a client we can satisfy
+	 * @param offers Value of the Sec-WebSocket-Extensions header sent by the client
+	 * @param response Set to the accepted extension and its parameters
+	 * @return True if an offer was accepted, false if none was acceptable
+	 */
+	bool NegotiateDeflate(const std::string& offers, std::string& response)
+	{
+		const WebSocketConfig& config = GetProvider()->GetConfig();
+		irc::commasepstream offerstream(offers);
+		for (std::string offer; offerstream.GetToken(offer); )
+		{
+			irc::sepstream paramstream(offer, ';');
+			std::string param;
+			if ((!paramstream.GetToken(param)) || (TrimWhitespace(param) != "permessage-deflate"))
+				continue;
+
+			bool valid = true;
+			bool servernocontext = false;
+			bool clientbitsallowed = false;
+			unsigned int serverbits = config.windowbits;
+			unsigned int clientbits = 15;
+			while ((valid) && (paramstream.GetToken(param)))
+			{
+				param = TrimWhitespace(param);
+				std::string value;
+				const std::string::size_type eqpos = param.find('=');
+				if (eqpos != std::string::npos)
+				{
+					value = TrimWhitespace(param.substr(eqpos + 1));
+					param = TrimWhitespace(param.substr(0, eqpos));
+				}
+
+				if ((param == "server_no_context_takeover") && (value.empty()))
+					servernocontext = true;
+				else if ((param == "client_no_context_takeover") && (value.empty()))
+					continue;
+				else if (param == "server_max_window_bits")
+				{
+					// zlib can't produce raw deflate streams with a window of 256 bytes
+					const unsigned int bits = ParseWindowBits(value);
+					valid = (bits >= 9);
+					serverbits = std::min(serverbits, bits);
+				}
+				else if (param == "client_max_window_bits")
+				{
+					clientbitsallowed = true;
+					if (!value.empty())
+					{
+						clientbits = ParseWindowBits(value);
+						valid = (clientbits != 0);
+					}
+				}
+				else
+					valid = false;
+			}
+
+			if (!valid)
+				continue;
+
+			if (clientbitsallowed)
+				clientbits = std::min(clientbits, config.clientwindowbits);
+
+			permessagedeflate = true;
+			contexttakeover = ((config.contexttakeover) && (!servernocontext));
+			serverwindowbits = serverbits;
+			clientwindowbits = clientbits;
+
+			response = "permessage-deflate";
+			if (!contexttakeover)
+				response.append("; server_no_context_takeover");
+			if (serverwindowbits < 15)
+				response.append("; server_max_window_bits=").append(ConvToStr(serverwindowbits));
+			if ((clientbitsallowed) && (clientwindowbits < 15))
+				response.append("; client_max_window_bits=").append(ConvToStr(clientwindowbits));
+			return true;
+		}
+		return false;
+	}
+#endif
+
+	/** Parse a frame in the recvq and unmask its payload in place
+	 * @param sock Socket the frame was received on
+	 * @param allowlarge True to accept frames with a payload longer than 125 bytes
+	 * @param pos Position of the frame in the recvq, advanced past the frame if it was complete
+	 * @param payload Set to the unmasked payload inside the recvq, valid until the recvq is modified
+	 * @param payloadlen Set to the length of the payload
+	 * @return 1 if a frame was parsed, 0 if the frame is not complete yet, -1 on error
+	 */
+	int HandleAppData(StreamSocket* sock, bool allowlarge, std::string::size_type& pos, const char*& payload, size_t& payloadlen)
 	{
 		std::string& myrecvq = GetRecvQ();
+		const std::string::size_type available = myrecvq.length() - pos;
 		// Need 1 byte opcode, minimum 1 byte len, 4 bytes masking key
-		if (myrecvq.length() < 6)
+		if (available < 6)
 			return 0;
 
-		const std::string& cmyrecvq = myrecvq;
-		unsigned char len1 = (unsigned char)cmyrecvq[1];
+		const char* const frame = myrecvq.data() + pos;
+		unsigned char len1 = (unsigned char)frame[1];
 		if (!(len1 & WS_MASKBIT))
 		{
 			sock->SetError("WebSocket protocol violation: unmasked client frame");
@@ -156,7 +736,7 @@ class WebSocketHook : public IOHookMiddle
 		// Assume the length is a single byte, if not, update values later
 		unsigned int len = len1;
 		unsigned int payloadstartoffset = 6;
-		const unsigned char* maskkey = reinterpret_cast<const unsigned char*>(&cmyrecvq[2]);
+		unsigned int maskkeyoffset = 2;
 
 		if (len1 == WS_PAYLOAD_LENGTH_MAGIC_LARGE)
 		{
@@ -169,11 +749,11 @@ class WebSocketHook : public IOHookMiddle
 
 			// Large frame, has 2 bytes len after the magic byte indicating the length
 			// Need 1 byte opcode, 3 bytes len, 4 bytes masking key
-			if (myrecvq.length() < 8)
+			if (available < 8)
 				return 0;
 
-			unsigned char len2 = (unsigned char)cmyrecvq[2];
-			unsigned char len3 = (unsigned char)cmyrecvq[3];
+			unsigned char len2 = (unsigned char)frame[2];
+			unsigned char len3 = (unsigned char)frame[3];
 			len = (len2 << 8) | len3;
 
 			if (len <= WS_MAX_PAYLOAD_LENGTH_SMALL)
@@ -182,7 +762,7 @@ class WebSocketHook : public IOHookMiddle
 				return -1;
 			}
 
-			maskkey += 2;
+			maskkeyoffset += 2;
 			payloadstartoffset += 2;
 		}
 		else if (len1 == WS_PAYLOAD_LENGTH_MAGIC_HUGE)
@@ -191,23 +771,67 @@ class WebSocketHook : public IOHookMiddle
 			return -1;
 		}
 
-		if (myrecvq.length() < payloadstartoffset + len)
+		if (available < payloadstartoffset + len)
 			return 0;
 
-		unsigned int maskkeypos = 0;
-		const std::string::iterator endit = myrecvq.begin() + payloadstartoffset + len;
-		for (std::string::const_iterator i = myrecvq.begin() + payloadstartoffset; i != endit; ++i)
+		char* const data = &myrecvq[pos + payloadstartoffset];
+		WebSocket::UnmaskPayload(data, len, reinterpret_cast<const unsigned char*>(&myrecvq[pos + maskkeyoffset]));
+		payload = data;
+		payloadlen = len;
+
+		pos += payloadstartoffset + len;
+		return 1;
+	}
+
+	int HandleDataFrame(StreamSocket* sock, std::string& destrecvq, std::string::size_type& pos)
+	{
+		const unsigned char header = (unsigned char)GetRecvQ()[pos];
+		const unsigned char opcode = header & WS_OPCODEBITS;
+		if ((header & WS_RSV1BIT) && (opcode == OP_CONTINUATION))
+		{
+			sock->SetError("WebSocket protocol violation: compressed continuation frame");
+			return -1;
+		}
+
+		const char* payload;
+		size_t len;
+		const int result = HandleAppData(sock, true, pos, payload, len);
+		if (result <= 0)
+			return result;
+
+#ifdef HAS_ZLIB
+		// Continuation frames belong to the message started by the last text or binary frame
+		if (opcode != OP_CONTINUATION)
+			compressedmsg = (header & WS_RSV1BIT);
+
+		// The payload was unmasked inside our recvq, append it (or its decompressed form) to the recvq of the layer above
+		if (!compressedmsg)
 		{
-			const unsigned char c = (unsigned char)*i;
-			appdataout.push_back(c ^ maskkey[maskkeypos++]);
-			maskkeypos %= 4;
+			destrecvq.append(payload, len);
+			return 1;
 		}
 
-		myrecvq.erase(myrecvq.begin(), endit);
+		if (!InflatePayload(sock, payload, len, destrecvq))
+			return -1;
+
+		if (header & WS_FINBIT)
+		{
+			// Put back the empty block the client removed from the end of the message
+			static const char trailer[] = { '\x00', '\x00', '\xff', '\xff' };
+			if (!InflatePayload(sock, trailer, sizeof(trailer), destrecvq))
+				return -1;
+
+			compressedmsg = false;
+			inflatedsize = 0;
+		}
+#else
+		// The payload was unmasked inside our recvq, append it to the recvq of the layer above
+		destrecvq.append(payload, len);
+#endif
 		return 1;
 	}
 
-	int HandlePingPongFrame(StreamSocket* sock, bool isping)
+	int HandlePingPongFrame(StreamSocket* sock, bool isping, std::string::size_type& pos)
 	{
 		if (lastpingpong + MINPINGPONGDELAY >= ServerInstance->Time())
 		{
@@ -217,27 +841,36 @@ class WebSocketHook : public IOHookMiddle
 
 		lastpingpong = ServerInstance->Time();
 
-		std::string appdata;
-		const int result = HandleAppData(sock, appdata, false);
+		const char* appdata;
+		size_t len;
+		const int result = HandleAppData(sock, false, pos, appdata, len);
 		// If it's a pong stop here regardless of the result so we won't generate a reply
 		if ((result <= 0) || (!isping))
 			return result;
 
-		StreamSocket::SendQueue::Element elem = PrepareSendQElem(appdata.length(), OP_PONG);
-		elem.append(appdata);
-		GetSendQ().push_back(elem);
+		GetSendQ().push_back(PrepareSendQElem(len, OP_PONG));
+		if (len)
+			GetSendQ().push_back(StreamSocket::SendQueue::Element(appdata, len));
 
 		SocketEngine::ChangeEventMask(sock, FD_ADD_TRIAL_WRITE);
 		return 1;
 	}
 
-	int HandleWS(StreamSocket* sock, std::string& destrecvq)
+	int HandleWS(StreamSocket* sock, std::string& destrecvq, std::string::size_type& pos)
 	{
-		if (GetRecvQ().empty())
+		if (GetRecvQ().length() <= pos)
 			return 0;
 
-		unsigned char opcode = (unsigned char)GetRecvQ().c_str()[0];
-		opcode &= ~WS_FINBIT;
+		const unsigned char header = (unsigned char)GetRecvQ()[pos];
+		const unsigned char opcode = header & WS_OPCODEBITS;
+
+		// RSV1 marks compressed messages if permessage-deflate was negotiated, the other bits are never used
+		const unsigned char allowedrsvbits = (permessagedeflate ? WS_RSV1BIT : 0);
+		if ((header & WS_RSVBITS) & ~allowedrsvbits)
+		{
+			sock->SetError("WebSocket protocol violation: reserved bit set");
+			return -1;
+		}
 
 		switch (opcode)
 		{
@@ -245,19 +878,21 @@ class WebSocketHook : public IOHookMiddle
 			case OP_TEXT:
 			case OP_BINARY:
 			{
-				return HandleAppData(sock, destrecvq, true);
+				return HandleDataFrame(sock, destrecvq, pos);
 			}
 
 			case OP_PING:
-			{
-				return HandlePingPongFrame(sock, true);
-			}
-
 			case OP_PONG:
 			{
+				if (header & WS_RSV1BIT)
+				{
+					sock->SetError("WebSocket protocol violation: compressed control frame");
+					return -1;
+				}
+
 				// A pong frame may be sent unsolicited, so we have to handle it.
 				// It may carry application data which we need to remove from the recvq as well.
-				return HandlePingPongFrame(sock, false);
+				return HandlePingPongFrame(sock, (opcode == OP_PING), pos);
 			}
 
 			case OP_CLOSE:
@@ -307,7 +942,16 @@ class WebSocketHook : public IOHookMiddle
 		key.append(MagicGUID);
 
 		std::string reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
-		reply.append(BinToBase64((*sha1)->GenerateRaw(key), NULL, '=')).append("\r\n\r\n");
+		reply.append(BinToBase64((*sha1)->GenerateRaw(key), NULL, '=')).append("\r\n");
+
+#ifdef HAS_ZLIB
+		HTTPHeaderFinder extheader;
+		std::string extresponse;
+		if ((GetProvider()->GetConfig().compress) && (extheader.Find(recvq, "Sec-WebSocket-Extensions:", 25, reqend))
+			&& (NegotiateDeflate(extheader.ExtractLine(recvq), extresponse)))
+			reply.append("Sec-WebSocket-Extensions: ").append(extresponse).append("\r\n");
+#endif
+		reply.append("\r\n");
 		GetSendQ().push_back(StreamSocket::SendQueue::Element(reply));
 
 		SocketEngine::ChangeEventMask(sock, FD_ADD_TRIAL_WRITE);
@@ -322,10 +966,28 @@ class WebSocketHook : public IOHookMiddle
 		: IOHookMiddle(Prov)
 		, state(STATE_HTTPREQ)
 		, lastpingpong(0)
+		, permessagedeflate(false)
+#ifdef HAS_ZLIB
+		, contexttakeover(true)
+		, serverwindowbits(15)
+		, clientwindowbits(15)
+		, deflater(NULL)
+		, inflater(NULL)
+		, compressedmsg(false)
+		, inflatedsize(0)
+#endif
 	{
 		sock->AddIOHook(this);
 	}
 
+#ifdef HAS_ZLIB
+	~WebSocketHook()
+	{
+		delete deflater;
+		delete inflater;
+	}
+#endif
+
 	int OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) CXX11_OVERRIDE
 	{
 		StreamSocket::SendQueue& mysendq = GetSendQ();
@@ -334,12 +996,21 @@ class WebSocketHook : public IOHookMiddle
 		if (state != STATE_ESTABLISHED)
 			return (mysendq.empty() ? 0 : 1);
 
-		if (!uppersendq.empty())
+		if (uppersendq.empty())
+			return 1;
+
+		if (!permessagedeflate)
 		{
 			StreamSocket::SendQueue::Element elem = PrepareSendQElem(uppersendq.bytes(), OP_BINARY);
 			mysendq.push_back(elem);
 			mysendq.moveall(uppersendq);
 		}
+#ifdef HAS_ZLIB
+		else if (!contexttakeover)
+			SendSharedFrames(uppersendq);
+		else if (!SendCompressedMessage(sock, uppersendq))
+			return -1;
+#endif
 
 		return 1;
 	}
@@ -353,13 +1024,17 @@ class WebSocketHook : public IOHookMiddle
 				return httpret;
 		}
 
+		// Parse all complete frames first and remove them from the recvq in one go afterwards
+		std::string& myrecvq = GetRecvQ();
+		std::string::size_type pos = 0;
 		int wsret;
 		do
 		{
-			wsret = HandleWS(sock, destrecvq);
+			wsret = HandleWS(sock, destrecvq, pos);
 		}
-		while ((!GetRecvQ().empty()) && (wsret > 0));
+		while ((pos < myrecvq.length()) && (wsret > 0));
 
+		myrecvq.erase(0, pos);
 		return wsret;
 	}
 
@@ -386,6 +1061,25 @@ class ModuleWebSocket : public Module
 		sha1 = &hash;
 	}
 
+	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
+	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("websocket");
+
+#ifdef HAS_ZLIB
+		WebSocketConfig config;
+		config.compress = tag->getBool("compress");
+		config.level = tag->getInt("compresslevel", 6, 1, 9);
+		config.memlevel = tag->getInt("memlevel", 8, 1, 9);
+		config.windowbits = tag->getInt("windowbits", 15, 9, 15);
+		config.clientwindowbits = tag->getInt("clientwindowbits", 15, 8, 15);
+		config.contexttakeover = tag->getBool("contexttakeover", true);
+		hookprov->SetConfig(config);
+#else
+		if (tag->getBool("compress"))
+			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "WARNING: <websocket:compress> is enabled but this module was built without zlib, WebSocket messages will not be compressed");
+#endif
+	}
+
 	void OnCleanup(ExtensionItem::ExtensibleType type, Extensible* item) CXX11_OVERRIDE
 	{
 		if (type != ExtensionItem::EXT_USER)
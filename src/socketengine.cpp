@@ -44,6 +44,204 @@ size_t SocketEngine::MaxSetSize = 0;
  */
 SocketEngine::Statistics SocketEngine::stats;
 
+namespace
+{
+	/** Minimum number of pending writes for which the I/O threads are woken up
+	 */
+	const size_t MinThreadedWrites = 32;
+
+	/** Number of writes an I/O thread takes from the batch at once
+	 */
+	const size_t WritesPerChunk = 16;
+
+	/** A write of the send queue of a StreamSocket performed by an I/O thread
+	 */
+	struct ThreadedWrite
+	{
+		/** Socket whose send queue is written
+		 */
+		StreamSocket* sock;
+
+		/** File descriptor of the socket, the I/O threads don't touch the socket object
+		 */
+		int fd;
+
+		/** Index of the first buffer to write in IOThreadPool::iovecs
+		 */
+		size_t first;
+
+		/** Number of buffers to write
+		 */
+		int count;
+
+		/** Number of bytes in the buffers
+		 */
+		size_t total;
+
+		/** Return value of writev()
+		 */
+		int result;
+
+		/** Value of errno after writev()
+		 */
+		int errnum;
+	};
+
+	class IOThreadPool;
+
+	/** A thread that performs the writes of a batch handed out by the IOThreadPool
+	 */
+	class IOThread CXX11_FINAL : public QueuedThread
+	{
+		IOThreadPool& pool;
+
+		/** True if there is a batch this thread has not yet worked on, guarded by the queue lock
+		 */
+		bool pending;
+
+	 public:
+		IOThread(IOThreadPool& p)
+			: pool(p)
+			, pending(false)
+		{
+		}
+
+		void Run() CXX11_OVERRIDE;
+
+		/** Tell this thread that a new batch is ready
+		 */
+		void Notify()
+		{
+			LockQueue();
+			pending = true;
+			UnlockQueueWakeup();
+		}
+	};
+
+	/** Runs batches of writes on the I/O threads and the main thread.
+	 * While a batch is running the main thread does nothing else, so the
+	 * send queues the buffers belong to are not modified.
+	 */
+	class IOThreadPool
+	{
+		/** Guards next
+		 */
+		Mutex nextlock;
+
+		/** Index of the first write in the batch that has not yet been taken by a thread
+		 */
+		size_t next;
+
+		/** Guards running, signalled when the last I/O thread is done with the batch
+		 */
+		ThreadQueueData donequeue;
+
+		/** Number of I/O threads still working on the batch
+		 */
+		size_t running;
+
+	 public:
+		/** Running I/O threads
+		 */
+		std::vector<IOThread*> threads;
+
+		/** Number of I/O threads requested in the last SocketEngine::SetIOThreadCount() call
+		 */
+		unsigned int wanted;
+
+		/** Writes in the current batch
+		 */
+		std::vector<ThreadedWrite> writes;
+
+		/** Buffers of all writes in the current batch
+		 */
+		std::vector<SocketEngine::IOVector> iovecs;
+
+		IOThreadPool()
+			: next(0)
+			, running(0)
+			, wanted(0)
+		{
+		}
+
+		/** Perform writes from the current batch until all of them have been taken
+		 */
+		void Work()
+		{
+			while (true)
+			{
+				nextlock.Lock();
+				const size_t first = next;
+				next = std::min(next + WritesPerChunk, writes.size());
+				const size_t last = next;
+				nextlock.Unlock();
+
+				if (first == last)
+					break;
+
+				for (size_t i = first; i != last; ++i)
+				{
+					ThreadedWrite& tw = writes[i];
+					tw.result = writev(tw.fd, &iovecs[tw.first], tw.count);
+					tw.errnum = errno;
+				}
+			}
+		}
+
+		/** Called by an I/O thread after it ran out of writes in the current batch
+		 */
+		void Done()
+		{
+			donequeue.Lock();
+			if (--running == 0)
+				donequeue.Wakeup();
+			donequeue.Unlock();
+		}
+
+		/** Perform all writes in the current batch, returns when all of them are done
+		 */
+		void Run()
+		{
+			next = 0;
+			running = threads.size();
+			for (std::vector<IOThread*>::const_iterator i = threads.begin(); i != threads.end(); ++i)
+				(*i)->Notify();
+
+			// The main thread takes part in the work as well
+			Work();
+
+			donequeue.Lock();
+			while (running)
+				donequeue.Wait();
+			donequeue.Unlock();
+		}
+	};
+
+	IOThreadPool iopool;
+
+	void IOThread::Run()
+	{
+		LockQueue();
+		while (!GetExitFlag())
+		{
+			if (!pending)
+			{
+				WaitForQueue();
+				continue;
+			}
+
+			pending = false;
+			UnlockQueue();
+
+			pool.Work();
+			pool.Done();
+
+			LockQueue();
+		}
+		UnlockQueue();
+	}
+}
+
 EventHandler::EventHandler()
 {
 	fd = -1;
@@ -109,6 +307,9 @@ void SocketEngine::ChangeEventMask(EventHandler* eh, int change)
 
 void SocketEngine::DispatchTrialWrites()
 {
+	SetIOThreadCount(ServerInstance->Config->IOThreads);
+
+	std::vector<int> writers;
 	std::vector<int> working_list;
 	working_list.reserve(trials.size());
 	working_list.assign(trials.begin(), trials.end());
@@ -124,10 +325,127 @@ void SocketEngine::DispatchTrialWrites()
 		if ((mask & (FD_ADD_TRIAL_READ | FD_READ_WILL_BLOCK)) == FD_ADD_TRIAL_READ)
 			eh->OnEventHandlerRead();
 		if ((mask & (FD_ADD_TRIAL_WRITE | FD_WRITE_WILL_BLOCK)) == FD_ADD_TRIAL_WRITE)
+		{
+			// Writes of sockets are done after all other handlers ran so they can be given to the I/O threads
+			if ((!iopool.threads.empty()) && (eh->ToStreamSocket()))
+				writers.push_back(fd);
+			else
+				eh->OnEventHandlerWrite();
+		}
+	}
+
+	if (!writers.empty())
+		DispatchThreadedWrites(writers);
+}
+
+void SocketEngine::DispatchThreadedWrites(const std::vector<int>& writers)
+{
+	// Waking up the I/O threads is only worth it if there are enough writes to share between them
+	if (writers.size() < MinThreadedWrites)
+	{
+		for (std::vector<int>::const_iterator i = writers.begin(); i != writers.end(); ++i)
+		{
+			EventHandler* const eh = GetRef(*i);
+			if (eh)
+				eh->OnEventHandlerWrite();
+		}
+		return;
+	}
+
+	// Sockets which can't be written to by an I/O thread (e.g. because they have an IOHook) are
+	// handled first, no handler code may run while the I/O threads are using the send queues
+	std::vector<int> threaded;
+	threaded.reserve(writers.size());
+	for (std::vector<int>::const_iterator i = writers.begin(); i != writers.end(); ++i)
+	{
+		EventHandler* const eh = GetRef(*i);
+		if (!eh)
+			continue;
+
+		StreamSocket* const sock = eh->ToStreamSocket();
+		if ((sock) && (sock->CanWriteThreaded()))
+			threaded.push_back(*i);
+		else
+			eh->OnEventHandlerWrite();
+	}
+
+	// Collect the buffers to write. Sockets that changed while running the handlers above
+	// get a normal write event after the batch is done.
+	std::vector<int> late;
+	iopool.writes.clear();
+	iopool.iovecs.clear();
+	for (std::vector<int>::const_iterator i = threaded.begin(); i != threaded.end(); ++i)
+	{
+		EventHandler* const eh = GetRef(*i);
+		StreamSocket* const sock = (eh ? eh->ToStreamSocket() : NULL);
+		if ((!sock) || (!sock->CanWriteThreaded()))
+		{
+			late.push_back(*i);
+			continue;
+		}
+
+		ThreadedWrite tw;
+		tw.sock = sock;
+		tw.fd = *i;
+		tw.first = iopool.iovecs.size();
+		tw.count = sock->PrepareThreadedWrite(iopool.iovecs, tw.total);
+		iopool.writes.push_back(tw);
+	}
+
+	iopool.Run();
+
+	// Remove the written data from the send queues before calling any handler
+	for (std::vector<ThreadedWrite>::const_iterator i = iopool.writes.begin(); i != iopool.writes.end(); ++i)
+	{
+		stats.UpdateWriteCounters(i->result);
+		i->sock->FinishThreadedWrite(i->result, i->total, i->errnum);
+	}
+
+	for (std::vector<ThreadedWrite>::const_iterator i = iopool.writes.begin(); i != iopool.writes.end(); ++i)
+	{
+		if (GetRef(i->fd) == i->sock)
+			i->sock->CheckError(I_ERR_OTHER);
+	}
+
+	for (std::vector<int>::const_iterator i = late.begin(); i != late.end(); ++i)
+	{
+		EventHandler* const eh = GetRef(*i);
+		if (eh)
 			eh->OnEventHandlerWrite();
 	}
 }
 
+void SocketEngine::SetIOThreadCount(unsigned int count)
+{
+	if (count == iopool.wanted)
+		return;
+
+	iopool.wanted = count;
+	while (iopool.threads.size() > count)
+	{
+		IOThread* const thread = iopool.threads.back();
+		iopool.threads.pop_back();
+		ServerInstance->Threads.Stop(thread);
+		delete thread;
+	}
+
+	while (iopool.threads.size() < count)
+	{
+		IOThread* const thread = new IOThread(iopool);
+		try
+		{
+			ServerInstance->Threads.Start(thread);
+		}
+		catch (CoreException& ex)
+		{
+			ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "Unable to start I/O thread: %s", ex.GetReason().c_str());
+			delete thread;
+			break;
+		}
+		iopool.threads.push_back(thread);
+	}
+}
+
 bool SocketEngine::AddFdRef(EventHandler* eh)
 {
 	int fd = eh->GetFd();
@@ -307,6 +625,14 @@ int SocketEngine::Shutdown(int fd, int how)
 	return shutdown(fd, how);
 }
 
+void SocketEngine::UpdateStats(size_t len_in, size_t len_out)
+{
+	if (len_in)
+		stats.UpdateReadCounters(len_in);
+	if (len_out)
+		stats.UpdateWriteCounters(len_out);
+}
+
 void SocketEngine::Statistics::UpdateReadCounters(int len_in)
 {
 	CheckFlush();
@@ -0,0 +1,479 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "inspircd.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/** A specialisation of the SocketEngine class, designed to use the Linux io_uring interface
+ * as a readiness notification engine, like epoll.
+ * Readiness of file descriptors is monitored with one-shot poll requests. Requests
+ * are queued in the submission ring and submitted together with waiting for events,
+ * so a loop iteration needs a single system call no matter how many file descriptors
+ * had their event mask changed. No data goes through the ring, sockets still call
+ * recv() and writev() themselves when they are notified.
+ */
+namespace
+{
+	/** Poll state of a file descriptor
+	 */
+	struct PollState
+	{
+		/** Incremented every time a poll request is cancelled, completions of poll
+		 * requests from an older generation are ignored.
+		 */
+		uint32_t generation;
+
+		/** Events of the poll request currently in flight, 0 if there is none
+		 */
+		unsigned int armed;
+
+		PollState() : generation(1), armed(0) { }
+	};
+
+	/** Userdata of poll removal requests, completions with this userdata are ignored
+	 */
+	const uint64_t RemoveUserData = 0;
+
+	int EngineHandle;
+
+	/** Submission queue ring
+	 */
+	struct
+	{
+		unsigned int* head;
+		unsigned int* tail;
+		unsigned int mask;
+		unsigned int entries;
+		io_uring_sqe* sqes;
+		void* ring;
+		size_t ringsize;
+		size_t sqesize;
+	} sq;
+
+	/** Completion queue ring
+	 */
+	struct
+	{
+		unsigned int* head;
+		unsigned int* tail;
+		unsigned int mask;
+		io_uring_cqe* cqes;
+		void* ring;
+		size_t ringsize;
+	} cq;
+
+	/** Number of queued requests which have not been submitted yet
+	 */
+	unsigned int unsubmitted = 0;
+
+	/** Poll state of each file descriptor, indexed by the fd
+	 */
+	std::vector<PollState> polls;
+
+	/** Completions copied out of the completion queue by DispatchEvents()
+	 */
+	std::vector<io_uring_cqe> events;
+
+	/** Completions copied out of the completion queue to make room for new requests,
+	 * dispatched by the next DispatchEvents() call
+	 */
+	std::vector<io_uring_cqe> backlog;
+
+	int Enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t argsize)
+	{
+		return syscall(__NR_io_uring_enter, EngineHandle, to_submit, min_complete, flags, arg, argsize);
+	}
+
+	/** Submit all queued requests without waiting for completions
+	 */
+	void Submit()
+	{
+		int ret = Enter(unsubmitted, 0, 0, NULL, 0);
+		if (ret > 0)
+			unsubmitted -= ret;
+	}
+
+	/** Move the completions in the completion queue to the end of a vector
+	 * @param out Vector to append the completions to
+	 */
+	void CopyCompletions(std::vector<io_uring_cqe>& out)
+	{
+		unsigned int head = *cq.head;
+		const unsigned int tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+			out.push_back(cq.cqes[head & cq.mask]);
+		__atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+	}
+
+	/** Get a free submission queue entry, submitting the queued requests if the ring is full
+	 * @return Submission queue entry, zeroed out, or NULL if the kernel takes no more requests
+	 */
+	io_uring_sqe* GetSQE()
+	{
+		while (*sq.tail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE) >= sq.entries)
+		{
+			const int ret = Enter(unsubmitted, 0, 0, NULL, 0);
+			if (ret > 0)
+			{
+				unsubmitted -= ret;
+				continue;
+			}
+
+			if ((ret < 0) && (errno == EINTR))
+				continue;
+
+			// The kernel takes no new requests while the completion queue is full. Make room
+			// by moving the completions out of the ring, completions which did not fit into
+			// it are moved into the ring when we ask for events.
+			if ((ret < 0) && ((errno == EBUSY) || (errno == EAGAIN)))
+			{
+				const size_t oldsize = backlog.size();
+				Enter(0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+				CopyCompletions(backlog);
+				if (backlog.size() != oldsize)
+					continue;
+			}
+
+			ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "io_uring_enter failed to submit requests: %s", (ret < 0 ? strerror(errno) : "no request was taken"));
+			return NULL;
+		}
+
+		io_uring_sqe* sqe = &sq.sqes[*sq.tail & sq.mask];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	/** Make a queued submission queue entry visible to the kernel
+	 */
+	void QueueSQE()
+	{
+		__atomic_store_n(sq.tail, *sq.tail + 1, __ATOMIC_RELEASE);
+		unsubmitted++;
+	}
+
+	uint64_t MakeUserData(int fd, uint32_t generation)
+	{
+		return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+	}
+
+	PollState& GetPollState(int fd)
+	{
+		if (static_cast<size_t>(fd) >= polls.size())
+			polls.resize(std::max<size_t>(fd + 1, polls.size() * 2));
+		return polls[fd];
+	}
+
+	/** Queue a one-shot poll request for a file descriptor
+	 * @param fd File descriptor to poll
+	 * @param ps Poll state of the file descriptor
+	 * @param pollevents Events to poll for
+	 * @return True if the request was queued, false if the submission queue is unusable
+	 */
+	bool Arm(int fd, PollState& ps, unsigned int pollevents)
+	{
+		io_uring_sqe* sqe = GetSQE();
+		if (!sqe)
+			return false;
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+		sqe->poll32_events = (pollevents << 16) | (pollevents >> 16);
+#else
+		sqe->poll32_events = pollevents;
+#endif
+		sqe->user_data = MakeUserData(fd, ps.generation);
+		QueueSQE();
+		ps.armed = pollevents;
+		return true;
+	}
+
+	/** Cancel the poll request of a file descriptor if it has one in flight
+	 * @param fd File descriptor
+	 * @param ps Poll state of the file descriptor
+	 */
+	void Disarm(int fd, PollState& ps)
+	{
+		if (!ps.armed)
+			return;
+
+		// If the request can't be cancelled its completion is still ignored because of the new generation
+		io_uring_sqe* sqe = GetSQE();
+		if (sqe)
+		{
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = MakeUserData(fd, ps.generation);
+			sqe->user_data = RemoveUserData;
+			QueueSQE();
+		}
+
+		ps.armed = 0;
+		if (++ps.generation == 0)
+			ps.generation = 1;
+	}
+}
+
+void SocketEngine::Init()
+{
+	LookupMaxFds();
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	EngineHandle = syscall(__NR_io_uring_setup, 4096, &params);
+	if (EngineHandle == -1)
+		InitError();
+
+	if (!(params.features & IORING_FEAT_EXT_ARG))
+	{
+		errno = ENOSYS;
+		InitError();
+	}
+
+	sq.ringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq.ringsize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sq.ringsize = cq.ringsize = std::max(sq.ringsize, cq.ringsize);
+
+	sq.ring = mmap(NULL, sq.ringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQ_RING);
+	if (sq.ring == MAP_FAILED)
+		InitError();
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		cq.ring = sq.ring;
+	else
+	{
+		cq.ring = mmap(NULL, cq.ringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_CQ_RING);
+		if (cq.ring == MAP_FAILED)
+			InitError();
+	}
+
+	sq.sqesize = params.sq_entries * sizeof(io_uring_sqe);
+	sq.sqes = static_cast<io_uring_sqe*>(mmap(NULL, sq.sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQES));
+	if (sq.sqes == MAP_FAILED)
+		InitError();
+
+	char* const sqring = static_cast<char*>(sq.ring);
+	sq.head = reinterpret_cast<unsigned int*>(sqring + params.sq_off.head);
+	sq.tail = reinterpret_cast<unsigned int*>(sqring + params.sq_off.tail);
+	sq.mask = *reinterpret_cast<unsigned int*>(sqring + params.sq_off.ring_mask);
+	sq.entries = *reinterpret_cast<unsigned int*>(sqring + params.sq_off.ring_entries);
+
+	// Submission queue entries are always used in order, so the index array never changes
+	unsigned int* const sqarray = reinterpret_cast<unsigned int*>(sqring + params.sq_off.array);
+	for (unsigned int i = 0; i < sq.entries; i++)
+		sqarray[i] = i;
+
+	char* const cqring = static_cast<char*>(cq.ring);
+	cq.head = reinterpret_cast<unsigned int*>(cqring + params.cq_off.head);
+	cq.tail = reinterpret_cast<unsigned int*>(cqring + params.cq_off.tail);
+	cq.mask = *reinterpret_cast<unsigned int*>(cqring + params.cq_off.ring_mask);
+	cq.cqes = reinterpret_cast<io_uring_cqe*>(cqring + params.cq_off.cqes);
+}
+
+void SocketEngine::RecoverFromFork()
+{
+}
+
+void SocketEngine::Deinit()
+{
+	munmap(sq.sqes, sq.sqesize);
+	if (cq.ring != sq.ring)
+		munmap(cq.ring, cq.ringsize);
+	munmap(sq.ring, sq.ringsize);
+	Close(EngineHandle);
+}
+
+static unsigned int mask_to_poll(int event_mask)
+{
+	unsigned int rv = 0;
+	if (event_mask & (FD_WANT_POLL_READ | FD_WANT_FAST_READ))
+		rv |= POLLIN;
+	if (event_mask & (FD_WANT_POLL_WRITE | FD_WANT_FAST_WRITE | FD_WANT_SINGLE_WRITE))
+		rv |= POLLOUT;
+	return rv;
+}
+
+bool SocketEngine::AddFd(EventHandler* eh, int event_mask)
+{
+	int fd = eh->GetFd();
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "AddFd out of range: (fd: %d)", fd);
+		return false;
+	}
+
+	if (!SocketEngine::AddFdRef(eh))
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to add duplicate fd: %d", fd);
+		return false;
+	}
+
+	PollState& ps = GetPollState(fd);
+	const unsigned int pollevents = mask_to_poll(event_mask);
+	if ((pollevents) && (!Arm(fd, ps, pollevents)))
+	{
+		SocketEngine::DelFdRef(eh);
+		return false;
+	}
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "New file descriptor: %d", fd);
+
+	eh->SetEventMask(event_mask);
+	return true;
+}
+
+void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
+{
+	const int fd = eh->GetFd();
+	PollState& ps = GetPollState(fd);
+	const unsigned int pollevents = mask_to_poll(new_mask);
+	if (ps.armed == pollevents)
+		return;
+
+	// Poll requests can't be modified, replace the one in flight (if any) with a new one
+	Disarm(fd, ps);
+	if ((pollevents) && (!Arm(fd, ps, pollevents)))
+		ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "Unable to poll file descriptor %d for events", fd);
+}
+
+void SocketEngine::DelFd(EventHandler* eh)
+{
+	int fd = eh->GetFd();
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "DelFd out of range: (fd: %d)", fd);
+		return;
+	}
+
+	Disarm(fd, GetPollState(fd));
+
+	// The removal has to reach the kernel before the fd is closed and possibly reused
+	Submit();
+
+	SocketEngine::DelFdRef(eh);
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Remove file descriptor: %d", fd);
+}
+
+int SocketEngine::DispatchEvents()
+{
+	// Submit all queued requests and wait for events in a single system call
+	struct __kernel_timespec ts;
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+	int ret = Enter(unsubmitted, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (ret > 0)
+		unsubmitted -= std::min<unsigned int>(ret, unsubmitted);
+	else if ((ret < 0) && (errno != ETIME) && (errno != EINTR) && (errno != EBUSY))
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring_enter failed: %s", strerror(errno));
+	ServerInstance->UpdateTime();
+
+	// Copy the completions out of the ring as handlers may queue new requests,
+	// completions moved out earlier to make room for requests come first
+	events.swap(backlog);
+	backlog.clear();
+	CopyCompletions(events);
+
+	int i = 0;
+	for (std::vector<io_uring_cqe>::const_iterator it = events.begin(); it != events.end(); ++it)
+	{
+		const io_uring_cqe& cqe = *it;
+		if (cqe.user_data == RemoveUserData)
+			continue;
+
+		// Ignore completions of poll requests that were replaced or removed
+		const int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+		const uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32);
+		if ((static_cast<size_t>(fd) >= polls.size()) || (polls[fd].generation != generation))
+			continue;
+
+		polls[fd].armed = 0;
+		EventHandler* const eh = GetRef(fd);
+		if (!eh)
+			continue;
+
+		i++;
+		if (cqe.res < 0)
+		{
+			stats.ErrorEvents++;
+			eh->OnEventHandlerError(-cqe.res);
+			continue;
+		}
+
+		const unsigned int revents = cqe.res;
+		if (revents & POLLHUP)
+		{
+			stats.ErrorEvents++;
+			eh->OnEventHandlerError(0);
+			continue;
+		}
+
+		if (revents & POLLERR)
+		{
+			stats.ErrorEvents++;
+			/* Get error number */
+			socklen_t codesize = sizeof(int);
+			int errcode;
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &codesize) < 0)
+				errcode = errno;
+			eh->OnEventHandlerError(errcode);
+			continue;
+		}
+
+		int mask = eh->GetEventMask();
+		if (revents & POLLIN)
+			mask &= ~FD_READ_WILL_BLOCK;
+		if (revents & POLLOUT)
+			mask &= ~(FD_WRITE_WILL_BLOCK | FD_WANT_SINGLE_WRITE);
+		eh->SetEventMask(mask);
+
+		if (revents & POLLIN)
+		{
+			eh->OnEventHandlerRead();
+			if (eh != GetRef(fd))
+				// whoa! we got deleted, better not give out the write event
+				continue;
+		}
+		if (revents & POLLOUT)
+		{
+			eh->OnEventHandlerWrite();
+			if (eh != GetRef(fd))
+				continue;
+		}
+
+		// The poll request was one-shot, ask for the next event unless the handler already did
+		PollState& ps = polls[fd];
+		const unsigned int pollevents = mask_to_poll(eh->GetEventMask());
+		if ((!ps.armed) && (pollevents) && (!Arm(fd, ps, pollevents)))
+			ServerInstance->Logs->Log("SOCKET", LOG_DEFAULT, "Unable to poll file descriptor %d for events", fd);
+	}
+
+	stats.TotalEvents += i;
+	return i;
+}
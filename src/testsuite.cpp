@@ -23,8 +23,14 @@
 
 #include "inspircd.h"
 #include "testsuite.h"
+#include "modules/websocket.h"
+#include <iomanip>
 #include <iostream>
 
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
 class TestSuiteThread : public Thread
 {
  public:
@@ -59,10 +65,15 @@ TestSuite::TestSuite()
 		std::cout << "(2) Load a module\n";
 		std::cout << "(3) Unload a module\n";
 		std::cout << "(4) Threading tests\n";
-		std::cout << "(5) Wildcard and CIDR tests\n";
+		std::cout << "(5) Wildcard and CIDR tests and benchmark\n";
 		std::cout << "(6) Comma sepstream tests\n";
 		std::cout << "(7) Space sepstream tests\n";
 		std::cout << "(8) UID generation tests\n";
+		std::cout << "(9) Command parser tests and benchmark\n";
+		std::cout << "(A) WebSocket unmasking tests and benchmark\n";
+		std::cout << "(B) Socket engine benchmark\n";
+		std::cout << "(C) Timer tests\n";
+		std::cout << "(D) User background check benchmark\n";
 
 		std::cout << std::endl << "(X) Exit test suite\n";
 
@@ -110,6 +121,21 @@ TestSuite::TestSuite()
 			case '8':
 				std::cout << (DoGenerateUIDTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
 				break;
+			case '9':
+				std::cout << (DoCommandParserTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'A':
+				std::cout << (DoWebSocketUnmaskTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'B':
+				std::cout << (DoSocketEngineBenchmark() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'C':
+				std::cout << (DoTimerTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'D':
+				std::cout << (DoUserTimerBenchmark() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
 			case 'X':
 				return;
 				break;
@@ -121,10 +147,93 @@ TestSuite::TestSuite()
 	}
 }
 
-/* Test that x matches y with match() */
-#define WCTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\") " << ((passed = (InspIRCd::Match(x, y, NULL))) ? " SUCCESS!\n" : " FAILURE\n")
-/* Test that x does not match y with match() */
-#define WCTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\") " << ((passed = ((!InspIRCd::Match(x, y, NULL)))) ? " SUCCESS!\n" : " FAILURE\n")
+namespace
+{
+	/** Time an old and a new implementation of the same work and print the time each of them takes per unit of work.
+	 * The implementations are function objects, each call does one iteration of the work.
+	 * @param oldname Name of the old implementation
+	 * @param oldimpl Old implementation
+	 * @param newname Name of the new implementation
+	 * @param newimpl New implementation
+	 * @param iterations Number of times each implementation is called
+	 * @param units Number of units of work done by one call
+	 * @param unit Name of a unit of work
+	 */
+	template <typename OldImpl, typename NewImpl>
+	void CompareImplementations(const std::string& oldname, OldImpl& oldimpl, const std::string& newname, NewImpl& newimpl, size_t iterations, size_t units, const char* unit)
+	{
+		clock_t start = clock();
+		for (size_t i = 0; i < iterations; i++)
+			oldimpl();
+		const double oldtime = double(clock() - start) / CLOCKS_PER_SEC;
+
+		start = clock();
+		for (size_t i = 0; i < iterations; i++)
+			newimpl();
+		const double newtime = double(clock() - start) / CLOCKS_PER_SEC;
+
+		const double total = double(iterations) * units;
+		const int width = std::max(oldname.length(), newname.length()) + 2;
+		std::cout << std::left << std::setw(width) << (oldname + ":") << std::right << oldtime * 1e9 / total << " ns per " << unit << "\n";
+		std::cout << std::left << std::setw(width) << (newname + ":") << std::right << newtime * 1e9 / total << " ns per " << unit << "\n";
+	}
+
+	/** Match strings against ban masks with InspIRCd::Match()
+	 */
+	class StringMatcher
+	{
+		const char* const* masks;
+		const char* const* strings;
+
+	 public:
+		size_t found;
+
+		StringMatcher(const char* const* matchmasks, const char* const* matchstrings)
+			: masks(matchmasks)
+			, strings(matchstrings)
+			, found(0)
+		{
+		}
+
+		void operator()()
+		{
+			for (const char* const* mask = masks; *mask; ++mask)
+				for (const char* const* str = strings; *str; ++str)
+					found += InspIRCd::Match(*str, *mask);
+		}
+	};
+
+	/** Match strings against ban masks compiled into WildcardMasks
+	 */
+	class CompiledMatcher
+	{
+		std::vector<WildcardMask> compiled;
+		const char* const* strings;
+
+	 public:
+		size_t found;
+
+		CompiledMatcher(const char* const* matchmasks, const char* const* matchstrings)
+			: strings(matchstrings)
+			, found(0)
+		{
+			for (const char* const* mask = matchmasks; *mask; ++mask)
+				compiled.push_back(WildcardMask(*mask));
+		}
+
+		void operator()()
+		{
+			for (std::vector<WildcardMask>::const_iterator mask = compiled.begin(); mask != compiled.end(); ++mask)
+				for (const char* const* str = strings; *str; ++str)
+					found += mask->Match(*str);
+		}
+	};
+}
+
+/* Test that x matches y with match() and with y compiled into a WildcardMask */
+#define WCTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\") " << ((passed = ((InspIRCd::Match(x, y, NULL)) && (WildcardMask(y).Match(x)))) ? " SUCCESS!\n" : " FAILURE\n")
+/* Test that x does not match y with match() or with y compiled into a WildcardMask */
+#define WCTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\") " << ((passed = ((!InspIRCd::Match(x, y, NULL)) && (!WildcardMask(y).Match(x)))) ? " SUCCESS!\n" : " FAILURE\n")
 
 /* Test that x matches y with match() and cidr enabled */
 #define CIDRTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\", true) " << ((passed = (InspIRCd::MatchCIDR(x, y, NULL))) ? " SUCCESS!\n" : " FAILURE\n")
@@ -159,6 +268,9 @@ bool TestSuite::DoWildTests()
 	WCTEST("test@foo.bar.test", "*@*.bar.test");
 	WCTEST("test@foo.bar.test", "*test*@*.bar.test");
 	WCTEST("test@foo.bar.test", "*@*test");
+	WCTEST("FooBar", "*oob?R");
+	WCTEST("nick!ident@Host.Example.COM", "*!*@*.example.com");
+	WCTEST("aXbXc", "*x*X*");
 
 	WCTEST("a", "*a");
 	WCTEST("aa", "*a");
@@ -187,6 +299,8 @@ bool TestSuite::DoWildTests()
 	WCTESTNOT("O", "OperServ");
 	WCTESTNOT("foobar.tst", "fo?bar.*g");
 	WCTESTNOT("foobar.test", "fo?bar.*tt");
+	WCTESTNOT("abcabd", "*abd*abd");
+	WCTESTNOT("nick!ident@host.example.org", "*!*@*.example.com");
 
 	CIDRTEST("brain@1.2.3.4", "*@1.2.0.0/16");
 	CIDRTEST("brain@1.2.3.4", "*@1.2.3.0/24");
@@ -200,7 +314,22 @@ bool TestSuite::DoWildTests()
 	CIDRTESTNOT("brain@1.2.3.4", "@");
 	CIDRTESTNOT("brain@1.2.3.4", "");
 
-	return true;
+	// Compare the cost of matching typical ban masks against typical hosts
+	const char* const masks[] = { "*!*@*.example.com", "*!*ident@*", "nick*!*@192.168.*", "*!*@*.a?.example.*", "*bad*word*", "*free*bitcoin*", NULL };
+	const char* const strings[] = { "nick!ident@host.example.com", "Someone!~user@192.168.12.34", "guest12345!~guest@cpe-12-34-56-78.isp.example.net",
+		"BadWordNick!ident@ab.example.org", "foo!bar@2001:db8::1",
+		"Hello everyone, does anybody know how to get the build working on a fresh install? I keep getting linker errors about missing symbols", NULL };
+
+	const unsigned int iterations = 200000;
+	const size_t matches = (sizeof(masks) / sizeof(*masks) - 1) * (sizeof(strings) / sizeof(*strings) - 1);
+	StringMatcher oldmatcher(masks, strings);
+	CompiledMatcher newmatcher(masks, strings);
+
+	std::cout << "\nMatching " << iterations * matches << " strings against ban masks:\n";
+	CompareImplementations("InspIRCd::Match", oldmatcher, "WildcardMask", newmatcher, iterations, matches, "match");
+	std::cout << oldmatcher.found << " and " << newmatcher.found << " matched\n";
+
+	return (oldmatcher.found == newmatcher.found);
 }
 
 
@@ -295,7 +424,7 @@ bool TestSuite::DoThreadTests()
 		std::cout << "Creation failed, test failure.\n";
 		return false;
 	}
-	std::cout << "Creation success, type " << te->GetName() << "\n";
+	std::cout << "Creation success\n";
 
 	std::cout << "Allocate: new TestSuiteThread...\n";
 	TestSuiteThread* tst = new TestSuiteThread();
@@ -394,6 +523,570 @@ bool TestSuite::DoGenerateUIDTests()
 	return true;
 }
 
+namespace
+{
+	/** Split a line the way the command parser used to, with irc::tokenstream
+	 */
+	void TokenStreamSplit(const std::string& line, std::string& command, std::vector<std::string>& params)
+	{
+		params.clear();
+		irc::tokenstream tokens(line);
+		std::string token;
+		tokens.GetToken(command);
+		if (command[0] == ':')
+			tokens.GetToken(command);
+		while (tokens.GetToken(token))
+			params.push_back(token);
+	}
+
+	/** Split a line and look up its command the way the command parser used to
+	 */
+	class TokenStreamParser
+	{
+		const std::string& line;
+		const CommandParser::CommandMap& cmdlist;
+		std::string command;
+		std::vector<std::string> params;
+
+	 public:
+		size_t found;
+
+		TokenStreamParser(const std::string& parseline)
+			: line(parseline)
+			, cmdlist(ServerInstance->Parser.GetCommands())
+			, found(0)
+		{
+		}
+
+		void operator()()
+		{
+			TokenStreamSplit(line, command, params);
+			std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+			found += (cmdlist.find(command) != cmdlist.end());
+		}
+	};
+
+	/** Split a line and look up its command with the functions of the command parser
+	 */
+	class SplitLineParser
+	{
+		const std::string& line;
+		std::string command;
+		std::vector<std::string> params;
+
+	 public:
+		size_t found;
+
+		SplitLineParser(const std::string& parseline)
+			: line(parseline)
+			, found(0)
+		{
+		}
+
+		void operator()()
+		{
+			CommandParser::SplitLine(line, command, params);
+			std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+			found += (ServerInstance->Parser.GetHandler(command) != NULL);
+		}
+	};
+}
+
+bool TestSuite::DoCommandParserTests()
+{
+	std::cout << "\n\nCommand parser tests\n\n";
+
+	const char* const lines[] = {
+		"PRIVMSG #chan :hello world",
+		"privmsg #chan hello",
+		":nick!user@host PRIVMSG #chan :with  two  spaces ",
+		"MODE #chan +ov  nick1 nick2",
+		"  PING   :",
+		":prefix :trailing command",
+		":prefix",
+		"   ",
+		"TOPIC #chan :",
+		"USER a b c :d: e :f",
+		NULL
+	};
+
+	bool passed = true;
+	std::string oldcommand, newcommand;
+	std::vector<std::string> oldparams, newparams;
+	for (const char* const* line = lines; *line; ++line)
+	{
+		TokenStreamSplit(*line, oldcommand, oldparams);
+		CommandParser::SplitLine(*line, newcommand, newparams);
+		const bool same = ((oldcommand == newcommand) && (oldparams == newparams));
+		std::cout << "SplitLine(\"" << *line << "\") " << (same ? "SUCCESS!\n" : "FAILURE\n");
+		passed &= same;
+	}
+
+	const char* const commands[] = { "PRIVMSG", "privmsg", "Join", "NOSUCHCOMMAND", NULL };
+	const CommandParser::CommandMap& cmdlist = ServerInstance->Parser.GetCommands();
+	for (const char* const* command = commands; *command; ++command)
+	{
+		CommandParser::CommandMap::const_iterator it = cmdlist.find(*command);
+		Command* const expected = (it != cmdlist.end() ? it->second : NULL);
+		const bool same = (ServerInstance->Parser.GetHandler(*command) == expected);
+		std::cout << "GetHandler(\"" << *command << "\") " << (same ? "SUCCESS!\n" : "FAILURE\n");
+		passed &= same;
+	}
+
+	// Compare the cost of splitting and looking up a typical PRIVMSG
+	const std::string privmsg = "PRIVMSG #channel :The quick brown fox jumps over the lazy dog";
+	const unsigned int iterations = 1000000;
+	TokenStreamParser oldparser(privmsg);
+	SplitLineParser newparser(privmsg);
+
+	std::cout << "\nParsing " << iterations << " PRIVMSG lines:\n";
+	CompareImplementations("irc::tokenstream and CommandMap", oldparser, "SplitLine and GetHandler", newparser, iterations, 1, "line");
+
+	return ((passed) && (oldparser.found == iterations) && (newparser.found == iterations));
+}
+
+namespace
+{
+	/** Unmask a payload one byte at a time, the way every frame was unmasked before blocks were used
+	 */
+	void UnmaskBytewise(char* data, size_t len, const unsigned char* maskkey)
+	{
+		for (size_t i = 0; i < len; i++)
+			data[i] ^= maskkey[i % 4];
+	}
+
+	/** Unmask the same payload with an unmasking function on every call
+	 */
+	template <void (*Unmask)(char*, size_t, const unsigned char*)>
+	class PayloadUnmasker
+	{
+		char* const data;
+		const size_t len;
+		const unsigned char* const maskkey;
+
+	 public:
+		PayloadUnmasker(char* payload, size_t payloadlen, const unsigned char* key)
+			: data(payload)
+			, len(payloadlen)
+			, maskkey(key)
+		{
+		}
+
+		void operator()()
+		{
+			Unmask(data, len, maskkey);
+		}
+	};
+}
+
+bool TestSuite::DoWebSocketUnmaskTests()
+{
+	std::cout << "\n\nWebSocket unmasking tests\n\n";
+
+	const unsigned char maskkey[4] = { 0x37, 0xfa, 0x21, 0x3d };
+	const size_t maxlen = 256;
+	const size_t maxoffset = 16;
+
+	// Every length up to and past a few SSE2 blocks, starting at every alignment within a block
+	bool passed = true;
+	std::vector<char> payload(maxlen + maxoffset);
+	for (size_t i = 0; i < payload.size(); i++)
+		payload[i] = static_cast<char>(i * 7 + 1);
+
+	for (size_t offset = 0; offset < maxoffset; offset++)
+	{
+		for (size_t len = 0; len <= maxlen; len++)
+		{
+			std::vector<char> expected(payload);
+			std::vector<char> unmasked(payload);
+			UnmaskBytewise(&expected[offset], len, maskkey);
+			WebSocket::UnmaskPayload(&unmasked[offset], len, maskkey);
+			if (expected != unmasked)
+			{
+				std::cout << "UnmaskPayload: FAILURE at offset " << offset << " length " << len << std::endl;
+				passed = false;
+			}
+		}
+	}
+	std::cout << "UnmaskPayload at " << maxoffset << " offsets and lengths 0 to " << maxlen << (passed ? " SUCCESS!\n" : " FAILURE\n");
+
+	// Compare the throughput on payloads of typical sizes, starting at an odd address
+	const size_t sizes[] = { 16, 512, 65536 };
+	const size_t total = 256 * 1024 * 1024;
+	std::vector<char> buffer(65536 + 1);
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+	{
+		const size_t size = sizes[s];
+		const size_t iterations = total / size;
+		PayloadUnmasker<UnmaskBytewise> oldunmasker(&buffer[1], size, maskkey);
+		PayloadUnmasker<WebSocket::UnmaskPayload> newunmasker(&buffer[1], size, maskkey);
+
+		std::cout << "\nUnmasking " << iterations << " payloads of " << size << " bytes:\n";
+		CompareImplementations("Byte at a time", oldunmasker, "UnmaskPayload", newunmasker, iterations, size, "byte");
+	}
+
+	// Use the result so the loops aren't optimized out
+	unsigned int checksum = 0;
+	for (std::vector<char>::const_iterator i = buffer.begin(); i != buffer.end(); ++i)
+		checksum += static_cast<unsigned char>(*i);
+	std::cout << "\nChecksum of the unmasked buffer: " << checksum << std::endl;
+
+	return passed;
+}
+
+/* Server side of a loopback connection, counts the read events it gets from the socket engine */
+class BenchmarkSocket : public EventHandler
+{
+ public:
+	unsigned long reads;
+
+	BenchmarkSocket(int newfd)
+		: reads(0)
+	{
+		SetFd(newfd);
+	}
+
+	void OnEventHandlerRead() CXX11_OVERRIDE
+	{
+		char buf[512];
+		if (SocketEngine::Recv(this, buf, sizeof(buf), 0) > 0)
+			reads++;
+	}
+
+	void OnEventHandlerWrite() CXX11_OVERRIDE
+	{
+	}
+
+	void OnEventHandlerError(int errornum) CXX11_OVERRIDE
+	{
+	}
+};
+
+bool TestSuite::DoSocketEngineBenchmark()
+{
+	std::cout << "\n\nSocket engine benchmark\n\n";
+
+	const size_t clients = 4000;
+	const unsigned int rounds = 200;
+	const char line[] = "PRIVMSG #channel :The quick brown fox jumps over the lazy dog\r\n";
+
+	irc::sockets::sockaddrs bindaddr;
+	irc::sockets::aptosa("127.0.0.1", 0, bindaddr);
+	socklen_t addrlen = bindaddr.sa_size();
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if ((listener < 0) || (bind(listener, &bindaddr.sa, addrlen) != 0) || (listen(listener, SOMAXCONN) != 0) || (getsockname(listener, &bindaddr.sa, &addrlen) != 0))
+	{
+		std::cout << "Unable to listen on 127.0.0.1: " << strerror(errno) << std::endl;
+		if (listener >= 0)
+			SocketEngine::Close(listener);
+		return false;
+	}
+
+	// Connect the clients over loopback TCP, the server side of every connection is added to the socket engine
+	std::vector<BenchmarkSocket*> sockets;
+	std::vector<int> writers;
+	bool passed = true;
+	for (size_t i = 0; i < clients; i++)
+	{
+		const int client = socket(AF_INET, SOCK_STREAM, 0);
+		if ((client < 0) || (connect(client, &bindaddr.sa, bindaddr.sa_size()) != 0))
+		{
+			std::cout << "Unable to connect client " << i << ": " << strerror(errno) << std::endl;
+			if (client >= 0)
+				SocketEngine::Close(client);
+			passed = false;
+			break;
+		}
+		writers.push_back(client);
+
+		const int server = accept(listener, NULL, NULL);
+		if (server < 0)
+		{
+			std::cout << "Unable to accept client " << i << ": " << strerror(errno) << std::endl;
+			passed = false;
+			break;
+		}
+
+		int on = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+		SocketEngine::NonBlocking(server);
+		BenchmarkSocket* sock = new BenchmarkSocket(server);
+		if (!SocketEngine::AddFd(sock, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+		{
+			std::cout << "AddFd() failed\n";
+			delete sock;
+			SocketEngine::Close(server);
+			passed = false;
+			break;
+		}
+		sockets.push_back(sock);
+	}
+	SocketEngine::Close(listener);
+
+	// Every round all clients send a line, events are dispatched until every connection has read once.
+	// Only the time spent dispatching events is measured.
+	unsigned long expected = 0;
+	clock_t readclocks = 0;
+	for (unsigned int round = 0; (passed) && (round < rounds); round++)
+	{
+		for (std::vector<int>::const_iterator i = writers.begin(); i != writers.end(); ++i)
+			passed &= (send(*i, line, sizeof(line) - 1, 0) == sizeof(line) - 1);
+		expected += sockets.size();
+
+		const clock_t start = clock();
+		for (unsigned int tries = 0; tries < 100; tries++)
+		{
+			unsigned long reads = 0;
+			for (std::vector<BenchmarkSocket*>::const_iterator i = sockets.begin(); i != sockets.end(); ++i)
+				reads += (*i)->reads;
+			if (reads == expected)
+				break;
+			SocketEngine::DispatchEvents();
+		}
+		readclocks += clock() - start;
+	}
+	const double readtime = double(readclocks) / CLOCKS_PER_SEC;
+
+	// Every round asks for write events on all connections and takes the request back before dispatching
+	// events, one client sends a line so dispatching doesn't wait for the timeout
+	clock_t start = clock();
+	for (unsigned int round = 0; (passed) && (round < rounds); round++)
+	{
+		for (std::vector<BenchmarkSocket*>::const_iterator i = sockets.begin(); i != sockets.end(); ++i)
+		{
+			SocketEngine::ChangeEventMask(*i, FD_WANT_POLL_WRITE);
+			SocketEngine::ChangeEventMask(*i, FD_WANT_NO_WRITE);
+		}
+
+		passed &= (send(writers.front(), line, sizeof(line) - 1, 0) == sizeof(line) - 1);
+		expected++;
+		const unsigned long target = sockets.front()->reads + 1;
+		for (unsigned int tries = 0; (tries < 100) && (sockets.front()->reads != target); tries++)
+			SocketEngine::DispatchEvents();
+	}
+	const double changetime = double(clock() - start) / CLOCKS_PER_SEC;
+
+	unsigned long reads = 0;
+	for (std::vector<BenchmarkSocket*>::const_iterator i = sockets.begin(); i != sockets.end(); ++i)
+	{
+		reads += (*i)->reads;
+		SocketEngine::DelFd(*i);
+		SocketEngine::Close(*i);
+		delete *i;
+	}
+	for (std::vector<int>::const_iterator i = writers.begin(); i != writers.end(); ++i)
+		SocketEngine::Close(*i);
+
+	passed &= (reads == expected);
+	std::cout << "Dispatching " << expected << " read events on " << sockets.size() << " loopback TCP connections (" << reads << " read):\n";
+	std::cout << readtime * 1e9 / std::max<unsigned long>(expected, 1) << " ns per event\n";
+	std::cout << "\nChanging the event mask of " << sockets.size() << " connections twice in " << rounds << " rounds:\n";
+	std::cout << changetime * 1e9 / std::max<size_t>(sockets.size() * rounds * 2, 1) << " ns per change\n";
+
+	return passed;
+}
+
+namespace
+{
+	class TestTimer : public Timer
+	{
+	 public:
+		unsigned int ticks;
+
+		TestTimer(unsigned int interval, bool repeating)
+			: Timer(interval, repeating)
+			, ticks(0)
+		{
+		}
+
+		bool Tick(time_t) CXX11_OVERRIDE
+		{
+			ticks++;
+			return true;
+		}
+	};
+}
+
+#define TIMERTEST(x, y) std::cout << x << " " << ((passed = (y)) ? "SUCCESS!\n" : "FAILURE\n"); if (!passed) return false
+
+bool TestSuite::DoTimerTests()
+{
+	std::cout << "\n\nTimer tests\n\n";
+
+	bool passed;
+	TimerManager timers;
+	const time_t now = ServerInstance->Time();
+	const time_t year = 365 * 24 * 60 * 60;
+
+	TestTimer soon(10, false);
+	TestTimer later(100000, false);
+	TestTimer distant(40 * year, false);
+	TestTimer repeating(60, true);
+	timers.AddTimer(&soon);
+	timers.AddTimer(&later);
+	timers.AddTimer(&distant);
+	timers.AddTimer(&repeating);
+
+	timers.TickTimers(now);
+	TIMERTEST("No timer is due", ((!soon.ticks) && (!later.ticks) && (!distant.ticks) && (!repeating.ticks)));
+
+	timers.TickTimers(now + 10);
+	TIMERTEST("Timer due in 10 seconds", ((soon.ticks == 1) && (!later.ticks)));
+
+	// The clock jumps thirty years ahead, every timer due by then has to run once without stepping through every second
+	const time_t jump = now + 30 * year;
+	const clock_t start = clock();
+	timers.TickTimers(jump);
+	const double elapsed = double(clock() - start) / CLOCKS_PER_SEC;
+	std::cout << "Jumping 30 years ahead took " << elapsed * 1e3 << " ms\n";
+	TIMERTEST("Jumping 30 years ahead is fast", (elapsed < 0.1));
+	TIMERTEST("Due timers ran once", ((soon.ticks == 1) && (later.ticks == 1) && (repeating.ticks == 1)));
+	TIMERTEST("Timer due in 40 years did not run", (!distant.ticks));
+
+	timers.TickTimers(jump + 59);
+	TIMERTEST("Repeating timer waits for its interval", (repeating.ticks == 1));
+	timers.TickTimers(jump + 60);
+	TIMERTEST("Repeating timer runs again after its interval", (repeating.ticks == 2));
+
+	timers.TickTimers(now + 40 * year);
+	TIMERTEST("Timer due in 40 years", ((distant.ticks == 1) && (later.ticks == 1)));
+
+	return true;
+}
+
+namespace
+{
+	/** The state of an idle registered user the background checks look at
+	 */
+	struct IdleUser
+	{
+		unsigned int penalty;
+		size_t sendqsize;
+		time_t nping;
+	};
+
+	/** Visit every user once a second, the way UserManager::DoBackgroundUserStuff() used to
+	 */
+	class BackgroundPoller
+	{
+		std::vector<IdleUser> users;
+		time_t now;
+		const time_t pingtime;
+
+	 public:
+		unsigned long pings;
+
+		BackgroundPoller(const std::vector<IdleUser>& idleusers, time_t start, time_t ping)
+			: users(idleusers)
+			, now(start)
+			, pingtime(ping)
+			, pings(0)
+		{
+		}
+
+		void operator()()
+		{
+			now++;
+			for (std::vector<IdleUser>::iterator i = users.begin(); i != users.end(); ++i)
+			{
+				if ((i->penalty) || (i->sendqsize))
+					i->penalty = 0;
+
+				if (now >= i->nping)
+				{
+					i->nping = now + pingtime;
+					pings++;
+				}
+			}
+		}
+	};
+
+	/** Schedule a timer for the next ping of every user, the way UserTimer does
+	 */
+	class TimerScheduler
+	{
+		class IdleUserTimer : public Timer
+		{
+			TimerScheduler& scheduler;
+			IdleUser user;
+
+		 public:
+			IdleUserTimer(TimerScheduler& owner, const IdleUser& idleuser)
+				: Timer(0)
+				, scheduler(owner)
+				, user(idleuser)
+			{
+				SetTrigger(user.nping);
+				scheduler.timers.AddTimer(this);
+			}
+
+			bool Tick(time_t TIME) CXX11_OVERRIDE
+			{
+				user.nping = TIME + scheduler.pingtime;
+				scheduler.pings++;
+				SetTrigger(user.nping);
+				scheduler.timers.AddTimer(this);
+				return true;
+			}
+		};
+
+		TimerManager timers;
+		std::vector<IdleUserTimer*> usertimers;
+		time_t now;
+		const time_t pingtime;
+
+	 public:
+		unsigned long pings;
+
+		TimerScheduler(const std::vector<IdleUser>& idleusers, time_t start, time_t ping)
+			: now(start)
+			, pingtime(ping)
+			, pings(0)
+		{
+			timers.TickTimers(now);
+			for (std::vector<IdleUser>::const_iterator i = idleusers.begin(); i != idleusers.end(); ++i)
+				usertimers.push_back(new IdleUserTimer(*this, *i));
+		}
+
+		~TimerScheduler()
+		{
+			stdalgo::delete_all(usertimers);
+		}
+
+		void operator()()
+		{
+			timers.TickTimers(++now);
+		}
+	};
+}
+
+bool TestSuite::DoUserTimerBenchmark()
+{
+	std::cout << "\n\nUser background check benchmark\n\n";
+
+	// Idle registered users whose ping deadlines are spread over the ping interval
+	const size_t usercount = 15000;
+	const time_t pingtime = 120;
+	const unsigned int seconds = 3600;
+	const time_t now = ServerInstance->Time();
+	std::vector<IdleUser> users(usercount);
+	for (size_t i = 0; i < usercount; i++)
+	{
+		users[i].penalty = 0;
+		users[i].sendqsize = 0;
+		users[i].nping = now + 1 + i % pingtime;
+	}
+
+	BackgroundPoller oldchecks(users, now, pingtime);
+	TimerScheduler newchecks(users, now, pingtime);
+
+	std::cout << "Checking " << usercount << " idle users with a ping time of " << pingtime << " seconds for " << seconds << " seconds:\n";
+	CompareImplementations("Visiting every user every second", oldchecks, "UserTimer in the timer wheel", newchecks, seconds, 1, "second");
+	std::cout << oldchecks.pings << " and " << newchecks.pings << " pings sent\n";
+
+	return (oldchecks.pings == newchecks.pings);
+}
+
 TestSuite::~TestSuite()
 {
 	std::cout << "\n\n*** END OF TEST SUITE ***\n";
@@ -32,6 +32,7 @@ void Timer::SetInterval(time_t newinterval)
 
 Timer::Timer(unsigned int secs_from_now, bool repeating)
 	: trigger(ServerInstance->Time() + secs_from_now)
+	, slot(NULL)
 	, secs(secs_from_now)
 	, repeat(repeating)
 {
@@ -42,42 +43,151 @@ Timer::~Timer()
 	ServerInstance->Timers.DelTimer(this);
 }
 
-void TimerManager::TickTimers(time_t TIME)
+TimerManager::TimerManager()
+	: current(0)
 {
-	for (TimerMap::iterator i = Timers.begin(); i != Timers.end(); )
+}
+
+void TimerManager::Schedule(Timer* t)
+{
+	// Timers which are already due are put in the list of the next second to be processed
+	time_t expires = std::max(t->GetTrigger(), current);
+	const uint64_t delta = expires - current;
+
+	TimerList* list;
+	if (delta < (1U << RootBits))
 	{
-		Timer* t = i->second;
-		if (t->GetTrigger() > TIME)
-			break;
+		list = &root[expires & ((1 << RootBits) - 1)];
+	}
+	else
+	{
+		// Find the first level whose lists cover the trigger time
+		unsigned int level = 0;
+		unsigned int shift = RootBits;
+		uint64_t span = static_cast<uint64_t>(1) << (shift + LevelBits);
+		while ((level < Levels - 1) && (delta >= span))
+		{
+			level++;
+			shift += LevelBits;
+			span <<= LevelBits;
+		}
 
-		Timers.erase(i++);
+		// Timers too far in the future for the wheel are put in the last list and redistributed when it is reached
+		if (delta >= span)
+			expires = current + span - 1;
 
-		if (!t->Tick(TIME))
-			continue;
+		list = &levels[level][(expires >> shift) & ((1 << LevelBits) - 1)];
+	}
 
-		if (t->GetRepeat())
+	list->push_back(t);
+	t->slot = list;
+}
+
+void TimerManager::Redistribute(TimerList& list)
+{
+	while (!list.empty())
+	{
+		Timer* t = list.front();
+		list.pop_front();
+		Schedule(t);
+	}
+}
+
+void TimerManager::Rebuild(time_t newcurrent)
+{
+	TimerList all;
+	for (unsigned int i = 0; i < (1 << RootBits); i++)
+	{
+		while (!root[i].empty())
 		{
-			t->SetTrigger(TIME + t->GetInterval());
-			AddTimer(t);
+			Timer* t = root[i].front();
+			root[i].pop_front();
+			all.push_back(t);
 		}
 	}
+	for (unsigned int level = 0; level < Levels; level++)
+	{
+		for (unsigned int i = 0; i < (1 << LevelBits); i++)
+		{
+			while (!levels[level][i].empty())
+			{
+				Timer* t = levels[level][i].front();
+				levels[level][i].pop_front();
+				all.push_back(t);
+			}
+		}
+	}
+
+	current = newcurrent;
+	Redistribute(all);
 }
 
-void TimerManager::DelTimer(Timer* t)
+void TimerManager::TickTimers(time_t TIME)
 {
-	std::pair<TimerMap::iterator, TimerMap::iterator> itpair = Timers.equal_range(t->GetTrigger());
+	if (!current)
+		current = TIME;
+
+	// If the clock went backwards or jumped further ahead than the first level covers redistribute
+	// all timers relative to the new time instead of stepping through every second in between.
+	// Timers which are due are put in the list of the current second and run below.
+	if ((TIME < current - 1) || (TIME - current >= (1 << RootBits)))
+		Rebuild(TIME);
 
-	for (TimerMap::iterator i = itpair.first; i != itpair.second; ++i)
+	for (; current <= TIME; current++)
 	{
-		if (i->second == t)
+		// When the first level wraps around move the timers of the next list of the
+		// second level down, and do the same for every further level which wrapped around
+		if (!(current & ((1 << RootBits) - 1)))
 		{
-			Timers.erase(i);
-			break;
+			unsigned int shift = RootBits;
+			for (unsigned int level = 0; level < Levels; level++, shift += LevelBits)
+			{
+				const unsigned int index = (current >> shift) & ((1 << LevelBits) - 1);
+				Redistribute(levels[level][index]);
+				if (index)
+					break;
+			}
+		}
+
+		TimerList& list = root[current & ((1 << RootBits) - 1)];
+		while (!list.empty())
+		{
+			Timer* t = list.front();
+			list.pop_front();
+			t->slot = NULL;
+
+			// The trigger time was changed with SetTrigger() without rescheduling the timer
+			if (t->GetTrigger() > TIME)
+			{
+				Schedule(t);
+				continue;
+			}
+
+			if (!t->Tick(TIME))
+				continue;
+
+			if (t->GetRepeat())
+			{
+				t->SetTrigger(TIME + t->GetInterval());
+				AddTimer(t);
+			}
 		}
 	}
 }
 
+void TimerManager::DelTimer(Timer* t)
+{
+	if (!t->slot)
+		return;
+
+	t->slot->erase(t);
+	t->slot = NULL;
+}
+
 void TimerManager::AddTimer(Timer* t)
 {
-	Timers.insert(std::make_pair(t->GetTrigger(), t));
+	DelTimer(t);
+	if (!current)
+		current = ServerInstance->Time();
+	Schedule(t);
 }
@@ -74,6 +74,7 @@ void UserManager::AddUser(int socket, ListenSocket* via, irc::sockets::sockaddrs
 	this->clientlist[New->nick] = New;
 	this->AddClone(New);
 	this->local_users.push_front(New);
+	ServerInstance->XLines->IndexUser(New);
 
 	if (!SocketEngine::AddFd(eh, FD_WANT_FAST_READ | FD_WANT_EDGE_WRITE))
 	{
@@ -112,6 +113,9 @@ void UserManager::AddUser(int socket, ListenSocket* via, irc::sockets::sockaddrs
 	if (New->quitting)
 		return;
 
+	// Make sure the registration timeout is checked, CheckClass() only scheduled the ping check
+	New->timer.ScheduleBy(New->signon + New->MyClass->GetRegTimeout() + 1);
+
 	/*
 	 * even with bancache, we still have to keep User::exempt current.
 	 * besides that, if we get a positive bancache hit, we still won't fuck
@@ -203,6 +207,7 @@ void UserManager::QuitUser(User* user, const std::string& quitreason, const std:
 		if (lu->registered == REG_ALL)
 			ServerInstance->SNO->WriteToSnoMask('q',"Client exiting: %s (%s) [%s]", user->GetFullRealHost().c_str(), user->GetIPString().c_str(), operreason->c_str());
 		local_users.erase(lu);
+		ServerInstance->XLines->UnindexUser(lu);
 	}
 
 	if (!clientlist.erase(user->nick))
@@ -285,72 +290,88 @@ bool UserManager::AllModulesReportReady(LocalUser* user)
 }
 
 /**
- * This function is called once a second from the mainloop.
- * It is intended to do background checking on all the users, e.g. do
+ * This function is called by the timer of a local user when the user needs attention.
+ * It is intended to do background checking on the user, e.g. do
  * ping checks, registration timeouts, etc.
  */
-void UserManager::DoBackgroundUserStuff()
+time_t UserManager::DoBackgroundUserStuff(LocalUser* curr)
 {
-	for (LocalList::iterator i = local_users.begin(); i != local_users.end(); )
-	{
-		// It's possible that we quit the user below due to ping timeout etc. and QuitUser() removes it from the list
-		LocalUser* curr = *i;
-		++i;
+	if (curr->quitting)
+		return 0;
 
-		if (curr->CommandFloodPenalty || curr->eh.getSendQSize())
-		{
-			unsigned int rate = curr->MyClass->GetCommandRate();
-			if (curr->CommandFloodPenalty > rate)
-				curr->CommandFloodPenalty -= rate;
-			else
-				curr->CommandFloodPenalty = 0;
-			curr->eh.OnDataReady();
-		}
+	if (curr->CommandFloodPenalty || curr->eh.getSendQSize())
+	{
+		unsigned int rate = curr->MyClass->GetCommandRate();
+		if (curr->CommandFloodPenalty > rate)
+			curr->CommandFloodPenalty -= rate;
+		else
+			curr->CommandFloodPenalty = 0;
+		curr->eh.OnDataReady();
+		if (curr->quitting)
+			return 0;
+	}
 
-		switch (curr->registered)
-		{
-			case REG_ALL:
-				if (ServerInstance->Time() >= curr->nping)
-				{
-					// This user didn't answer the last ping, remove them
-					if (!curr->lastping)
-					{
-						time_t time = ServerInstance->Time() - (curr->nping - curr->MyClass->GetPingTime());
-						const std::string message = "Ping timeout: " + ConvToStr(time) + (time != 1 ? " seconds" : " second");
-						this->QuitUser(curr, message);
-						continue;
-					}
-
-					curr->Write("PING :" + ServerInstance->Config->ServerName);
-					curr->lastping = 0;
-					curr->nping = ServerInstance->Time() + curr->MyClass->GetPingTime();
-				}
-				break;
-			case REG_NICKUSER:
-				if (AllModulesReportReady(curr))
+	switch (curr->registered)
+	{
+		case REG_ALL:
+			if (ServerInstance->Time() >= curr->nping)
+			{
+				// This user didn't answer the last ping, remove them
+				if (!curr->lastping)
 				{
-					/* User has sent NICK/USER, modules are okay, DNS finished. */
-					curr->FullConnect();
-					continue;
+					time_t time = ServerInstance->Time() - (curr->nping - curr->MyClass->GetPingTime());
+					const std::string message = "Ping timeout: " + ConvToStr(time) + (time != 1 ? " seconds" : " second");
+					this->QuitUser(curr, message);
+					return 0;
 				}
 
-				// If the user has been quit in OnCheckReady then we shouldn't
-				// quit them again for having a registration timeout.
+				curr->Write("PING :" + ServerInstance->Config->ServerName);
+				curr->lastping = 0;
+				curr->nping = ServerInstance->Time() + curr->MyClass->GetPingTime();
+			}
+			break;
+		case REG_NICKUSER:
+			if (AllModulesReportReady(curr))
+			{
+				/* User has sent NICK/USER, modules are okay, DNS finished. */
+				curr->FullConnect();
 				if (curr->quitting)
-					continue;
+					return 0;
 				break;
-		}
+			}
 
-		if (curr->registered != REG_ALL && curr->MyClass && (ServerInstance->Time() > (curr->signon + curr->MyClass->GetRegTimeout())))
+			// If the user has been quit in OnCheckReady then we shouldn't
+			// quit them again for having a registration timeout.
+			if (curr->quitting)
+				return 0;
+			break;
+	}
+
+	time_t next;
+	if (curr->registered == REG_ALL)
+	{
+		next = curr->nping;
+	}
+	else
+	{
+		const time_t regtimeout = curr->signon + curr->MyClass->GetRegTimeout();
+		if (ServerInstance->Time() > regtimeout)
 		{
 			/*
 			 * registration timeout -- didnt send USER/NICK/HOST
 			 * in the time specified in their connection class.
 			 */
 			this->QuitUser(curr, "Registration timeout");
-			continue;
+			return 0;
 		}
+		next = regtimeout + 1;
 	}
+
+	// Keep checking every second while the penalty decays or modules are not ready yet
+	if ((curr->CommandFloodPenalty) || (curr->eh.getSendQSize()) || (curr->registered == REG_NICKUSER))
+		next = std::min(next, ServerInstance->Time() + 1);
+
+	return next;
 }
 
 already_sent_t UserManager::NextAlreadySentId()
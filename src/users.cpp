@@ -63,8 +63,12 @@ std::string User::GetModeLetters(bool includeparams) const
 	return ret;
 }
 
+/** The last value given out by User::InvalidateCache() as an identity generation */
+static uint64_t lastidentitygen = 0;
+
 User::User(const std::string& uid, Server* srv, int type)
-	: age(ServerInstance->Time())
+	: identitygen(++lastidentitygen)
+	, age(ServerInstance->Time())
 	, signon(0)
 	, uuid(uid)
 	, server(srv)
@@ -87,6 +91,7 @@ User::User(const std::string& uid, Server* srv, int type)
 LocalUser::LocalUser(int myfd, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* servaddr)
 	: User(ServerInstance->UIDGen.GetUID(), ServerInstance->FakeClient->server, USERTYPE_LOCAL)
 	, eh(this)
+	, timer(this)
 	, bytes_in(0)
 	, bytes_out(0)
 	, cmds_in(0)
@@ -109,6 +114,23 @@ LocalUser::LocalUser(int myfd, irc::sockets::sockaddrs* client, irc::sockets::so
 	ChangeRealHost(GetIPString(), true);
 }
 
+void UserTimer::ScheduleBy(time_t when)
+{
+	if ((IsScheduled()) && (GetTrigger() <= when))
+		return;
+
+	SetTrigger(when);
+	ServerInstance->Timers.AddTimer(this);
+}
+
+bool UserTimer::Tick(time_t TIME)
+{
+	const time_t next = ServerInstance->Users->DoBackgroundUserStuff(user);
+	if (next)
+		ScheduleBy(next);
+	return true;
+}
+
 User::~User()
 {
 }
@@ -234,62 +256,91 @@ void UserIOHandler::OnDataReady()
 	if (!user->HasPrivPermission("users/flood/no-fakelag"))
 		penaltymax = user->MyClass->GetPenaltyThreshold() * 1000;
 
+	// Lines are copied out of the recvq without modifying it, the consumed part is erased once at the end
+	const std::string::size_type maxline = ServerInstance->Config->Limits.MaxLine - 2;
+	std::string line;
+	std::string::size_type qpos = 0;
 	while (user->CommandFloodPenalty < penaltymax && getSendQSize() < sendqmax)
 	{
-		std::string line;
-		line.reserve(ServerInstance->Config->Limits.MaxLine);
-		std::string::size_type qpos = 0;
-		while (qpos < recvq.length())
+		const char* const start = recvq.data() + qpos;
+		const char* const eol = static_cast<const char*>(memchr(start, '\n', recvq.length() - qpos));
+		if (!eol)
+			break;
+
+		const char* end = eol;
+		if ((end != start) && (end[-1] == '\r'))
+			end--;
+
+		if ((memchr(start, '\r', end - start)) || (memchr(start, '\0', end - start)))
 		{
-			char c = recvq[qpos++];
-			switch (c)
+			// Uncommon case: drop every CR and replace NULs with spaces
+			line.clear();
+			for (const char* c = start; (c != end) && (line.length() < maxline); ++c)
 			{
-			case '\0':
-				c = ' ';
-				break;
-			case '\r':
-				continue;
-			case '\n':
-				goto eol_found;
+				if (*c == '\r')
+					continue;
+				line.push_back(*c ? *c : ' ');
 			}
-			if (line.length() < ServerInstance->Config->Limits.MaxLine - 2)
-				line.push_back(c);
 		}
-		// if we got here, the recvq ran out before we found a newline
-		return;
-eol_found:
-		// just found a newline. Terminate the string, and pull it out of recvq
-		recvq.erase(0, qpos);
+		else
+		{
+			line.assign(start, std::min<std::string::size_type>(end - start, maxline));
+		}
+
+		const std::string::size_type linelen = eol - start + 1;
+		qpos += linelen;
 
 		// TODO should this be moved to when it was inserted in recvq?
-		ServerInstance->stats.Recv += qpos;
-		user->bytes_in += qpos;
+		ServerInstance->stats.Recv += linelen;
+		user->bytes_in += linelen;
 		user->cmds_in++;
 
 		ServerInstance->Parser.ProcessBuffer(line, user);
 		if (user->quitting)
-			return;
+			break;
 	}
+	recvq.erase(0, qpos);
+	if (user->quitting)
+		return;
+
 	if (user->CommandFloodPenalty >= penaltymax && !user->MyClass->fakelag)
+	{
 		ServerInstance->Users->QuitUser(user, "Excess Flood");
+		return;
+	}
+
+	// Let the penalty decay, or finish registration once modules are ready, in the next background check
+	if ((user->CommandFloodPenalty) || (getSendQSize()) || (user->registered == REG_NICKUSER))
+		user->timer.ScheduleBy(ServerInstance->Time() + 1);
 }
 
-void UserIOHandler::AddWriteBuf(const std::string &data)
+bool UserIOHandler::CanAddWriteBuf(size_t len)
 {
 	if (user->quitting_sendq)
-		return;
-	if (!user->quitting && getSendQSize() + data.length() > user->MyClass->GetSendqHardMax() &&
+		return false;
+	if (!user->quitting && getSendQSize() + len > user->MyClass->GetSendqHardMax() &&
 		!user->HasPrivPermission("users/flood/increased-buffers"))
 	{
 		user->quitting_sendq = true;
 		ServerInstance->GlobalCulls.AddSQItem(user);
-		return;
+		return false;
 	}
 
 	// We still want to append data to the sendq of a quitting user,
 	// e.g. their ERROR message that says 'closing link'
+	return true;
+}
 
-	WriteData(data);
+void UserIOHandler::AddWriteBuf(const std::string &data)
+{
+	if (CanAddWriteBuf(data.length()))
+		WriteData(data);
+}
+
+void UserIOHandler::AddWriteBuf(const SendQueue::Element& data)
+{
+	if (CanAddWriteBuf(data.length()))
+		WriteData(data);
 }
 
 void UserIOHandler::OnError(BufferedSocketError)
@@ -330,6 +381,7 @@ void User::Oper(OperInfo* info)
 
 	this->SetMode(opermh, true);
 	this->oper = info;
+	this->InvalidateCache();
 	this->WriteCommand("MODE", "+o");
 	FOREACH_MOD(OnOper, (this, info->name));
 
@@ -416,7 +468,7 @@ void User::UnOper()
 	 * to call UnOper. -- w00t
 	 */
 	oper = NULL;
-
+	InvalidateCache();
 
 	/* Remove all oper only modes from the user when the deoper - Bug #466*/
 	Modes::ChangeList changelist;
@@ -474,6 +526,7 @@ void LocalUser::CheckClass(bool clone_count)
 	}
 
 	this->nping = ServerInstance->Time() + a->GetPingTime();
+	timer.ScheduleBy(nping);
 }
 
 bool LocalUser::CheckLines(bool doZline)
@@ -553,6 +606,7 @@ void LocalUser::FullConnect()
 	FOREACH_MOD(OnUserConnect, (this));
 
 	this->registered = REG_ALL;
+	ServerInstance->XLines->IndexUser(this);
 
 	FOREACH_MOD(OnPostConnect, (this));
 
@@ -572,6 +626,7 @@ void User::InvalidateCache()
 	cached_hostip.clear();
 	cached_makehost.clear();
 	cached_fullrealhost.clear();
+	identitygen = ++lastidentitygen;
 }
 
 bool User::ChangeNick(const std::string& newnick, time_t newts)
@@ -729,6 +784,8 @@ void LocalUser::SetClientIP(const irc::sockets::sockaddrs& sa, bool recheck_elin
 	if (sa != client_sa)
 	{
 		User::SetClientIP(sa);
+		if (registered == REG_ALL)
+			ServerInstance->XLines->IndexUser(this);
 		if (recheck_eline)
 			this->exempt = (ServerInstance->XLines->MatchesLine("E", this) != NULL);
 
@@ -736,8 +793,6 @@ void LocalUser::SetClientIP(const irc::sockets::sockaddrs& sa, bool recheck_elin
 	}
 }
 
-static std::string wide_newline("\r\n");
-
 void User::Write(const std::string& text)
 {
 }
@@ -746,26 +801,35 @@ void User::Write(const char *text, ...)
 {
 }
 
+StreamSocket::SendQueue::Element LocalUser::PrepareLine(const std::string& text)
+{
+	// Crop the line at the maximum length, this should happen rarely or never.
+	const std::string::size_type len = std::min<std::string::size_type>(text.length(), ServerInstance->Config->Limits.MaxLine - 2);
+	std::string line;
+	line.reserve(len + 2);
+	line.append(text, 0, len).append("\r\n", 2);
+	return StreamSocket::SendQueue::Element::Take(line);
+}
+
 void LocalUser::Write(const std::string& text)
 {
 	if (!SocketEngine::BoundsCheckFd(&eh))
 		return;
 
-	if (text.length() > ServerInstance->Config->Limits.MaxLine - 2)
-	{
-		// this should happen rarely or never. Crop the string at 512 and try again.
-		std::string try_again(text, 0, ServerInstance->Config->Limits.MaxLine - 2);
-		Write(try_again);
+	Write(PrepareLine(text));
+}
+
+void LocalUser::Write(const StreamSocket::SendQueue::Element& line)
+{
+	if (!SocketEngine::BoundsCheckFd(&eh))
 		return;
-	}
 
-	ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %s", uuid.c_str(), text.c_str());
+	ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %.*s", uuid.c_str(), (int)line.length() - 2, line.data());
 
-	eh.AddWriteBuf(text);
-	eh.AddWriteBuf(wide_newline);
+	eh.AddWriteBuf(line);
 
-	ServerInstance->stats.Sent += text.length() + 2;
-	this->bytes_out += text.length() + 2;
+	ServerInstance->stats.Sent += line.length();
+	this->bytes_out += line.length();
 	this->cmds_out++;
 }
 
@@ -857,7 +921,7 @@ namespace
 {
 	class WriteCommonRawHandler : public User::ForEachNeighborHandler
 	{
-		const std::string& msg;
+		const StreamSocket::SendQueue::Element msg;
 
 		void Execute(LocalUser* user) CXX11_OVERRIDE
 		{
@@ -866,7 +930,7 @@ namespace
 
 	 public:
 		WriteCommonRawHandler(const std::string& message)
-			: msg(message)
+			: msg(LocalUser::PrepareLine(message))
 		{
 		}
 	};
@@ -924,12 +988,12 @@ void User::ForEachNeighbor(ForEachNeighborHandler& handler, bool include_self)
 	for (IncludeChanList::const_iterator i = include_chans.begin(); i != include_chans.end(); ++i)
 	{
 		Channel* chan = (*i)->chan;
-		const Channel::MemberMap& userlist = chan->GetUsers();
-		for (Channel::MemberMap::const_iterator j = userlist.begin(); j != userlist.end(); ++j)
+		const Channel::MemberMap::LocalList& locals = chan->GetUsers().GetLocal();
+		for (Channel::MemberMap::LocalList::const_iterator j = locals.begin(); j != locals.end(); ++j)
 		{
-			LocalUser* curr = IS_LOCAL(j->first);
+			LocalUser* curr = j->first;
 			// User not yet visited?
-			if ((curr) && (curr->already_sent != newid))
+			if (curr->already_sent != newid)
 			{
 				// Mark as visited and execute function
 				curr->already_sent = newid;
@@ -951,7 +1015,7 @@ void User::WriteRemoteNumeric(const Numeric::Numeric& numeric)
  * the first users channels then the second users channels within the outer loop,
  * therefore it was a maximum of x*y iterations (upon returning 0 and checking
  * all possible iterations). However this new function instead checks against the
- * channel's userlist in the inner loop which is a std::map<User*,User*>
+ * channel's userlist in the inner loop which is indexed by User pointers
  * and saves us time as we already know what pointer value we are after.
  * Don't quote me on the maths as i am not a mathematician or computer scientist,
  * but i believe this algorithm is now x+(log y) maximum iterations instead.
@@ -984,6 +1048,7 @@ bool User::ChangeName(const std::string& gecos)
 		FOREACH_MOD(OnChangeName, (this,gecos));
 	}
 	this->fullname.assign(gecos, 0, ServerInstance->Config->Limits.MaxGecos);
+	this->InvalidateCache();
 
 	return true;
 }
@@ -1029,6 +1094,11 @@ void User::ChangeRealHost(const std::string& host, bool resetdisplay)
 
 	realhost = host;
 	this->InvalidateCache();
+
+	// Keep the X-line user index current, unregistered users are not indexed by host
+	LocalUser* const luser = IS_LOCAL(this);
+	if ((luser) && (luser->registered == REG_ALL))
+		ServerInstance->XLines->IndexUser(luser);
 }
 
 bool User::ChangeIdent(const std::string& newident)
@@ -1041,6 +1111,10 @@ bool User::ChangeIdent(const std::string& newident)
 	this->ident.assign(newident, 0, ServerInstance->Config->Limits.IdentMax);
 	this->InvalidateCache();
 
+	LocalUser* const luser = IS_LOCAL(this);
+	if ((luser) && (luser->registered == REG_ALL))
+		ServerInstance->XLines->IndexUser(luser);
+
 	return true;
 }
 
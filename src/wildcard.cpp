@@ -107,6 +107,232 @@ bool InspIRCd::MatchCIDR(const char* str, const char* mask, unsigned const char*
 	return InspIRCd::Match(str, mask, map);
 }
 
+inline unsigned const char* WildcardMask::GetMap() const
+{
+	return (fixedmap ? fixedmap : national_case_insensitive_map);
+}
+
+WildcardMask::WildcardMask()
+	: fixedmap(NULL)
+	, casemapgen(national_case_map_generation)
+	, star(false)
+	, minlength(0)
+{
+	segments.push_back(Segment(0, 0));
+}
+
+WildcardMask::WildcardMask(const std::string& Mask, unsigned const char* Map)
+	: mask(Mask)
+	, fixedmap(Map)
+	, star(false)
+	, minlength(0)
+{
+	Compile();
+}
+
+void WildcardMask::Compile() const
+{
+	unsigned const char* const map = GetMap();
+	casemapgen = national_case_map_generation;
+	folded.clear();
+	segments.clear();
+	star = false;
+	minlength = 0;
+
+	// Like MatchInternal() the mask ends at the first null
+	const std::string::size_type masklen = strlen(mask.c_str());
+	folded.reserve(masklen);
+
+	std::string::size_type start = 0;
+	for (std::string::size_type i = 0; i <= masklen; ++i)
+	{
+		const unsigned char chr = (i < masklen ? mask[i] : '*');
+		if (chr != '*')
+		{
+			folded.push_back((chr == '?') ? chr : map[chr]);
+			continue;
+		}
+
+		if (i < masklen)
+			folded.push_back(chr);
+
+		// Empty segments in the middle of the mask (from "**") match anywhere so skip them,
+		// but always keep the head and tail so Match() can anchor them
+		const bool last = (i == masklen);
+		if ((i == start) && (!segments.empty()) && (!last))
+		{
+			start = i + 1;
+			continue;
+		}
+
+		Segment seg(start, i - start);
+		for (std::string::size_type j = seg.offset; j < i; ++j)
+		{
+			if (mask[j] == '?')
+			{
+				seg.wild = true;
+				seg.exact = false;
+				continue;
+			}
+
+			// Collect every character which folds to the same character as this one
+			unsigned char matches[2];
+			unsigned int matchcount = 0;
+			for (unsigned int c = 0; c < 256; ++c)
+			{
+				if (map[c] != static_cast<unsigned char>(folded[j]))
+					continue;
+				if (matchcount < 2)
+					matches[matchcount] = c;
+				matchcount++;
+			}
+
+			if ((matchcount != 1) || (matches[0] != static_cast<unsigned char>(mask[j])))
+				seg.exact = false;
+
+			if (seg.first == seg.length)
+			{
+				seg.first = j - seg.offset;
+				seg.needlecount = (matchcount <= 2 ? matchcount : 0);
+				for (unsigned int n = 0; n < seg.needlecount; ++n)
+					seg.needles[n] = matches[n];
+			}
+		}
+
+		segments.push_back(seg);
+		minlength += seg.length;
+		start = i + 1;
+		if (!last)
+			star = true;
+	}
+}
+
+bool WildcardMask::MatchSegment(const Segment& seg, const unsigned char* str) const
+{
+	unsigned const char* const map = GetMap();
+	if ((seg.exact) && (seg.length >= 8))
+		return !memcmp(mask.data() + seg.offset, str, seg.length);
+
+	const char* raw = mask.data() + seg.offset;
+	const unsigned char* folded_seg = reinterpret_cast<const unsigned char*>(folded.data()) + seg.offset;
+	for (std::string::size_type i = 0; i < seg.length; ++i)
+	{
+		if ((folded_seg[i] != map[str[i]]) && (raw[i] != '?'))
+			return false;
+	}
+	return true;
+}
+
+const unsigned char* WildcardMask::FindSegment(const Segment& seg, const unsigned char* str, const unsigned char* end) const
+{
+	if (seg.length > static_cast<std::string::size_type>(end - str))
+		return NULL;
+
+	unsigned const char* const map = GetMap();
+	// A segment made up of nothing but '?' matches at the first position it fits
+	if (seg.first == seg.length)
+		return str;
+
+	// Scan for the first literal character of the segment and verify the rest of it at each hit
+	const unsigned char* pos = str + seg.first;
+	const unsigned char* const last = end - seg.length + seg.first;
+	const unsigned char needle = folded[seg.offset + seg.first];
+	while (pos <= last)
+	{
+		const std::string::size_type remaining = last - pos + 1;
+		const unsigned char* hit = NULL;
+		if ((remaining < 16) || ((seg.needlecount != 1) && (remaining < 64)))
+		{
+			// Not worth the setup cost of memchr()
+			for (const unsigned char* i = pos; i <= last; ++i)
+			{
+				if (map[*i] == needle)
+				{
+					hit = i;
+					break;
+				}
+			}
+		}
+		else if (seg.needlecount == 1)
+		{
+			hit = static_cast<const unsigned char*>(memchr(pos, seg.needles[0], remaining));
+		}
+		else if (seg.needlecount == 2)
+		{
+			// Usually an upper and lower case pair, look for the second one only up to the first
+			hit = static_cast<const unsigned char*>(memchr(pos, seg.needles[0], remaining));
+			const unsigned char* other = static_cast<const unsigned char*>(memchr(pos, seg.needles[1], hit ? hit - pos : remaining));
+			if (other)
+				hit = other;
+		}
+		else
+		{
+			for (const unsigned char* i = pos; i <= last; ++i)
+			{
+				if (map[*i] == needle)
+				{
+					hit = i;
+					break;
+				}
+			}
+		}
+
+		if (!hit)
+			return NULL;
+
+		const unsigned char* const candidate = hit - seg.first;
+		if (MatchSegment(seg, candidate))
+			return candidate;
+		pos = hit + 1;
+	}
+	return NULL;
+}
+
+bool WildcardMask::Match(const char* cstr) const
+{
+	// The national case map has changed since the mask was folded
+	if ((!fixedmap) && (casemapgen != national_case_map_generation))
+		Compile();
+
+	const unsigned char* const str = reinterpret_cast<const unsigned char*>(cstr);
+
+	// The head must match at the start of the string, checking it first rejects most
+	// strings without having to find the length of them
+	const Segment& head = segments.front();
+	if ((head.length) && ((strnlen(cstr, head.length) < head.length) || (!MatchSegment(head, str))))
+		return false;
+
+	const std::string::size_type len = head.length + strlen(cstr + head.length);
+	if (!star)
+		return (len == head.length);
+
+	// The tail must match at the end, minlength makes sure that it does not overlap the head
+	const Segment& tail = segments.back();
+	if (len < minlength)
+		return false;
+
+	const unsigned char* const end = str + len - tail.length;
+	if ((tail.length) && (!MatchSegment(tail, end)))
+		return false;
+
+	// Every segment in between is separated by a '*' so taking the leftmost match of
+	// each one in turn never rules out a match which would otherwise be possible
+	const unsigned char* pos = str + head.length;
+	for (std::vector<Segment>::const_iterator i = segments.begin() + 1; i + 1 != segments.end(); ++i)
+	{
+		pos = FindSegment(*i, pos, end);
+		if (!pos)
+			return false;
+		pos += i->length;
+	}
+	return true;
+}
+
+bool WildcardMask::Match(const std::string& str) const
+{
+	return Match(str.c_str());
+}
+
 bool InspIRCd::MatchMask(const std::string& masks, const std::string& hostname, const std::string& ipaddr)
 {
 	irc::spacesepstream masklist(masks);
@@ -135,15 +135,481 @@ class ZLineFactory : public XLineFactory
  *  bans. :)
  */
 
+/** Works out how the masks of lines and the hosts of users are indexed, used by XLineIndex and
+ * XLineUserIndex.
+ */
+class XLineMasks
+{
+ public:
+	enum Kind
+	{
+		KIND_RESIDUAL,
+		KIND_LITERAL,
+		KIND_SUFFIX,
+		KIND_CIDR,
+		KIND_IDENT
+	};
+
+	/** Lowercase a string with the ASCII case map */
+	static std::string Lower(const std::string& str)
+	{
+		std::string ret(str);
+		for (std::string::iterator i = ret.begin(); i != ret.end(); ++i)
+			*i = ascii_case_insensitive_map[static_cast<unsigned char>(*i)];
+		return ret;
+	}
+
+	/** Get the key of a CIDR mask in hash tables */
+	static std::string MakeKey(const irc::sockets::cidr_mask& mask)
+	{
+		std::string key(1, mask.type);
+		key.push_back(mask.length);
+		key.append(reinterpret_cast<const char*>(mask.bits), sizeof(mask.bits));
+		return key;
+	}
+
+	/** Check whether a mask has no wildcards and only has characters which are matched the same
+	 * way by every case map.
+	 */
+	static bool IsPlain(const std::string& mask)
+	{
+		for (std::string::const_iterator i = mask.begin(); i != mask.end(); ++i)
+		{
+			const char chr = *i;
+			if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9'))
+				continue;
+			if (chr == '.' || chr == ':' || chr == '-' || chr == '_' || chr == '/')
+				continue;
+			return false;
+		}
+		return true;
+	}
+
+	/** Check whether irc::sockets::MatchCIDR() treats a mask as a CIDR mask */
+	static bool IsCIDR(const std::string& mask)
+	{
+		const std::string::size_type per_pos = mask.rfind('/');
+		return ((per_pos != std::string::npos) && (per_pos != mask.length()-1)
+			&& (mask.find_first_not_of("0123456789", per_pos+1) == std::string::npos)
+			&& (mask.find_first_not_of("0123456789abcdefABCDEF.:") >= per_pos));
+	}
+
+	/** Remove an item from a multimap
+	 * @param bucket Multimap to remove the item from
+	 * @param key Key of the item
+	 * @param value Item to remove
+	 */
+	template <typename Bucket>
+	static void EraseFromBucket(Bucket& bucket, const std::string& key, typename Bucket::mapped_type value)
+	{
+		std::pair<typename Bucket::iterator, typename Bucket::iterator> range = bucket.equal_range(key);
+		for (typename Bucket::iterator i = range.first; i != range.second; ++i)
+		{
+			if (i->second == value)
+			{
+				bucket.erase(i);
+				return;
+			}
+		}
+	}
+
+	/** Append every item of a multimap having the given key to a vector */
+	template <typename Bucket>
+	static void FindInBucket(const Bucket& bucket, const std::string& key, std::vector<typename Bucket::mapped_type>& items)
+	{
+		std::pair<typename Bucket::const_iterator, typename Bucket::const_iterator> range = bucket.equal_range(key);
+		for (typename Bucket::const_iterator i = range.first; i != range.second; ++i)
+			items.push_back(i->second);
+	}
+
+	/** Work out where a line is filed
+	 * @param line Line to classify
+	 * @param key Set to the key of the line in its bucket
+	 * @param cidr Set to the CIDR mask of the line if it is filed by it
+	 * @return The bucket the line is filed in
+	 */
+	static Kind Classify(XLine* line, std::string& key, irc::sockets::cidr_mask& cidr)
+	{
+		std::string ident;
+		std::string host;
+		if (!line->GetMatchMasks(ident, host))
+			return KIND_RESIDUAL;
+
+		if (IsCIDR(host))
+		{
+			// Addresses which fail to parse compare equal to every host which isn't an IP
+			irc::sockets::sockaddrs sa;
+			if (!irc::sockets::aptosa(host.substr(0, host.rfind('/')), 0, sa))
+				return KIND_RESIDUAL;
+
+			cidr = irc::sockets::cidr_mask(host);
+			key = MakeKey(cidr);
+			return KIND_CIDR;
+		}
+
+		if (IsPlain(host))
+		{
+			key = Lower(host);
+			return KIND_LITERAL;
+		}
+
+		if ((host.length() > 1) && (host[0] == '*') && (IsPlain(host.substr(1))))
+		{
+			key = Lower(host.substr(1));
+			return KIND_SUFFIX;
+		}
+
+		if ((!ident.empty()) && (ident.find_first_of("*?") == std::string::npos))
+		{
+			key = Lower(ident);
+			return KIND_IDENT;
+		}
+
+		return KIND_RESIDUAL;
+	}
+};
+
+/** Index of the lines of one type.
+ * Lines are filed by the host mask they return from XLine::GetMatchMasks():
+ *  - Literal hosts and IPs (no wildcards) are kept in a hash table keyed by the lowercased host.
+ *  - Masks in the form of *suffix (e.g. *.example.com) are kept in a hash table keyed by the
+ *    lowercased suffix, and looked up with the suffixes of the host which have a length used by
+ *    at least one line.
+ *  - CIDR masks are kept in a hash table keyed by the masked address, and looked up with the
+ *    address of the user masked to every prefix length used by at least one line.
+ *  - Lines with any other host mask are filed by their ident mask if it has no wildcards.
+ *  - Everything else is kept in a residual set which is checked against every user.
+ * The index only narrows down the lines which might match a user, the candidates are still
+ * checked with XLine::Matches().
+ */
+class XLineIndex
+{
+	typedef TR1NS::unordered_multimap<std::string, XLine*> Bucket;
+	typedef std::map<std::string::size_type, size_t> SuffixLengths;
+	typedef std::map<std::pair<unsigned char, unsigned char>, size_t> CIDRLengths;
+
+	/** Lines with a literal host mask, keyed by the lowercased host */
+	Bucket literals;
+
+	/** Lines with a *suffix host mask, keyed by the lowercased suffix */
+	Bucket suffixes;
+
+	/** Number of lines in suffixes for each suffix length */
+	SuffixLengths suffixlengths;
+
+	/** Lines with a CIDR host mask, keyed by XLineMasks::MakeKey() of the mask */
+	Bucket cidrs;
+
+	/** Number of lines in cidrs for each address family and prefix length */
+	CIDRLengths cidrlengths;
+
+	/** Lines with a literal ident mask and a host mask which can't be indexed, keyed by the lowercased ident */
+	Bucket idents;
+
+	/** Lines which have to be checked against every user */
+	std::set<XLine*> residual;
+
+	template <typename Map, typename Key>
+	static void Release(Map& counts, const Key& key)
+	{
+		typename Map::iterator it = counts.find(key);
+		if ((it != counts.end()) && (--it->second == 0))
+			counts.erase(it);
+	}
+
+	void FindHost(const std::string& host, std::vector<XLine*>& lines) const
+	{
+		const std::string lowerhost = XLineMasks::Lower(host);
+		XLineMasks::FindInBucket(literals, lowerhost, lines);
+
+		for (SuffixLengths::const_iterator i = suffixlengths.begin(); i != suffixlengths.end(); ++i)
+		{
+			if (i->first > lowerhost.length())
+				break;
+			XLineMasks::FindInBucket(suffixes, lowerhost.substr(lowerhost.length() - i->first), lines);
+		}
+
+		if (cidrlengths.empty())
+			return;
+
+		irc::sockets::sockaddrs sa;
+		if (!irc::sockets::aptosa(host, 0, sa))
+			return;
+
+		for (CIDRLengths::const_iterator i = cidrlengths.begin(); i != cidrlengths.end(); ++i)
+		{
+			if (i->first.first == sa.sa.sa_family)
+				XLineMasks::FindInBucket(cidrs, XLineMasks::MakeKey(irc::sockets::cidr_mask(sa, i->first.second)), lines);
+		}
+	}
+
+ public:
+	void Add(XLine* line)
+	{
+		std::string key;
+		irc::sockets::cidr_mask cidr;
+		switch (XLineMasks::Classify(line, key, cidr))
+		{
+			case XLineMasks::KIND_LITERAL:
+				literals.insert(std::make_pair(key, line));
+				break;
+			case XLineMasks::KIND_SUFFIX:
+				suffixes.insert(std::make_pair(key, line));
+				suffixlengths[key.length()]++;
+				break;
+			case XLineMasks::KIND_CIDR:
+				cidrs.insert(std::make_pair(key, line));
+				cidrlengths[std::make_pair(cidr.type, cidr.length)]++;
+				break;
+			case XLineMasks::KIND_IDENT:
+				idents.insert(std::make_pair(key, line));
+				break;
+			case XLineMasks::KIND_RESIDUAL:
+				residual.insert(line);
+				break;
+		}
+	}
+
+	void Remove(XLine* line)
+	{
+		std::string key;
+		irc::sockets::cidr_mask cidr;
+		switch (XLineMasks::Classify(line, key, cidr))
+		{
+			case XLineMasks::KIND_LITERAL:
+				XLineMasks::EraseFromBucket(literals, key, line);
+				break;
+			case XLineMasks::KIND_SUFFIX:
+				XLineMasks::EraseFromBucket(suffixes, key, line);
+				Release(suffixlengths, key.length());
+				break;
+			case XLineMasks::KIND_CIDR:
+				XLineMasks::EraseFromBucket(cidrs, key, line);
+				Release(cidrlengths, std::make_pair(cidr.type, cidr.length));
+				break;
+			case XLineMasks::KIND_IDENT:
+				XLineMasks::EraseFromBucket(idents, key, line);
+				break;
+			case XLineMasks::KIND_RESIDUAL:
+				residual.erase(line);
+				break;
+		}
+	}
+
+	void Find(User* user, std::vector<XLine*>& lines) const
+	{
+		const std::vector<XLine*>::size_type first = lines.size();
+
+		FindHost(user->GetIPString(), lines);
+		if (user->GetRealHost() != user->GetIPString())
+			FindHost(user->GetRealHost(), lines);
+
+		XLineMasks::FindInBucket(idents, XLineMasks::Lower(user->ident), lines);
+		lines.insert(lines.end(), residual.begin(), residual.end());
+
+		// A line can be found through both the host and the IP of the user
+		std::sort(lines.begin() + first, lines.end());
+		lines.erase(std::unique(lines.begin() + first, lines.end()), lines.end());
+	}
+};
+
+/** Index of the local users, used to find the users a line might match without checking every user.
+ * Registered users are filed by their lowercased real host and IP address, by every suffix of those
+ * starting at a dot (e.g. .example.com for foo.example.com), by their address and by their ident.
+ * Unregistered users can still change their ident without telling anyone, so they are returned as
+ * candidates for every line.
+ */
+class XLineUserIndex
+{
+	typedef TR1NS::unordered_multimap<std::string, LocalUser*> Bucket;
+	typedef std::multimap<std::string, LocalUser*> AddressMap;
+
+	/** The keys a user is filed by, kept so the user can be removed after its details changed
+	 */
+	struct Entry
+	{
+		std::vector<std::string> hosts;
+		std::vector<std::string> domains;
+		std::vector<std::string> addresses;
+		std::string ident;
+	};
+	typedef TR1NS::unordered_map<LocalUser*, Entry> EntryMap;
+
+	/** Users keyed by their lowercased real host and IP address */
+	Bucket hosts;
+
+	/** Users keyed by the dot-suffixes of their lowercased real host and IP address */
+	Bucket domains;
+
+	/** Users keyed by MakeAddressKey() of their address, ordered so CIDR ranges can be looked up */
+	AddressMap addresses;
+
+	/** Users keyed by their lowercased ident */
+	Bucket idents;
+
+	/** Keys of every registered user in the index */
+	EntryMap entries;
+
+	/** Users who haven't registered yet */
+	std::set<LocalUser*> unregistered;
+
+	/** Get the key of an address in the address map, the host bits of IPv4 addresses are padded with zeroes */
+	static std::string MakeAddressKey(const irc::sockets::sockaddrs& sa)
+	{
+		std::string key(1 + 16, '\0');
+		key[0] = sa.sa.sa_family;
+		if (sa.sa.sa_family == AF_INET)
+			memcpy(&key[1], &sa.in4.sin_addr, 4);
+		else
+			memcpy(&key[1], &sa.in6.sin6_addr, 16);
+		return key;
+	}
+
+	static void AddHost(const std::string& host, Entry& entry)
+	{
+		const std::string lowerhost = XLineMasks::Lower(host);
+		entry.hosts.push_back(lowerhost);
+		for (std::string::size_type pos = lowerhost.find('.'); pos != std::string::npos; pos = lowerhost.find('.', pos + 1))
+			entry.domains.push_back(lowerhost.substr(pos));
+
+		irc::sockets::sockaddrs sa;
+		if ((irc::sockets::aptosa(host, 0, sa)) && ((sa.sa.sa_family == AF_INET) || (sa.sa.sa_family == AF_INET6)))
+			entry.addresses.push_back(MakeAddressKey(sa));
+	}
+
+	void Insert(LocalUser* user)
+	{
+		Entry& entry = entries[user];
+		AddHost(user->GetRealHost(), entry);
+		if (user->GetRealHost() != user->GetIPString())
+			AddHost(user->GetIPString(), entry);
+		entry.ident = XLineMasks::Lower(user->ident);
+
+		for (std::vector<std::string>::const_iterator i = entry.hosts.begin(); i != entry.hosts.end(); ++i)
+			hosts.insert(std::make_pair(*i, user));
+		for (std::vector<std::string>::const_iterator i = entry.domains.begin(); i != entry.domains.end(); ++i)
+			domains.insert(std::make_pair(*i, user));
+		for (std::vector<std::string>::const_iterator i = entry.addresses.begin(); i != entry.addresses.end(); ++i)
+			addresses.insert(std::make_pair(*i, user));
+		idents.insert(std::make_pair(entry.ident, user));
+	}
+
+	void Erase(LocalUser* user)
+	{
+		EntryMap::iterator it = entries.find(user);
+		if (it == entries.end())
+			return;
+
+		const Entry& entry = it->second;
+		for (std::vector<std::string>::const_iterator i = entry.hosts.begin(); i != entry.hosts.end(); ++i)
+			XLineMasks::EraseFromBucket(hosts, *i, user);
+		for (std::vector<std::string>::const_iterator i = entry.domains.begin(); i != entry.domains.end(); ++i)
+			XLineMasks::EraseFromBucket(domains, *i, user);
+		for (std::vector<std::string>::const_iterator i = entry.addresses.begin(); i != entry.addresses.end(); ++i)
+			XLineMasks::EraseFromBucket(addresses, *i, user);
+		XLineMasks::EraseFromBucket(idents, entry.ident, user);
+		entries.erase(it);
+	}
+
+ public:
+	/** Add a user to the index, or update its keys if it is in the index already */
+	void Add(LocalUser* user)
+	{
+		Erase(user);
+		if (user->registered == REG_ALL)
+		{
+			unregistered.erase(user);
+			Insert(user);
+		}
+		else
+			unregistered.insert(user);
+	}
+
+	void Remove(LocalUser* user)
+	{
+		Erase(user);
+		unregistered.erase(user);
+	}
+
+	/** Find the users a line might match
+	 * @param line Line to find the users for
+	 * @param users Vector to append the users to, every user is added at most once
+	 * @return False if the line can't be looked up in the index, in which case every local user might match
+	 */
+	bool Find(XLine* line, std::vector<LocalUser*>& users) const
+	{
+		const std::vector<LocalUser*>::size_type begin = users.size();
+		std::string key;
+		irc::sockets::cidr_mask cidr;
+		switch (XLineMasks::Classify(line, key, cidr))
+		{
+			case XLineMasks::KIND_LITERAL:
+				XLineMasks::FindInBucket(hosts, key, users);
+				break;
+
+			case XLineMasks::KIND_SUFFIX:
+			{
+				// Every host ending in "foo.example.com" also ends in ".example.com"
+				const std::string::size_type pos = key.find('.');
+				if (pos == std::string::npos)
+					return false;
+				XLineMasks::FindInBucket(domains, key.substr(pos), users);
+				break;
+			}
+
+			case XLineMasks::KIND_CIDR:
+			{
+				// Addresses in the range have the same prefix and any host bits
+				std::string first(1 + 16, '\0');
+				first[0] = cidr.type;
+				memcpy(&first[1], cidr.bits, 16);
+				std::string last(first);
+				const unsigned int addrbits = (cidr.type == AF_INET ? 32 : 128);
+				for (unsigned int bit = cidr.length; bit < addrbits; bit++)
+					last[1 + bit / 8] |= (0x80 >> (bit % 8));
+
+				const AddressMap::const_iterator end = addresses.upper_bound(last);
+				for (AddressMap::const_iterator i = addresses.lower_bound(first); i != end; ++i)
+					users.push_back(i->second);
+				break;
+			}
+
+			case XLineMasks::KIND_IDENT:
+				XLineMasks::FindInBucket(idents, key, users);
+				break;
+
+			case XLineMasks::KIND_RESIDUAL:
+				return false;
+		}
+
+		users.insert(users.end(), unregistered.begin(), unregistered.end());
+
+		// A user can be found through both its host and its IP
+		std::sort(users.begin() + begin, users.end());
+		users.erase(std::unique(users.begin() + begin, users.end()), users.end());
+		return true;
+	}
+};
+
 bool XLine::Matches(User *u)
 {
 	return false;
 }
 
+/** Match a host or IP against a compiled mask in the same way as InspIRCd::MatchCIDR() */
+static bool MatchHost(const std::string& host, const WildcardMask& mask)
+{
+	// A mask without a '/' can never be a valid CIDR mask so skip the copying done by irc::sockets::MatchCIDR()
+	if ((mask.GetMask().find('/') != std::string::npos) && (irc::sockets::MatchCIDR(host, mask.GetMask(), true)))
+		return true;
+
+	return mask.Match(host);
+}
+
 /*
  * Checks what users match a given vector of ELines and sets their ban exempt flag accordingly.
  */
-void XLineManager::CheckELines()
+void XLineManager::CheckELines(XLine* eline)
 {
 	ContainerIter n = lookup_lines.find("E");
 
@@ -155,25 +621,32 @@ void XLineManager::CheckELines()
 	if (ELines.empty())
 		return;
 
-	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
-	for (UserManager::LocalList::const_iterator u2 = list.begin(); u2 != list.end(); u2++)
+	// If an E-line was removed only the users it might have matched can lose their exemption
+	std::vector<LocalUser*> users;
+	if ((!eline) || (!FindUsers(eline, users)))
+	{
+		const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
+		for (UserManager::LocalList::const_iterator u2 = list.begin(); u2 != list.end(); u2++)
+			users.push_back(*u2);
+	}
+
+	std::vector<XLine*> candidates;
+	for (std::vector<LocalUser*>::const_iterator u2 = users.begin(); u2 != users.end(); ++u2)
 	{
 		LocalUser* u = *u2;
 		u->exempt = false;
 
-		/* This uses safe iteration to ensure that if a line expires here, it doenst trash the iterator */
-		LookupIter safei;
-
-		for (LookupIter i = ELines.begin(); i != ELines.end(); )
+		/* Lines are not expired here, Unset() of an expiring E-line calls this */
+		candidates.clear();
+		FindCandidates("E", u, candidates);
+		for (std::vector<XLine*>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
 		{
-			safei = i;
-			safei++;
-
-			XLine *e = i->second;
+			XLine *e = *i;
 			if ((!e->duration || ServerInstance->Time() < e->expiry) && e->Matches(u))
+			{
 				u->exempt = true;
-
-			i = safei;
+				break;
+			}
 		}
 	}
 }
@@ -284,6 +757,10 @@ bool XLineManager::AddLine(XLine* line, User* user)
 		pending_lines.push_back(line);
 
 	lookup_lines[line->type][line->Displayable()] = line;
+	XLineIndex*& index = line_indexes[line->type];
+	if (!index)
+		index = new XLineIndex;
+	index->Add(line);
 	line->OnAdd();
 
 	FOREACH_MOD(OnAddLine, (user, line));
@@ -312,6 +789,7 @@ bool XLineManager::DelLine(const char* hostmask, const std::string &type, User*
 
 	FOREACH_MOD(OnDelLine, (user, y->second));
 
+	line_indexes[type]->Remove(y->second);
 	y->second->Unset();
 
 	stdalgo::erase(pending_lines, y->second);
@@ -325,11 +803,18 @@ bool XLineManager::DelLine(const char* hostmask, const std::string &type, User*
 
 void ELine::Unset()
 {
-	ServerInstance->XLines->CheckELines();
+	ServerInstance->XLines->CheckELines(this);
 }
 
 // returns a pointer to the reason if a nickname matches a qline, NULL if it didnt match
 
+void XLineManager::FindCandidates(const std::string& type, User* user, std::vector<XLine*>& lines)
+{
+	std::map<std::string, XLineIndex*>::const_iterator index = line_indexes.find(type);
+	if (index != line_indexes.end())
+		index->second->Find(user, lines);
+}
+
 XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 {
 	ContainerIter x = lookup_lines.find(type);
@@ -339,27 +824,22 @@ XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 
 	const time_t current = ServerInstance->Time();
 
-	LookupIter safei;
+	// Only check the lines which the index says might match
+	std::vector<XLine*> candidates;
+	FindCandidates(type, user, candidates);
 
-	for (LookupIter i = x->second.begin(); i != x->second.end(); )
+	for (std::vector<XLine*>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
 	{
-		safei = i;
-		safei++;
-
-		if (i->second->duration && current > i->second->expiry)
+		XLine* line = *i;
+		if (line->duration && current > line->expiry)
 		{
 			/* Expire the line, proceed to next one */
-			ExpireLine(x, i);
-			i = safei;
+			ExpireLine(x, x->second.find(line->Displayable()));
 			continue;
 		}
 
-		if (i->second->Matches(user))
-		{
-			return i->second;
-		}
-
-		i = safei;
+		if (line->Matches(user))
+			return line;
 	}
 	return NULL;
 }
@@ -405,6 +885,7 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 	FOREACH_MOD(OnExpireLine, (item->second));
 
 	item->second->DisplayExpiry();
+	line_indexes[container->first]->Remove(item->second);
 	item->second->Unset();
 
 	/* TODO: Can we skip this loop by having a 'pending' field in the XLine class, which is set when a line
@@ -418,26 +899,71 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 }
 
 
+void XLineManager::IndexUser(LocalUser* user)
+{
+	user_index->Add(user);
+}
+
+void XLineManager::UnindexUser(LocalUser* user)
+{
+	user_index->Remove(user);
+}
+
+bool XLineManager::FindUsers(XLine* line, std::vector<LocalUser*>& users)
+{
+	return user_index->Find(line, users);
+}
+
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
-	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
-	for (UserManager::LocalList::const_iterator j = list.begin(); j != list.end(); ++j)
+	// Lines which can be looked up in the user index are only checked against the users they might
+	// match, the rest are checked against every local user in a single pass.
+	std::vector<XLine*> unindexed;
+	std::vector<LocalUser*> users;
+	for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
 	{
-		LocalUser* u = *j;
-
-		// Don't ban people who are exempt.
-		if (u->exempt)
+		XLine *x = *i;
+		users.clear();
+		if (!FindUsers(x, users))
+		{
+			unindexed.push_back(x);
 			continue;
+		}
 
-		for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+		for (std::vector<LocalUser*>::const_iterator j = users.begin(); j != users.end(); ++j)
 		{
-			XLine *x = *i;
+			LocalUser* u = *j;
+
+			// Don't ban people who are exempt or already banned.
+			if ((u->exempt) || (u->quitting))
+				continue;
+
 			if (x->Matches(u))
 				x->Apply(u);
 		}
 	}
 
+	if (!unindexed.empty())
+	{
+		const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
+		for (UserManager::LocalList::const_iterator j = list.begin(); j != list.end(); ++j)
+		{
+			LocalUser* u = *j;
+
+			// Don't ban people who are exempt.
+			if (u->exempt)
+				continue;
+
+			for (std::vector<XLine *>::iterator i = unindexed.begin(); i != unindexed.end(); i++)
+			{
+				XLine *x = *i;
+				if (x->Matches(u))
+					x->Apply(u);
+			}
+		}
+	}
+
 	pending_lines.clear();
 }
 
@@ -490,6 +1016,8 @@ XLineManager::XLineManager()
 	RegisterFactory(KFact);
 	RegisterFactory(QFact);
 	RegisterFactory(ZFact);
+
+	user_index = new XLineUserIndex;
 }
 
 XLineManager::~XLineManager()
@@ -509,6 +1037,11 @@ XLineManager::~XLineManager()
 			delete j->second;
 		}
 	}
+
+	for (std::map<std::string, XLineIndex*>::iterator i = line_indexes.begin(); i != line_indexes.end(); ++i)
+		delete i->second;
+
+	delete user_index;
 }
 
 void XLine::Apply(User* u)
@@ -546,10 +1079,9 @@ bool KLine::Matches(User *u)
 	if (lu && lu->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (this->identmatch.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->GetRealHost(), this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (MatchHost(u->GetRealHost(), this->hostmatch) || MatchHost(u->GetIPString(), this->hostmatch))
 		{
 			return true;
 		}
@@ -569,10 +1101,9 @@ bool GLine::Matches(User *u)
 	if (lu && lu->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (this->identmatch.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->GetRealHost(), this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (MatchHost(u->GetRealHost(), this->hostmatch) || MatchHost(u->GetIPString(), this->hostmatch))
 		{
 			return true;
 		}
@@ -592,10 +1123,9 @@ bool ELine::Matches(User *u)
 	if (lu && lu->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (this->identmatch.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->GetRealHost(), this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (MatchHost(u->GetRealHost(), this->hostmatch) || MatchHost(u->GetIPString(), this->hostmatch))
 		{
 			return true;
 		}
@@ -610,7 +1140,7 @@ bool ZLine::Matches(User *u)
 	if (lu && lu->exempt)
 		return false;
 
-	if (InspIRCd::MatchCIDR(u->GetIPString(), this->ipaddr))
+	if (MatchHost(u->GetIPString(), this->ipmatch))
 		return true;
 	else
 		return false;
@@ -624,7 +1154,7 @@ void ZLine::Apply(User* u)
 
 bool QLine::Matches(User *u)
 {
-	if (InspIRCd::Match(u->nick, this->nick))
+	if (this->nickmatch.Match(u->nick))
 		return true;
 
 	return false;
@@ -637,6 +1167,33 @@ void QLine::Apply(User* u)
 }
 
 
+bool KLine::GetMatchMasks(std::string& ident, std::string& host)
+{
+	ident = identmask;
+	host = hostmask;
+	return true;
+}
+
+bool GLine::GetMatchMasks(std::string& ident, std::string& host)
+{
+	ident = identmask;
+	host = hostmask;
+	return true;
+}
+
+bool ELine::GetMatchMasks(std::string& ident, std::string& host)
+{
+	ident = identmask;
+	host = hostmask;
+	return true;
+}
+
+bool ZLine::GetMatchMasks(std::string& ident, std::string& host)
+{
+	host = ipaddr;
+	return true;
+}
+
 bool ZLine::Matches(const std::string &str)
 {
 	if (InspIRCd::MatchCIDR(str, this->ipaddr))
@@ -670,9 +1227,16 @@ bool GLine::Matches(const std::string &str)
 
 void ELine::OnAdd()
 {
-	/* When adding one eline, only check the one eline */
-	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
-	for (UserManager::LocalList::const_iterator u2 = list.begin(); u2 != list.end(); u2++)
+	/* When adding one eline, only check the one eline against the users it might match */
+	std::vector<LocalUser*> users;
+	if (!ServerInstance->XLines->FindUsers(this, users))
+	{
+		const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
+		for (UserManager::LocalList::const_iterator u2 = list.begin(); u2 != list.end(); u2++)
+			users.push_back(*u2);
+	}
+
+	for (std::vector<LocalUser*>::const_iterator u2 = users.begin(); u2 != users.end(); ++u2)
 	{
 		LocalUser* u = *u2;
 		if (this->Matches(u))